@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/cryptography.h"
+#include "nearbyshare/cryptography/aesnicbc.h"
+#include "nearbyshare/cryptography/avx2hmacsha256.h"
+#include "nearbyshare/cryptography/cryptoengine.h"
+#include <QRandomGenerator>
+#include <benchmark/benchmark.h>
+
+// Baseline numbers for the crypto paths used per frame and per connection.
+//
+// Engine specific benchmarks are registered once for every engine built into the library and named
+// "<operation>/<engine>", so a single run compares the backends. BM_AesNiCbcDecrypt/<kernel> covers the decrypt
+// kernels that cached decryption keys use on x86, next to BM_Aes256CbcDecrypt/<engine> for the engines' own code, and
+// BM_Avx2HmacSha256 the batch HMAC kernel next to BM_HmacSha256Batch/<engine>. Use --benchmark_format=json (or the
+// crypto-bench-json target) for machine readable output.
+
+namespace {
+    void bulkArguments(benchmark::internal::Benchmark* benchmark) {
+        benchmark->ArgName("bytes")->RangeMultiplier(4)->Range(1024, 4 * 1024 * 1024);
+    }
+
+    void BM_Aes256CbcEncrypt(benchmark::State& state, CryptoEngine* engine) {
+        QByteArray key(32, 'K');
+        QByteArray iv(16, 'I');
+        QByteArray input(state.range(0), 'X');
+        QByteArray output(input.length() + 16, Qt::Uninitialized);
+
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(engine->aes256cbc(input.constData(), input.length(), output.data(), key, iv, true));
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0));
+    }
+
+    void BM_Aes256CbcDecrypt(benchmark::State& state, CryptoEngine* engine) {
+        QByteArray key(32, 'K');
+        QByteArray iv(16, 'I');
+        QByteArray plaintext(state.range(0), 'X');
+        QByteArray input(plaintext.length() + 16, Qt::Uninitialized);
+        input.truncate(engine->aes256cbc(plaintext.constData(), plaintext.length(), input.data(), key, iv, true));
+        QByteArray output(input.length() + 16, Qt::Uninitialized);
+
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(engine->aes256cbc(input.constData(), input.length(), output.data(), key, iv, false));
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0));
+    }
+
+    void BM_AesNiCbcDecrypt(benchmark::State& state, AesNiCbc::DecryptKernel kernel) {
+        QByteArray key(32, 'K');
+        QByteArray iv(16, 'I');
+        auto input = Cryptography::aes256cbcEncrypt(QByteArray(state.range(0), 'X'), key, iv);
+        QByteArray output(input.length(), Qt::Uninitialized);
+        AesNiCbc aesNi(key);
+        aesNi.setDecryptKernel(kernel);
+
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(aesNi.decrypt(input.constData(), input.length(), output.data(), iv));
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0));
+    }
+
+    // The per session path used by NearbySocket, with the key schedule already expanded
+    void BM_Aes256CbcEncryptCachedKey(benchmark::State& state, CryptoEngine* engine) {
+        QByteArray iv(16, 'I');
+        QByteArray input(state.range(0), 'X');
+        QByteArray output(input.length() + 16, Qt::Uninitialized);
+        auto key = engine->createAes256CbcKey(QByteArray(32, 'K'), true);
+
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(engine->aes256cbc(key, input.constData(), input.length(), output.data(), iv));
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0));
+
+        delete key;
+    }
+
+    // Eight frames of the given size at once, as the payload send path submits them
+    void BM_Aes256CbcEncryptBatch(benchmark::State& state, CryptoEngine* engine) {
+        constexpr auto frames = 8;
+        QByteArray iv(16, 'I');
+        QByteArray input(state.range(0), 'X');
+        QByteArray output(frames * (input.length() + 16), Qt::Uninitialized);
+        auto key = engine->createAes256CbcKey(QByteArray(32, 'K'), true);
+
+        Aes256CbcJob jobs[frames];
+        for (auto i = 0; i < frames; i++) {
+            jobs[i].input = input.constData();
+            jobs[i].length = input.length();
+            jobs[i].output = output.data() + i * (input.length() + 16);
+            jobs[i].iv = iv;
+        }
+
+        for (auto _ : state) {
+            engine->aes256cbcEncryptBatch(key, jobs, frames);
+            benchmark::DoNotOptimize(jobs[0].written);
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0) * frames);
+
+        delete key;
+    }
+
+    // Encryption and authentication in one pass, to compare with BM_Aes256CbcEncryptCachedKey plus BM_HmacSha256CachedKey
+    void BM_Aes256GcmEncrypt(benchmark::State& state, CryptoEngine* engine) {
+        QByteArray iv(Cryptography::Aes256GcmIvLength, 'I');
+        QByteArray associatedData(64, 'H');
+        QByteArray input(state.range(0), 'X');
+        QByteArray output(input.length(), Qt::Uninitialized);
+        char tag[Cryptography::Aes256GcmTagLength];
+        auto key = engine->createAes256GcmKey(QByteArray(32, 'K'), true);
+
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(engine->aes256gcmEncrypt(key, input.constData(), input.length(), output.data(), iv, associatedData, tag));
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0));
+
+        delete key;
+    }
+
+    void BM_Aes256GcmDecrypt(benchmark::State& state, CryptoEngine* engine) {
+        QByteArray iv(Cryptography::Aes256GcmIvLength, 'I');
+        QByteArray associatedData(64, 'H');
+        QByteArray input(state.range(0), 'X');
+        QByteArray ciphertext(input.length(), Qt::Uninitialized);
+        QByteArray output(input.length(), Qt::Uninitialized);
+        QByteArray tag(Cryptography::Aes256GcmTagLength, Qt::Uninitialized);
+        auto encryptKey = engine->createAes256GcmKey(QByteArray(32, 'K'), true);
+        auto key = engine->createAes256GcmKey(QByteArray(32, 'K'), false);
+        engine->aes256gcmEncrypt(encryptKey, input.constData(), input.length(), ciphertext.data(), iv, associatedData, tag.data());
+
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(engine->aes256gcmDecrypt(key, ciphertext.constData(), ciphertext.length(), output.data(), iv, associatedData, tag));
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0));
+
+        delete encryptKey;
+        delete key;
+    }
+
+    void BM_HmacSha256CachedKey(benchmark::State& state, CryptoEngine* engine) {
+        QByteArray input(state.range(0), 'X');
+        auto key = engine->createHmacSha256Key(QByteArray(32, 'K'));
+
+        for (auto _ : state) {
+            engine->hmacSha256Begin(key);
+            engine->hmacSha256Update(key, input.constData(), input.length());
+            benchmark::DoNotOptimize(engine->hmacSha256Finish(key));
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0));
+
+        delete key;
+    }
+
+    // Eight frames at once, as the payload send path signs them. Engines only hash them side by side where
+    // Avx2HmacSha256::isPreferred(); elsewhere this is eight BM_HmacSha256CachedKey runs.
+    void BM_HmacSha256Batch(benchmark::State& state, CryptoEngine* engine) {
+        constexpr auto frames = 8;
+        QByteArray input(state.range(0), 'X');
+        QByteArray signatures(frames * 32, Qt::Uninitialized);
+        auto key = engine->createHmacSha256Key(QByteArray(32, 'K'));
+
+        HmacSha256Job jobs[frames];
+        for (auto i = 0; i < frames; i++) jobs[i] = {input.constData(), input.length(), signatures.data() + i * 32};
+
+        for (auto _ : state) {
+            engine->hmacSha256Batch(key, jobs, frames);
+            benchmark::DoNotOptimize(signatures.data());
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0) * frames);
+
+        delete key;
+    }
+
+    // The AVX2 kernel on its own, whether or not the engines would pick it on this processor
+    void BM_Avx2HmacSha256(benchmark::State& state) {
+        constexpr auto frames = Avx2HmacSha256::Lanes;
+        QByteArray input(state.range(0), 'X');
+        QByteArray signatures(frames * 32, Qt::Uninitialized);
+        Avx2HmacSha256 avx2(QByteArray(32, 'K'));
+
+        HmacSha256Job jobs[frames];
+        for (auto i = 0; i < frames; i++) jobs[i] = {input.constData(), input.length(), signatures.data() + i * 32};
+
+        for (auto _ : state) {
+            avx2.signBatch(jobs, frames);
+            benchmark::DoNotOptimize(signatures.data());
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0) * frames);
+    }
+
+    void BM_GenerateEcdsaKeyPair(benchmark::State& state, CryptoEngine* engine) {
+        for (auto _ : state) {
+            delete engine->generateEcdsaKeyPair();
+        }
+    }
+
+    void BM_DiffieHellman(benchmark::State& state, CryptoEngine* engine) {
+        auto ourKey = engine->generateEcdsaKeyPair();
+        auto peerKey = engine->generateEcdsaKeyPair();
+        auto peerX = engine->ecdsaX(peerKey);
+        auto peerY = engine->ecdsaY(peerKey);
+
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(engine->diffieHellman(ourKey, peerX, peerY));
+        }
+
+        delete ourKey;
+        delete peerKey;
+    }
+
+    void BM_GenerateX25519KeyPair(benchmark::State& state, CryptoEngine* engine) {
+        for (auto _ : state) {
+            auto key = engine->generateX25519KeyPair();
+            benchmark::DoNotOptimize(engine->x25519PublicKey(key));
+            delete key;
+        }
+    }
+
+    void BM_X25519DiffieHellman(benchmark::State& state, CryptoEngine* engine) {
+        auto ourKey = engine->generateX25519KeyPair();
+        auto peerKey = engine->generateX25519KeyPair();
+        auto peerPublicKey = engine->x25519PublicKey(peerKey);
+
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(engine->x25519DiffieHellman(ourKey, peerPublicKey));
+        }
+
+        delete ourKey;
+        delete peerKey;
+    }
+
+    void BM_HkdfExtractExpand(benchmark::State& state, CryptoEngine* engine) {
+        QByteArray salt(32, 'S');
+        QByteArray ikm(32, 'I');
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(engine->hkdfExtractExpand(salt, ikm, "ENC:2", 32));
+        }
+    }
+
+    // The ENC and SIG keys for one direction of a session, sharing a single extract step
+    void BM_HkdfExtractOnceExpandTwice(benchmark::State& state, CryptoEngine* engine) {
+        QByteArray salt(32, 'S');
+        QByteArray ikm(32, 'I');
+        for (auto _ : state) {
+            auto prk = engine->hkdfExtract(salt, ikm);
+            benchmark::DoNotOptimize(engine->hkdfExpand(prk, "ENC:2", 32));
+            benchmark::DoNotOptimize(engine->hkdfExpand(prk, "SIG:1", 32));
+        }
+    }
+
+    // Qt's HMAC, which hmacSha256Signature uses when it is given a raw key
+    void BM_HmacSha256Signature(benchmark::State& state) {
+        QByteArray key(32, 'K');
+        QByteArray input(state.range(0), 'X');
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(Cryptography::hmacSha256Signature(input, key));
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0));
+    }
+
+    // One IV per encrypted frame
+    void BM_RandomBytes(benchmark::State& state) {
+        for (auto _ : state) {
+            benchmark::DoNotOptimize(Cryptography::randomBytes(state.range(0)));
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0));
+    }
+
+    // What randomBytes did before the per thread generator, kept as a baseline
+    void BM_SecurelySeededRandomBytes(benchmark::State& state) {
+        for (auto _ : state) {
+            QByteArray bytes(state.range(0), Qt::Uninitialized);
+            QRandomGenerator::securelySeeded().fillRange(reinterpret_cast<quint32*>(bytes.data()), bytes.size() / 4);
+            benchmark::DoNotOptimize(bytes);
+        }
+        state.SetBytesProcessed(state.iterations() * state.range(0));
+    }
+
+    void registerEngineBenchmarks() {
+        for (const auto& name : Cryptography::availableEngines()) {
+            auto engine = Cryptography::engine(name);
+            auto benchmarkName = [&name](const char* operation) {
+                return std::string(operation) + "/" + name.toStdString();
+            };
+
+            benchmark::RegisterBenchmark(benchmarkName("BM_Aes256CbcEncrypt").c_str(), BM_Aes256CbcEncrypt, engine)->Apply(bulkArguments);
+            benchmark::RegisterBenchmark(benchmarkName("BM_Aes256CbcDecrypt").c_str(), BM_Aes256CbcDecrypt, engine)->Apply(bulkArguments);
+            benchmark::RegisterBenchmark(benchmarkName("BM_Aes256CbcEncryptCachedKey").c_str(), BM_Aes256CbcEncryptCachedKey, engine)->Apply(bulkArguments);
+            benchmark::RegisterBenchmark(benchmarkName("BM_Aes256CbcEncryptBatch").c_str(), BM_Aes256CbcEncryptBatch, engine)->Apply(bulkArguments);
+            benchmark::RegisterBenchmark(benchmarkName("BM_Aes256GcmEncrypt").c_str(), BM_Aes256GcmEncrypt, engine)->Apply(bulkArguments);
+            benchmark::RegisterBenchmark(benchmarkName("BM_Aes256GcmDecrypt").c_str(), BM_Aes256GcmDecrypt, engine)->Apply(bulkArguments);
+            benchmark::RegisterBenchmark(benchmarkName("BM_HmacSha256CachedKey").c_str(), BM_HmacSha256CachedKey, engine)->Apply(bulkArguments);
+            benchmark::RegisterBenchmark(benchmarkName("BM_HmacSha256Batch").c_str(), BM_HmacSha256Batch, engine)->Apply(bulkArguments);
+            benchmark::RegisterBenchmark(benchmarkName("BM_GenerateEcdsaKeyPair").c_str(), BM_GenerateEcdsaKeyPair, engine);
+            benchmark::RegisterBenchmark(benchmarkName("BM_DiffieHellman").c_str(), BM_DiffieHellman, engine);
+            benchmark::RegisterBenchmark(benchmarkName("BM_GenerateX25519KeyPair").c_str(), BM_GenerateX25519KeyPair, engine);
+            benchmark::RegisterBenchmark(benchmarkName("BM_X25519DiffieHellman").c_str(), BM_X25519DiffieHellman, engine);
+            benchmark::RegisterBenchmark(benchmarkName("BM_HkdfExtractExpand").c_str(), BM_HkdfExtractExpand, engine);
+            benchmark::RegisterBenchmark(benchmarkName("BM_HkdfExtractOnceExpandTwice").c_str(), BM_HkdfExtractOnceExpandTwice, engine);
+        }
+
+        if (AesNiCbc::isSupported(AesNiCbc::AesNiKernel)) {
+            benchmark::RegisterBenchmark("BM_AesNiCbcDecrypt/aesni", BM_AesNiCbcDecrypt, AesNiCbc::AesNiKernel)->Apply(bulkArguments);
+        }
+        if (AesNiCbc::isSupported(AesNiCbc::VaesKernel)) {
+            benchmark::RegisterBenchmark("BM_AesNiCbcDecrypt/vaes", BM_AesNiCbcDecrypt, AesNiCbc::VaesKernel)->Apply(bulkArguments);
+        }
+        if (Avx2HmacSha256::isSupported()) {
+            benchmark::RegisterBenchmark("BM_Avx2HmacSha256", BM_Avx2HmacSha256)->Apply(bulkArguments);
+        }
+    }
+} // namespace
+
+BENCHMARK(BM_HmacSha256Signature)->Apply(bulkArguments);
+BENCHMARK(BM_RandomBytes)->Arg(16)->Arg(32);
+BENCHMARK(BM_SecurelySeededRandomBytes)->Arg(16)->Arg(32);
+
+int main(int argc, char** argv) {
+    registerEngineBenchmarks();
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/framedecoder.h"
+#include <QBuffer>
+#include <QtEndian>
+#include <benchmark/benchmark.h>
+
+// Feeds a stream of length prefixed frames into a decoder in reads of a fixed size.
+// Small reads simulate fragmented TCP segments, large reads simulate several frames coalesced into one readyRead.
+
+namespace {
+    QByteArray buildStream(qsizetype frameSize, int frameCount) {
+        QByteArray frame(frameSize, 'X');
+        auto beLength = qToBigEndian<quint32>(frameSize);
+
+        QByteArray stream;
+        stream.reserve((frameSize + 4) * frameCount);
+        for (auto i = 0; i < frameCount; i++) {
+            stream.append(reinterpret_cast<const char*>(&beLength), 4);
+            stream.append(frame);
+        }
+        return stream;
+    }
+
+    // The decoding loop NearbySocket::readBuffer used before FrameDecoder, kept as a baseline
+    struct LegacyDecoder {
+            QBuffer buffer;
+            quint32 packetLength = 0;
+            QByteArray packetData;
+
+            template<typename F> void feed(const QByteArray& data, F frameCallback) {
+                buffer.open(QBuffer::ReadWrite);
+                buffer.write(data);
+                buffer.seek(0);
+
+                while (!buffer.atEnd()) {
+                    if (packetLength == 0) {
+                        auto packetLengthBytes = buffer.read(4);
+                        if (packetLengthBytes.length() != 4) {
+                            buffer.close();
+                            buffer.setData(packetLengthBytes);
+                            return;
+                        }
+                        packetLength = qFromBigEndian(*reinterpret_cast<quint32*>(packetLengthBytes.data()));
+                    }
+
+                    while (packetLength > 0 && !buffer.atEnd()) {
+                        auto buf = buffer.read(packetLength);
+                        packetData.append(buf);
+                        packetLength -= buf.length();
+                    }
+
+                    if (packetLength == 0) {
+                        frameCallback(packetData);
+                        packetData.clear();
+                    }
+                }
+
+                buffer.close();
+                buffer.setData(QByteArray());
+            }
+    };
+
+    void BM_FrameDecoder(benchmark::State& state) {
+        auto stream = buildStream(state.range(0), 16);
+        auto readSize = state.range(1);
+
+        FrameDecoder decoder;
+        for (auto _ : state) {
+            for (qsizetype offset = 0; offset < stream.length(); offset += readSize) {
+                auto length = qMin<qsizetype>(readSize, stream.length() - offset);
+
+                // Equivalent of QIODevice::read into the decoder's buffer
+                std::memcpy(decoder.prepareWrite(length), stream.constData() + offset, length);
+                decoder.commitWrite(length);
+
+                QByteArrayView frame;
+                while (decoder.nextFrame(&frame)) {
+                    benchmark::DoNotOptimize(frame.data());
+                }
+            }
+        }
+
+        state.SetBytesProcessed(state.iterations() * stream.length());
+    }
+
+    void BM_LegacyDecoder(benchmark::State& state) {
+        auto stream = buildStream(state.range(0), 16);
+        auto readSize = state.range(1);
+
+        LegacyDecoder decoder;
+        for (auto _ : state) {
+            for (qsizetype offset = 0; offset < stream.length(); offset += readSize) {
+                // Equivalent of QIODevice::readAll
+                auto data = stream.mid(offset, readSize);
+                decoder.feed(data, [](const QByteArray& frame) {
+                    benchmark::DoNotOptimize(frame.data());
+                });
+            }
+        }
+
+        state.SetBytesProcessed(state.iterations() * stream.length());
+    }
+
+    void frameArguments(benchmark::internal::Benchmark* benchmark) {
+        benchmark->ArgNames({"frame", "read"});
+        for (auto frameSize : {256, 64 * 1024, 512 * 1024}) {
+            // Fragmented: one TCP segment per read
+            benchmark->Args({frameSize, 1448});
+            // Typical socket notifier read
+            benchmark->Args({frameSize, 64 * 1024});
+            // Coalesced: several frames per read
+            benchmark->Args({frameSize, 4 * 1024 * 1024});
+        }
+    }
+} // namespace
+
+BENCHMARK(BM_FrameDecoder)->Apply(frameArguments);
+BENCHMARK(BM_LegacyDecoder)->Apply(frameArguments);
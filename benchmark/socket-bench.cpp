@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/bufferpool.h"
+#include "nearbyshare/nearbysocket.h"
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QHostAddress>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <benchmark/benchmark.h>
+#include <cstring>
+
+// Sends a payload between two NearbySockets over TCP with different write watermarks, to show how much the write
+// queue gains over writing one frame at a time (watermarks of 0).
+//
+// By default both ends run in this process over loopback. To measure a real link, run `socket-bench --serve=PORT`
+// on the receiving machine and `socket-bench --peer=HOST:PORT` on the sending one.
+
+namespace {
+    constexpr qint64 TransferSize = 64 * 1024 * 1024;
+    constexpr qint64 PacketSize = 512 * 1024;
+
+    QString peerHost;
+    quint16 peerPort = 0;
+
+    bool waitForEncryption(NearbySocket* socket) {
+        QEventLoop loop;
+        QObject::connect(socket, &NearbySocket::readyForEncryptedMessages, &loop, &QEventLoop::quit);
+        QObject::connect(socket, &NearbySocket::disconnected, &loop, &QEventLoop::quit);
+        loop.exec();
+        return socket->active();
+    }
+
+    // Accepts connections and receives payloads until the process is stopped
+    int serve(quint16 port) {
+        QTcpServer server;
+        if (!server.listen(QHostAddress::Any, port)) {
+            QTextStream(stderr) << "Could not listen on port " << port << "\n";
+            return 1;
+        }
+
+        QObject::connect(&server, &QTcpServer::newConnection, &server, [&server] {
+            while (auto connection = server.nextPendingConnection()) {
+                auto socket = new NearbySocket(connection, true, connection);
+                QObject::connect(socket, &NearbySocket::disconnected, connection, &QObject::deleteLater);
+            }
+        });
+        return QCoreApplication::exec();
+    }
+
+    void BM_PayloadTransfer(benchmark::State& state) {
+        QTcpServer server;
+        NearbySocket* receiver = nullptr;
+        if (peerHost.isEmpty()) {
+            server.listen(QHostAddress::LocalHost);
+            QObject::connect(&server, &QTcpServer::newConnection, &server, [&server, &receiver] {
+                auto connection = server.nextPendingConnection();
+                receiver = new NearbySocket(connection, true, connection);
+            });
+        }
+
+        auto connection = new QTcpSocket();
+        connection->connectToHost(peerHost.isEmpty() ? QStringLiteral("127.0.0.1") : peerHost, peerHost.isEmpty() ? server.serverPort() : peerPort);
+        auto sender = new NearbySocket(connection, false, connection);
+        if (!waitForEncryption(sender)) {
+            state.SkipWithError("Could not connect");
+            delete connection;
+            return;
+        }
+        sender->setWriteWatermarks(state.range(0) * 1024, state.range(1) * 1024);
+
+        QByteArray packet(PacketSize, 'W');
+        qint64 id = 1;
+        auto hits = BufferPool::instance()->hits();
+        auto misses = BufferPool::instance()->misses();
+        for (auto _ : state) {
+            QEventLoop loop;
+            qint64 offset = 0;
+            auto sendNext = [&] {
+                if (offset == TransferSize) return;
+                offset += PacketSize;
+                sender->sendPayloadPacket(packet, id, NearbySocket::Bytes, offset - PacketSize, offset == TransferSize, TransferSize);
+            };
+
+            // Over loopback the transfer is done when the receiver has the whole payload. A remote receiver can't say
+            // so, so there it is done once everything has been handed to the kernel.
+            QMetaObject::Connection done;
+            if (receiver) {
+                done = QObject::connect(receiver, &NearbySocket::messageReceived, &loop, &QEventLoop::quit);
+            }
+            auto ready = QObject::connect(sender, &NearbySocket::readyForNextPacket, &loop, [&] {
+                if (!receiver && offset == TransferSize) {
+                    loop.quit();
+                    return;
+                }
+                sendNext();
+            }, Qt::QueuedConnection);
+
+            sendNext();
+            loop.exec();
+
+            QObject::disconnect(ready);
+            QObject::disconnect(done);
+            id++;
+        }
+        state.SetBytesProcessed(state.iterations() * TransferSize);
+
+        // Once warmed up, every frame should come from the buffer pool
+        auto pool = BufferPool::instance();
+        state.counters["pool_hits"] = benchmark::Counter(pool->hits() - hits, benchmark::Counter::kAvgIterations);
+        state.counters["pool_misses"] = benchmark::Counter(pool->misses() - misses, benchmark::Counter::kAvgIterations);
+
+        delete connection;
+    }
+} // namespace
+
+// Watermarks in KiB: one frame at a time, then queues either side of the default (256/1024) to pick it from
+BENCHMARK(BM_PayloadTransfer)->Args({0, 0})->Args({64, 256})->Args({128, 512})->Args({256, 1024})->Args({512, 2048})->Args({1024, 4096})->Unit(benchmark::kMillisecond)->UseRealTime();
+
+int main(int argc, char** argv) {
+    QCoreApplication app(argc, argv);
+
+    for (auto i = 1; i < argc; i++) {
+        auto argument = QString::fromLocal8Bit(argv[i]);
+        if (argument.startsWith("--serve=")) {
+            return serve(argument.mid(8).toUShort());
+        } else if (argument.startsWith("--peer=")) {
+            auto peer = argument.mid(7);
+            peerHost = peer.section(':', 0, 0);
+            peerPort = peer.section(':', 1, 1).toUShort();
+
+            // Google Benchmark rejects arguments it doesn't know
+            std::memmove(argv + i, argv + i + 1, (argc - i) * sizeof(char*));
+            argc--;
+            i--;
+        }
+    }
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
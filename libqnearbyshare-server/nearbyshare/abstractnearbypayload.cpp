@@ -64,14 +64,14 @@ qint64 AbstractNearbyPayload::id() {
     return d->id;
 }
 
-void AbstractNearbyPayload::loadChunk(quint64 offset, const QByteArray& body) {
+void AbstractNearbyPayload::loadChunk(quint64 offset, QByteArrayView body) {
     if (d->read != offset) {
         // Stop!
         QTextStream(stderr) << "Nearby Payload offset jumped unexpectedly\n";
         return;
     }
-    d->output->write(body);
-    d->read += body.length();
+    d->output->write(body.data(), body.size());
+    d->read += body.size();
     emit transferredChanged();
 }
 
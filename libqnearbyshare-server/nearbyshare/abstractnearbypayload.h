@@ -26,6 +26,7 @@
 #define QNEARBYSHARE_ABSTRACTNEARBYPAYLOAD_H
 
 #include <QByteArray>
+#include <QByteArrayView>
 #include <QObject>
 #include <QSharedPointer>
 
@@ -38,7 +39,7 @@ class AbstractNearbyPayload : public QObject {
         ~AbstractNearbyPayload();
 
         void setOutput(QIODevice* output);
-        void loadChunk(quint64 offset, const QByteArray& body);
+        void loadChunk(quint64 offset, QByteArrayView body);
 
         void setCompleted();
         bool completed();
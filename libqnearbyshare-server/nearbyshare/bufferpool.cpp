@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "bufferpool.h"
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <algorithm>
+#include <atomic>
+
+namespace {
+    constexpr int ClassesPerDoubling = 8;
+
+    QList<qsizetype> classSizes() {
+        // Eight steps to each doubling, but never steps smaller than MinimumClassSize
+        QList<qsizetype> sizes;
+        for (auto size = BufferPool::MinimumClassSize; size <= BufferPool::MaximumClassSize;) {
+            sizes.append(size);
+            auto doubling = size;
+            while (doubling & (doubling - 1)) doubling &= doubling - 1;
+            size += qMax(BufferPool::MinimumClassSize, doubling / ClassesPerDoubling);
+        }
+        return sizes;
+    }
+} // namespace
+
+struct BufferPoolPrivate {
+        QMutex mutex;
+        QList<qsizetype> classSizes;
+        QList<QList<QByteArray>> buffers;
+        qint64 pooledBytes = 0;
+        qint64 maximumBytes = BufferPool::DefaultMaximumBytes;
+
+        std::atomic<quint64> hits = 0;
+        std::atomic<quint64> misses = 0;
+};
+
+BufferPool* BufferPool::instance() {
+    // Intentionally never destroyed so that buffers recycled by worker threads at exit never touch a dead pool
+    static auto pool = new BufferPool();
+    return pool;
+}
+
+BufferPool::BufferPool() {
+    d = new BufferPoolPrivate();
+    d->classSizes = classSizes();
+    d->buffers.resize(d->classSizes.size());
+
+    bool ok;
+    auto size = qEnvironmentVariableIntValue("QNEARBYSHARE_BUFFER_POOL_SIZE", &ok);
+    if (ok && size >= 0) d->maximumBytes = static_cast<qint64>(size) * 1024 * 1024;
+}
+
+BufferPool::~BufferPool() {
+    delete d;
+}
+
+QByteArray BufferPool::take(qsizetype size) {
+    if (size > MaximumClassSize) {
+        d->misses++;
+        return QByteArray(size, Qt::Uninitialized);
+    }
+
+    // The smallest class that fits
+    auto index = std::lower_bound(d->classSizes.cbegin(), d->classSizes.cend(), size) - d->classSizes.cbegin();
+    QByteArray buffer;
+    auto hit = false;
+    {
+        QMutexLocker locker(&d->mutex);
+        auto& buffers = d->buffers[index];
+        if (!buffers.isEmpty()) {
+            buffer = buffers.takeLast();
+            d->pooledBytes -= buffer.capacity();
+            hit = true;
+        }
+    }
+
+    if (hit) {
+        d->hits++;
+    } else {
+        d->misses++;
+        buffer = QByteArray(d->classSizes.at(index), Qt::Uninitialized);
+    }
+
+    // Shrinking doesn't give up the capacity, so the whole class size is still there when it comes back
+    buffer.resize(size);
+    return buffer;
+}
+
+void BufferPool::recycle(QByteArray&& buffer) {
+    auto recycled = std::move(buffer);
+
+    // Views made with QByteArray::fromRawData() have no capacity, so they never get this far
+    auto capacity = recycled.capacity();
+    if (capacity < MinimumClassSize || capacity > MaximumClassSize || !recycled.isDetached()) return;
+
+    // The largest class it can hold
+    auto index = std::upper_bound(d->classSizes.cbegin(), d->classSizes.cend(), capacity) - d->classSizes.cbegin() - 1;
+
+    QMutexLocker locker(&d->mutex);
+    if (d->pooledBytes + capacity > d->maximumBytes) return;
+    d->pooledBytes += capacity;
+    d->buffers[index].append(std::move(recycled));
+}
+
+void BufferPool::setMaximumBytes(qint64 maximumBytes) {
+    QMutexLocker locker(&d->mutex);
+    d->maximumBytes = maximumBytes;
+
+    // Free the biggest buffers first, since they are the least likely to be asked for again
+    for (qsizetype index = d->buffers.size() - 1; index >= 0 && d->pooledBytes > maximumBytes; index--) {
+        auto& buffers = d->buffers[index];
+        while (!buffers.isEmpty() && d->pooledBytes > maximumBytes) {
+            d->pooledBytes -= buffers.takeLast().capacity();
+        }
+    }
+}
+
+qint64 BufferPool::maximumBytes() {
+    QMutexLocker locker(&d->mutex);
+    return d->maximumBytes;
+}
+
+qint64 BufferPool::pooledBytes() {
+    QMutexLocker locker(&d->mutex);
+    return d->pooledBytes;
+}
+
+quint64 BufferPool::hits() {
+    return d->hits;
+}
+
+quint64 BufferPool::misses() {
+    return d->misses;
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_BUFFERPOOL_H
+#define QNEARBYSHARE_BUFFERPOOL_H
+
+#include <QByteArray>
+
+struct BufferPoolPrivate;
+
+// Keeps large buffers that are done with so the next frame or chunk of the same size can reuse them, rather than
+// going back to malloc for every one.
+//
+// Buffers are grouped into size classes, eight to each doubling from MinimumClassSize up to MaximumClassSize, so a
+// buffer is never more than an eighth bigger than what was asked for. take() hands out a buffer from the smallest
+// class that fits, and recycle() puts it back into the largest class it can hold. Buffers that something else still
+// refers to are left alone, so recycling is always safe, just not always possible. At most maximumBytes() are kept;
+// anything over that is freed as usual.
+//
+// The pool is shared by every thread and defaults to DefaultMaximumBytes, which can be overridden (in MiB) with the
+// QNEARBYSHARE_BUFFER_POOL_SIZE environment variable or setMaximumBytes(). A size of 0 disables the pool.
+class BufferPool {
+    public:
+        static BufferPool* instance();
+
+        BufferPool(const BufferPool&) = delete;
+        BufferPool& operator=(const BufferPool&) = delete;
+
+        static constexpr qsizetype MinimumClassSize = 4 * 1024;
+        static constexpr qsizetype MaximumClassSize = 8 * 1024 * 1024;
+        static constexpr qint64 DefaultMaximumBytes = 64 * 1024 * 1024;
+
+        // A buffer of size bytes, which are left uninitialised
+        QByteArray take(qsizetype size);
+
+        // Keeps buffer for reuse if nothing else refers to it. The buffer is left empty either way.
+        void recycle(QByteArray&& buffer);
+
+        void setMaximumBytes(qint64 maximumBytes);
+        qint64 maximumBytes();
+        qint64 pooledBytes();
+
+        // How many calls to take() were handed a recycled buffer, and how many had to allocate a new one
+        quint64 hits();
+        quint64 misses();
+
+    private:
+        BufferPool();
+        ~BufferPool();
+
+        BufferPoolPrivate* d;
+};
+
+#endif // QNEARBYSHARE_BUFFERPOOL_H
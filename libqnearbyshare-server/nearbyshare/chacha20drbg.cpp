@@ -0,0 +1,142 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "chacha20drbg.h"
+#include <QRandomGenerator>
+#include <QtEndian>
+#include <cstring>
+
+namespace {
+    constexpr int BlocksPerBatch = 16;
+    constexpr qsizetype KeyLength = 32;
+    constexpr qsizetype BatchLength = BlocksPerBatch * 64;
+
+    inline quint32 rotateLeft(quint32 value, int bits) {
+        return (value << bits) | (value >> (32 - bits));
+    }
+
+    inline void quarterRound(quint32& a, quint32& b, quint32& c, quint32& d) {
+        a += b;
+        d = rotateLeft(d ^ a, 16);
+        c += d;
+        b = rotateLeft(b ^ c, 12);
+        a += b;
+        d = rotateLeft(d ^ a, 8);
+        c += d;
+        b = rotateLeft(b ^ c, 7);
+    }
+
+    void secureWipe(void* data, qsizetype length) {
+        // Writing through a volatile pointer keeps the compiler from removing the wipe
+        auto bytes = static_cast<volatile char*>(data);
+        for (qsizetype i = 0; i < length; i++) bytes[i] = 0;
+    }
+} // namespace
+
+struct ChaCha20DrbgPrivate {
+        quint32 key[8];
+        char buffer[BatchLength];
+
+        // Bytes in [position, BatchLength) have not been handed out yet
+        qsizetype position = BatchLength;
+        qsizetype bytesSinceReseed = 0;
+};
+
+ChaCha20Drbg::ChaCha20Drbg() {
+    d = new ChaCha20DrbgPrivate();
+    QRandomGenerator::system()->fillRange(d->key);
+}
+
+ChaCha20Drbg::~ChaCha20Drbg() {
+    secureWipe(d, sizeof(ChaCha20DrbgPrivate));
+    delete d;
+}
+
+void ChaCha20Drbg::generate(char* output, qsizetype length) {
+    if (d->bytesSinceReseed >= ReseedInterval) reseed();
+    d->bytesSinceReseed += length;
+
+    while (length > 0) {
+        if (d->position == BatchLength) refill();
+
+        auto count = qMin(length, BatchLength - d->position);
+        std::memcpy(output, d->buffer + d->position, count);
+        secureWipe(d->buffer + d->position, count);
+
+        d->position += count;
+        output += count;
+        length -= count;
+    }
+}
+
+void ChaCha20Drbg::reseed() {
+    quint32 entropy[8];
+    QRandomGenerator::system()->fillRange(entropy);
+    for (auto i = 0; i < 8; i++) d->key[i] ^= entropy[i];
+    secureWipe(entropy, sizeof(entropy));
+
+    // Drop anything generated with the old key
+    secureWipe(d->buffer, BatchLength);
+    d->position = BatchLength;
+    d->bytesSinceReseed = 0;
+}
+
+void ChaCha20Drbg::block(const quint32 key[8], quint32 counter, const quint32 nonce[3], char output[64]) {
+    quint32 initial[16] = {
+        0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+        key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+        counter, nonce[0], nonce[1], nonce[2]};
+
+    quint32 x[16];
+    std::memcpy(x, initial, sizeof(x));
+    for (auto i = 0; i < 10; i++) {
+        quarterRound(x[0], x[4], x[8], x[12]);
+        quarterRound(x[1], x[5], x[9], x[13]);
+        quarterRound(x[2], x[6], x[10], x[14]);
+        quarterRound(x[3], x[7], x[11], x[15]);
+        quarterRound(x[0], x[5], x[10], x[15]);
+        quarterRound(x[1], x[6], x[11], x[12]);
+        quarterRound(x[2], x[7], x[8], x[13]);
+        quarterRound(x[3], x[4], x[9], x[14]);
+    }
+
+    for (auto i = 0; i < 16; i++) {
+        qToLittleEndian<quint32>(x[i] + initial[i], output + i * 4);
+    }
+    secureWipe(x, sizeof(x));
+    secureWipe(initial, sizeof(initial));
+}
+
+void ChaCha20Drbg::refill() {
+    // The key changes after every batch, so the nonce and counter can start from zero each time
+    const quint32 nonce[3] = {0, 0, 0};
+    for (auto i = 0; i < BlocksPerBatch; i++) {
+        block(d->key, i, nonce, d->buffer + i * 64);
+    }
+
+    // Fast key erasure: the start of the batch becomes the next key and is never handed out
+    for (auto i = 0; i < 8; i++) {
+        d->key[i] = qFromLittleEndian<quint32>(d->buffer + i * 4);
+    }
+    secureWipe(d->buffer, KeyLength);
+    d->position = KeyLength;
+}
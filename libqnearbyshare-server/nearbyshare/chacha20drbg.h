@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_CHACHA20DRBG_H
+#define QNEARBYSHARE_CHACHA20DRBG_H
+
+#include <QByteArrayView>
+
+struct ChaCha20DrbgPrivate;
+
+// ChaCha20 based random generator with fast key erasure.
+//
+// Output is generated a few blocks at a time; the first 32 bytes of every batch immediately replace the key and
+// every byte is wiped from the buffer once handed out, so a later compromise of the generator state does not reveal
+// earlier output. The generator is seeded from the operating system once and mixes in fresh system entropy after
+// every ReseedInterval bytes, so the per call cost is only the ChaCha20 block function.
+//
+// Instances are not thread safe; Cryptography::randomBytes keeps one per thread.
+class ChaCha20Drbg {
+    public:
+        ChaCha20Drbg();
+        ~ChaCha20Drbg();
+
+        ChaCha20Drbg(const ChaCha20Drbg&) = delete;
+        ChaCha20Drbg& operator=(const ChaCha20Drbg&) = delete;
+
+        static constexpr qsizetype ReseedInterval = 1024 * 1024;
+
+        void generate(char* output, qsizetype length);
+        void reseed();
+
+        // The raw ChaCha20 block function from RFC 8439
+        static void block(const quint32 key[8], quint32 counter, const quint32 nonce[3], char output[64]);
+
+    private:
+        ChaCha20DrbgPrivate* d;
+
+        void refill();
+};
+
+#endif // QNEARBYSHARE_CHACHA20DRBG_H
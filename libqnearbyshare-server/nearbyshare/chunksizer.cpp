@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "chunksizer.h"
+
+ChunkSizer::ChunkSizer(qint64 maximumChunkSize) :
+    maximum(qMax(maximumChunkSize, MinimumChunkSize)) {
+    size = qMin(size, maximum);
+}
+
+void ChunkSizer::recordQueued(qint64 bytes, qint64 now) {
+    bytesQueued += bytes;
+    queuedChunks.enqueue({bytesQueued, now});
+}
+
+void ChunkSizer::recordWritten(qint64 bytes, qint64 now) {
+    bytesWritten += bytes;
+    while (!queuedChunks.isEmpty() && queuedChunks.head().end <= bytesWritten) {
+        // Until the chunk ahead had gone this one was only waiting its turn, which says nothing about its size
+        auto chunk = queuedChunks.dequeue();
+        recordDrainTime(now - qMax(chunk.queuedAt, lastDrainedAt));
+        lastDrainedAt = now;
+    }
+
+    if (sampleStart < 0) sampleStart = now;
+    sampleBytes += bytes;
+
+    auto elapsed = now - sampleStart;
+    if (elapsed < SampleInterval) return;
+    if (elapsed > IdleInterval) {
+        // A gap this long means nothing was being sent rather than a slow link; slow links are caught by the drain time
+        sampleStart = now;
+        sampleBytes = 0;
+        return;
+    }
+
+    auto sample = sampleBytes * 1000 / elapsed;
+    smoothedThroughput = smoothedThroughput == 0 ? sample : (smoothedThroughput * 3 + sample) / 4;
+    sampleStart = now;
+    sampleBytes = 0;
+
+    auto target = smoothedThroughput * TargetChunkTime / 1000;
+    if (target >= size * 2) {
+        size = qMin(size * 2, maximum);
+    } else if (target <= size / 2) {
+        size = qMax(size / 2, MinimumChunkSize);
+    }
+}
+
+void ChunkSizer::recordDrainTime(qint64 drainTime) {
+    // The queue is backing up, so don't wait for the throughput to catch up
+    if (drainTime > MaxDrainTime) size = qMax(size / 2, MinimumChunkSize);
+}
+
+qint64 ChunkSizer::chunkSize() {
+    return size;
+}
+
+qint64 ChunkSizer::maximumChunkSize() {
+    return maximum;
+}
+
+qint64 ChunkSizer::throughput() {
+    return smoothedThroughput;
+}
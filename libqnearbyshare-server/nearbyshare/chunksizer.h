@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_CHUNKSIZER_H
+#define QNEARBYSHARE_CHUNKSIZER_H
+
+#include <QQueue>
+#include <QtGlobal>
+
+// Picks how much of a file to read and hand to the socket at a time, from how fast data is actually leaving.
+//
+// Throughput is sampled from written bytes over SampleInterval and smoothed, and the chunk size aims for a chunk to
+// take about TargetChunkTime to go out: big chunks on fast links, where per-frame overhead adds up (each chunk goes
+// out as a single frame), and small ones on slow links, where a big chunk only adds latency and memory. The size
+// moves by at most a factor of two per sample so that it doesn't swing about, and is halved straight away whenever a
+// chunk takes longer than MaxDrainTime to drain. A chunk's drain time only starts once everything queued ahead of it
+// has been written, so it depends on the chunk's own size rather than on how much the sender keeps queued. Times are
+// in milliseconds from any monotonic clock.
+class ChunkSizer {
+    public:
+        static constexpr qint64 MinimumChunkSize = 64 * 1024;
+        static constexpr qint64 InitialChunkSize = 512 * 1024;
+
+        // Android peers are kept to chunks that are known to work well with them; other QNearbyShare instances can
+        // take the larger ceiling
+        static constexpr qint64 AndroidMaximumChunkSize = 1024 * 1024;
+        static constexpr qint64 MaximumChunkSize = 4 * 1024 * 1024;
+
+        static constexpr qint64 SampleInterval = 100;
+        static constexpr qint64 IdleInterval = 2000;
+        static constexpr qint64 TargetChunkTime = 100;
+        static constexpr qint64 MaxDrainTime = 1000;
+
+        explicit ChunkSizer(qint64 maximumChunkSize = AndroidMaximumChunkSize);
+
+        // A chunk of this many bytes has been queued to go out, after every chunk queued before it
+        void recordQueued(qint64 bytes, qint64 now);
+        void recordWritten(qint64 bytes, qint64 now);
+        void recordDrainTime(qint64 drainTime);
+
+        qint64 chunkSize();
+        qint64 maximumChunkSize();
+
+        // Smoothed bytes per second, or 0 before the first sample
+        qint64 throughput();
+
+    private:
+        qint64 maximum;
+        qint64 size = InitialChunkSize;
+        qint64 smoothedThroughput = 0;
+
+        qint64 sampleStart = -1;
+        qint64 sampleBytes = 0;
+
+        // Queued chunks, by the total queued up to their end, and when the last one finished draining
+        struct QueuedChunk {
+                qint64 end;
+                qint64 queuedAt;
+        };
+        QQueue<QueuedChunk> queuedChunks;
+        qint64 bytesQueued = 0;
+        qint64 bytesWritten = 0;
+        qint64 lastDrainedAt = -1;
+};
+
+#endif // QNEARBYSHARE_CHUNKSIZER_H
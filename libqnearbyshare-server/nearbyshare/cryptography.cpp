@@ -23,21 +23,244 @@
  */
 
 #include "cryptography.h"
+#include "chacha20drbg.h"
+#include "cryptography/cryptoengine.h"
+#include <QElapsedTimer>
 #include <QMessageAuthenticationCode>
-#include <QRandomGenerator>
 #include <QTextStream>
+#include <limits>
 
-QByteArray Cryptography::randomBytes(qint64 length) {
-    qint64 baLength = ceil(length / 4.0) * 4;
+#ifndef DEFAULT_CRYPTO_ENGINE
+    #define DEFAULT_CRYPTO_ENGINE "cryptopp"
+#endif
+
+namespace {
+    const QList<CryptoEngine*>& engines() {
+        static const QList<CryptoEngine*> engines = {
+#ifdef HAVE_CRYPTOPP
+            createCryptoPPCryptoEngine(),
+#endif
+#ifdef HAVE_OPENSSL
+            createOpenSSLCryptoEngine(),
+#endif
+        };
+        return engines;
+    }
+
+    // Encrypts and signs a few payload chunks with each engine and returns the one that took the least time
+    CryptoEngine* fastestEngine() {
+        QByteArray key(32, 'K');
+        QByteArray iv(16, 'I');
+        QByteArray input(256 * 1024, 'X');
+        QByteArray output(input.length() + 16, Qt::Uninitialized);
+
+        CryptoEngine* fastest = nullptr;
+        qint64 fastestTime = std::numeric_limits<qint64>::max();
+        for (auto engine : engines()) {
+            auto aesKey = engine->createAes256CbcKey(key, true);
+            auto hmacKey = engine->createHmacSha256Key(key);
+            if (aesKey && hmacKey) {
+                QElapsedTimer timer;
+
+                // The first round only warms up the caches
+                for (auto round = 0; round < 2; round++) {
+                    timer.start();
+                    for (auto i = 0; i < 4; i++) {
+                        auto length = engine->aes256cbc(aesKey, input.constData(), input.length(), output.data(), iv);
+                        engine->hmacSha256Begin(hmacKey);
+                        engine->hmacSha256Update(hmacKey, output.constData(), length);
+                        engine->hmacSha256Finish(hmacKey);
+                    }
+                }
+
+                auto elapsed = timer.nsecsElapsed();
+                if (elapsed < fastestTime) {
+                    fastest = engine;
+                    fastestTime = elapsed;
+                }
+            }
+
+            delete aesKey;
+            delete hmacKey;
+        }
+
+        return fastest ? fastest : engines().first();
+    }
+} // namespace
+
+CryptoEngine* Cryptography::engine() {
+    static CryptoEngine* const engine = [] {
+        auto name = qEnvironmentVariable("QNEARBYSHARE_CRYPTO_ENGINE", QStringLiteral(DEFAULT_CRYPTO_ENGINE));
+        if (name == QStringLiteral("auto")) return fastestEngine();
+
+        if (auto selected = Cryptography::engine(name)) return selected;
+        QTextStream(stderr) << "Crypto engine " << name << " is not available, using " << engines().first()->name() << "\n";
+        return engines().first();
+    }();
+    return engine;
+}
+
+CryptoEngine* Cryptography::engine(const QString& name) {
+    for (auto engine : engines()) {
+        if (engine->name() == name) return engine;
+    }
+    return nullptr;
+}
+
+QStringList Cryptography::availableEngines() {
+    QStringList names;
+    for (auto engine : engines()) names.append(engine->name());
+    return names;
+}
 
-    QByteArray bytes(baLength, Qt::Uninitialized);
-    QRandomGenerator::securelySeeded().fillRange(reinterpret_cast<quint32*>(bytes.data()), baLength / 4);
-    bytes.truncate(length);
+QByteArray Cryptography::randomBytes(qint64 length) {
+    QByteArray bytes(length, Qt::Uninitialized);
+    randomBytes(bytes.data(), length);
     return bytes;
 }
 
-QByteArray Cryptography::hmacSha256Signature(const QByteArray& data, const QByteArray& key) {
-    return QMessageAuthenticationCode::hash(data, key, QCryptographicHash::Sha256);
+void Cryptography::randomBytes(char* output, qsizetype length) {
+    // Seeding from the OS on every call is far too slow for per frame IVs, so each thread keeps its own generator
+    static thread_local ChaCha20Drbg drbg;
+    drbg.generate(output, length);
+}
+
+EcKey* Cryptography::generateEcdsaKeyPair() {
+    return engine()->generateEcdsaKeyPair();
+}
+
+void Cryptography::deleteEcdsaKeyPair(EcKey* key) {
+    delete key;
+}
+
+QByteArray Cryptography::ecdsaX(EcKey* key) {
+    return engine()->ecdsaX(key);
+}
+
+QByteArray Cryptography::ecdsaY(EcKey* key) {
+    return engine()->ecdsaY(key);
+}
+
+QByteArray Cryptography::diffieHellman(EcKey* ourKey, const QByteArray& peerX, const QByteArray& peerY) {
+    return engine()->diffieHellman(ourKey, peerX, peerY);
+}
+
+EcKey* Cryptography::generateX25519KeyPair() {
+    return engine()->generateX25519KeyPair();
+}
+
+QByteArray Cryptography::x25519PublicKey(EcKey* key) {
+    return engine()->x25519PublicKey(key);
+}
+
+QByteArray Cryptography::x25519DiffieHellman(EcKey* ourKey, const QByteArray& peerPublicKey) {
+    return engine()->x25519DiffieHellman(ourKey, peerPublicKey);
+}
+
+QByteArray Cryptography::hkdfExtractExpand(const QByteArray& salt, const QByteArray& ikm, const QByteArray& info, size_t length) {
+    return engine()->hkdfExtractExpand(salt, ikm, info, length);
+}
+
+QByteArray Cryptography::hkdfExtract(const QByteArray& salt, const QByteArray& ikm) {
+    return engine()->hkdfExtract(salt, ikm);
+}
+
+QByteArray Cryptography::hkdfExpand(const QByteArray& prk, const QByteArray& info, size_t length) {
+    return engine()->hkdfExpand(prk, info, length);
+}
+
+QList<QByteArray> Cryptography::hkdfExtractExpand(const QByteArray& salt, const QByteArray& ikm, const QList<QByteArray>& infos, size_t length) {
+    auto prk = hkdfExtract(salt, ikm);
+
+    QList<QByteArray> keys;
+    keys.reserve(infos.size());
+    for (const auto& info : infos) {
+        keys.append(prk.isEmpty() ? QByteArray() : hkdfExpand(prk, info, length));
+    }
+    return keys;
+}
+
+qsizetype Cryptography::aes256cbc(const char* input, qsizetype length, char* output, const QByteArray& key, const QByteArray& iv, bool isEncrypt) {
+    return engine()->aes256cbc(input, length, output, key, iv, isEncrypt);
+}
+
+AesKey* Cryptography::createAes256CbcKey(const QByteArray& key, bool isEncrypt) {
+    return engine()->createAes256CbcKey(key, isEncrypt);
+}
+
+void Cryptography::deleteAesKey(AesKey* key) {
+    delete key;
+}
+
+qsizetype Cryptography::aes256cbc(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv) {
+    return engine()->aes256cbc(key, input, length, output, iv);
+}
+
+AesKey* Cryptography::createAes256GcmKey(const QByteArray& key, bool isEncrypt) {
+    return engine()->createAes256GcmKey(key, isEncrypt);
+}
+
+qsizetype Cryptography::aes256gcmEncrypt(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, char* tag) {
+    return engine()->aes256gcmEncrypt(key, input, length, output, iv, associatedData, tag);
+}
+
+qsizetype Cryptography::aes256gcmDecrypt(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, QByteArrayView tag) {
+    return engine()->aes256gcmDecrypt(key, input, length, output, iv, associatedData, tag);
+}
+
+HmacKey* Cryptography::createHmacSha256Key(const QByteArray& key) {
+    return engine()->createHmacSha256Key(key);
+}
+
+void Cryptography::deleteHmacKey(HmacKey* key) {
+    delete key;
+}
+
+void Cryptography::hmacSha256Begin(HmacKey* key) {
+    engine()->hmacSha256Begin(key);
+}
+
+void Cryptography::hmacSha256Update(HmacKey* key, const char* data, qsizetype length) {
+    engine()->hmacSha256Update(key, data, length);
+}
+
+QByteArray Cryptography::hmacSha256Finish(HmacKey* key) {
+    return engine()->hmacSha256Finish(key);
+}
+
+QByteArray Cryptography::hmacSha256Signature(QByteArrayView data, const QByteArray& key) {
+    QMessageAuthenticationCode mac(QCryptographicHash::Sha256, key);
+    mac.addData(data.data(), data.size());
+    return mac.result();
+}
+
+void Cryptography::aes256cbcEncryptBatch(AesKey* key, Aes256CbcJob* jobs, qsizetype count) {
+    engine()->aes256cbcEncryptBatch(key, jobs, count);
+}
+
+QByteArray Cryptography::hmacSha256Signature(QByteArrayView data, HmacKey* key) {
+    hmacSha256Begin(key);
+    hmacSha256Update(key, data.data(), data.size());
+    return hmacSha256Finish(key);
+}
+
+void Cryptography::hmacSha256Batch(HmacKey* key, HmacSha256Job* jobs, qsizetype count) {
+    engine()->hmacSha256Batch(key, jobs, count);
+}
+
+bool Cryptography::constantTimeEquals(QByteArrayView first, QByteArrayView second) {
+    // Signature lengths aren't secret
+    if (first.size() != second.size()) return false;
+    return engine()->constantTimeEquals(first, second);
+}
+
+QByteArray Cryptography::aes256cbc(const QByteArray& input, const QByteArray& key, const QByteArray& iv, bool isEncrypt) {
+    QByteArray output(input.length() + 16, Qt::Uninitialized);
+    auto outputLength = aes256cbc(input.constData(), input.length(), output.data(), key, iv, isEncrypt);
+    if (outputLength < 0) return {};
+
+    output.truncate(outputLength);
+    return output;
 }
 
 QByteArray Cryptography::aes256cbcDecrypt(const QByteArray& ciphertext, const QByteArray& key, const QByteArray& iv) {
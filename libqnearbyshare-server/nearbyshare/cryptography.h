@@ -25,11 +25,45 @@
 #ifndef QNEARBYSHARE_CRYPTOGRAPHY_H
 #define QNEARBYSHARE_CRYPTOGRAPHY_H
 
+#include <QByteArrayView>
+#include <QList>
 #include <QString>
+#include <QStringList>
 
+class CryptoEngine;
 struct EcKey;
+struct AesKey;
+struct HmacKey;
+
+// One message of an aes256cbcEncryptBatch call. As with aes256cbc, output must have room for length + 16 bytes and
+// may be the same buffer as input.
+struct Aes256CbcJob {
+        const char* input;
+        qsizetype length;
+        char* output;
+        QByteArrayView iv;
+
+        // Set to the number of bytes written, or -1 on failure
+        qsizetype written = -1;
+};
+
+// One message of an hmacSha256Batch call. Output must have room for the 32 byte signature.
+struct HmacSha256Job {
+        const char* input;
+        qsizetype length;
+        char* output;
+};
+
 namespace Cryptography {
+    // The engine behind the functions below, chosen on first use from the QNEARBYSHARE_CRYPTO_ENGINE environment
+    // variable: "openssl", "cryptopp", or "auto" to time the engines that were built and use the fastest one.
+    // Keys must only be used with the engine that created them.
+    CryptoEngine* engine();
+    CryptoEngine* engine(const QString& name);
+    QStringList availableEngines();
+
     QByteArray randomBytes(qint64 length);
+    void randomBytes(char* output, qsizetype length);
 
     EcKey* generateEcdsaKeyPair();
     void deleteEcdsaKeyPair(EcKey* key);
@@ -39,12 +73,60 @@ namespace Cryptography {
     QByteArray ecdsaY(EcKey* key);
 
     QByteArray diffieHellman(EcKey* ourKey, const QByteArray& peerX, const QByteArray& peerY);
+
+    // Curve25519 key pairs are freed with deleteEcdsaKeyPair as well
+    EcKey* generateX25519KeyPair();
+    QByteArray x25519PublicKey(EcKey* key);
+    QByteArray x25519DiffieHellman(EcKey* ourKey, const QByteArray& peerPublicKey);
     QByteArray hkdfExtractExpand(const QByteArray& salt, const QByteArray& ikm, const QByteArray& info, size_t length);
 
+    // The two halves of HKDF-SHA256 (RFC 5869). The PRK from hkdfExtract can be expanded any number of times.
+    QByteArray hkdfExtract(const QByteArray& salt, const QByteArray& ikm);
+    QByteArray hkdfExpand(const QByteArray& prk, const QByteArray& info, size_t length);
+
+    // Derives one key per info from the same salt and IKM, running the extract step only once
+    QList<QByteArray> hkdfExtractExpand(const QByteArray& salt, const QByteArray& ikm, const QList<QByteArray>& infos, size_t length);
+
+    // Output must have room for length + 16 bytes, and may point to the same buffer as input. Returns the number of bytes written, or -1 on failure.
+    qsizetype aes256cbc(const char* input, qsizetype length, char* output, const QByteArray& key, const QByteArray& iv, bool isEncrypt);
     QByteArray aes256cbc(const QByteArray& input, const QByteArray& key, const QByteArray& iv, bool isEncrypt);
     QByteArray aes256cbcDecrypt(const QByteArray& ciphertext, const QByteArray& key, const QByteArray& iv);
     QByteArray aes256cbcEncrypt(const QByteArray& plaintext, const QByteArray& key, const QByteArray& iv);
-    QByteArray hmacSha256Signature(const QByteArray& data, const QByteArray& key);
+    QByteArray hmacSha256Signature(QByteArrayView data, const QByteArray& key);
+
+    // Keys that are used for many messages keep their expanded AES key schedule, so each call only has to set the IV
+    AesKey* createAes256CbcKey(const QByteArray& key, bool isEncrypt);
+    void deleteAesKey(AesKey* key);
+    qsizetype aes256cbc(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv);
+
+    // Encrypts independent messages together, each with its own IV. Where the processor has AES-NI the messages are
+    // encrypted side by side (see AesNiCbc), which is several times faster than encrypting them one after another.
+    void aes256cbcEncryptBatch(AesKey* key, Aes256CbcJob* jobs, qsizetype count);
+
+    // AES-256-GCM with a 12 byte IV and a 16 byte tag. Output must have room for length bytes and may be the same
+    // buffer as input. Decryption returns -1 if the tag doesn't match the ciphertext and associated data.
+    constexpr qsizetype Aes256GcmIvLength = 12;
+    constexpr qsizetype Aes256GcmTagLength = 16;
+    AesKey* createAes256GcmKey(const QByteArray& key, bool isEncrypt);
+    qsizetype aes256gcmEncrypt(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, char* tag);
+    qsizetype aes256gcmDecrypt(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, QByteArrayView tag);
+
+    // HMAC keys keep the hash state after the inner and outer padded keys, so each message only hashes its own data.
+    // A key holds one message in progress at a time.
+    HmacKey* createHmacSha256Key(const QByteArray& key);
+    void deleteHmacKey(HmacKey* key);
+    void hmacSha256Begin(HmacKey* key);
+    void hmacSha256Update(HmacKey* key, const char* data, qsizetype length);
+    QByteArray hmacSha256Finish(HmacKey* key);
+    QByteArray hmacSha256Signature(QByteArrayView data, HmacKey* key);
+
+    // Signs independent messages together. Where the processor has AVX2 but not the SHA extensions the messages are
+    // hashed side by side (see Avx2HmacSha256); otherwise they are signed one after another.
+    void hmacSha256Batch(HmacKey* key, HmacSha256Job* jobs, qsizetype count);
+
+    // For checking signatures and other secrets; the time taken doesn't depend on where the data differs. Data of
+    // different lengths is never equal.
+    bool constantTimeEquals(QByteArrayView first, QByteArrayView second);
 }; // namespace Cryptography
 
 #endif // QNEARBYSHARE_CRYPTOGRAPHY_H
@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "aesnicbc.h"
+#include "../cryptography.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define QNEARBYSHARE_AESNI
+    #include <immintrin.h>
+    #define AESNI_TARGET __attribute__((target("aes,sse4.1")))
+    #define VAES_TARGET __attribute__((target("aes,sse4.1,avx512f,vaes")))
+#endif
+
+struct AesNiCbcPrivate {
+#ifdef QNEARBYSHARE_AESNI
+        __m128i roundKeys[15];
+        __m128i decryptRoundKeys[15];
+#endif
+        AesNiCbc::DecryptKernel decryptKernel = AesNiCbc::AesNiKernel;
+};
+
+#ifdef QNEARBYSHARE_AESNI
+namespace {
+    struct Lane {
+            Aes256CbcJob* job;
+            const char* input;
+            char* output;
+            qsizetype block;
+            qsizetype fullBlocks;
+            __m128i chain;
+
+            // The last block including its PKCS#7 padding
+            alignas(16) char finalBlock[16];
+    };
+
+    AESNI_TARGET inline __m128i expandEven(__m128i key, __m128i assist) {
+        key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+        key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+        key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+        return _mm_xor_si128(key, _mm_shuffle_epi32(assist, 0xFF));
+    }
+
+    AESNI_TARGET inline __m128i expandOdd(__m128i even, __m128i key) {
+        auto assist = _mm_aeskeygenassist_si128(even, 0);
+        key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+        key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+        key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+        return _mm_xor_si128(key, _mm_shuffle_epi32(assist, 0xAA));
+    }
+
+    AESNI_TARGET void expandKey(const char* key, __m128i* roundKeys) {
+        roundKeys[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+        roundKeys[1] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key + 16));
+
+        // The round constant has to be an immediate, hence the unrolling
+#define EXPAND_ROUND(i, rcon)                                                                       \
+    roundKeys[i] = expandEven(roundKeys[i - 2], _mm_aeskeygenassist_si128(roundKeys[i - 1], rcon)); \
+    roundKeys[i + 1] = expandOdd(roundKeys[i], roundKeys[i - 1]);
+        EXPAND_ROUND(2, 0x01)
+        EXPAND_ROUND(4, 0x02)
+        EXPAND_ROUND(6, 0x04)
+        EXPAND_ROUND(8, 0x08)
+        EXPAND_ROUND(10, 0x10)
+        EXPAND_ROUND(12, 0x20)
+        roundKeys[14] = expandEven(roundKeys[12], _mm_aeskeygenassist_si128(roundKeys[13], 0x40));
+#undef EXPAND_ROUND
+    }
+
+    // The equivalent inverse cipher runs the round keys backwards, with InvMixColumns applied to the middle ones
+    AESNI_TARGET void invertKey(const __m128i* roundKeys, __m128i* decryptRoundKeys) {
+        decryptRoundKeys[0] = roundKeys[14];
+        for (auto round = 1; round < 14; round++) decryptRoundKeys[round] = _mm_aesimc_si128(roundKeys[14 - round]);
+        decryptRoundKeys[14] = roundKeys[0];
+    }
+
+    // Decrypts whole blocks, 8 at a time. All the ciphertext of a step is loaded before anything is stored so that
+    // output may overwrite input; the last ciphertext block carries over to the next call in chain.
+    AESNI_TARGET void decryptAesNi(const __m128i* roundKeys, const char* input, qsizetype blocks, char* output, __m128i* chain) {
+        auto previous = *chain;
+        qsizetype i = 0;
+        for (; i + 8 <= blocks; i += 8) {
+            __m128i ciphertext[8];
+            __m128i state[8];
+            #pragma GCC unroll 8
+            for (auto l = 0; l < 8; l++) {
+                ciphertext[l] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + (i + l) * 16));
+                state[l] = _mm_xor_si128(ciphertext[l], roundKeys[0]);
+            }
+            #pragma GCC unroll 16
+            for (auto round = 1; round < 14; round++) {
+                #pragma GCC unroll 8
+                for (auto l = 0; l < 8; l++) state[l] = _mm_aesdec_si128(state[l], roundKeys[round]);
+            }
+            #pragma GCC unroll 8
+            for (auto l = 0; l < 8; l++) {
+                state[l] = _mm_aesdeclast_si128(state[l], roundKeys[14]);
+                state[l] = _mm_xor_si128(state[l], l == 0 ? previous : ciphertext[l - 1]);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(output + (i + l) * 16), state[l]);
+            }
+            previous = ciphertext[7];
+        }
+
+        for (; i < blocks; i++) {
+            auto ciphertext = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i * 16));
+            auto state = _mm_xor_si128(ciphertext, roundKeys[0]);
+            for (auto round = 1; round < 14; round++) state = _mm_aesdec_si128(state, roundKeys[round]);
+            state = _mm_xor_si128(_mm_aesdeclast_si128(state, roundKeys[14]), previous);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i * 16), state);
+            previous = ciphertext;
+        }
+        *chain = previous;
+    }
+
+    // Decrypts 16 blocks at a time as four 512 bit vectors of four blocks each, leaving any remainder to AES-NI
+    VAES_TARGET void decryptVaes(const __m128i* roundKeys, const char* input, qsizetype blocks, char* output, __m128i* chain) {
+        __m512i wideRoundKeys[15];
+        for (auto round = 0; round < 15; round++) wideRoundKeys[round] = _mm512_broadcast_i32x4(roundKeys[round]);
+
+        // Only the top block of previous matters: it's the ciphertext block before the current step
+        auto previous = _mm512_broadcast_i32x4(*chain);
+        qsizetype i = 0;
+        for (; i + 16 <= blocks; i += 16) {
+            __m512i ciphertext[4];
+            __m512i state[4];
+            #pragma GCC unroll 4
+            for (auto l = 0; l < 4; l++) {
+                ciphertext[l] = _mm512_loadu_si512(input + (i + l * 4) * 16);
+                state[l] = _mm512_xor_si512(ciphertext[l], wideRoundKeys[0]);
+            }
+            #pragma GCC unroll 16
+            for (auto round = 1; round < 14; round++) {
+                #pragma GCC unroll 4
+                for (auto l = 0; l < 4; l++) state[l] = _mm512_aesdec_epi128(state[l], wideRoundKeys[round]);
+            }
+            #pragma GCC unroll 4
+            for (auto l = 0; l < 4; l++) {
+                state[l] = _mm512_aesdeclast_epi128(state[l], wideRoundKeys[14]);
+
+                // Shift the preceding ciphertext block in underneath to line each block up with its predecessor
+                auto preceding = _mm512_alignr_epi32(ciphertext[l], l == 0 ? previous : ciphertext[l - 1], 12);
+                _mm512_storeu_si512(output + (i + l * 4) * 16, _mm512_xor_si512(state[l], preceding));
+            }
+            previous = ciphertext[3];
+        }
+        *chain = _mm512_extracti32x4_epi32(previous, 3);
+
+        decryptAesNi(roundKeys, input + i * 16, blocks - i, output + i * 16, chain);
+    }
+
+    // The lane and round loops are unrolled so that the state of every lane stays in a register
+    template<int N> AESNI_TARGET inline void encryptBlock(const __m128i* roundKeys, __m128i* state) {
+        #pragma GCC unroll 16
+        for (auto l = 0; l < N; l++) state[l] = _mm_xor_si128(state[l], roundKeys[0]);
+        #pragma GCC unroll 16
+        for (auto round = 1; round < 14; round++) {
+            #pragma GCC unroll 16
+            for (auto l = 0; l < N; l++) state[l] = _mm_aesenc_si128(state[l], roundKeys[round]);
+        }
+        #pragma GCC unroll 16
+        for (auto l = 0; l < N; l++) state[l] = _mm_aesenclast_si128(state[l], roundKeys[14]);
+    }
+
+    // Encrypts the next `blocks` blocks of the first N lanes, interleaving the rounds of every lane. No lane has
+    // fewer than `blocks` blocks left, so only the last step can reach a padded final block.
+    template<int N> AESNI_TARGET void encryptLanes(const __m128i* roundKeys, Lane* lanes, qsizetype blocks) {
+        const char* input[N];
+        char* output[N];
+        __m128i state[N];
+        for (auto l = 0; l < N; l++) {
+            input[l] = lanes[l].input + lanes[l].block * 16;
+            output[l] = lanes[l].output + lanes[l].block * 16;
+            state[l] = lanes[l].chain;
+        }
+
+        for (qsizetype i = 0; i < blocks - 1; i++) {
+            #pragma GCC unroll 16
+            for (auto l = 0; l < N; l++) state[l] = _mm_xor_si128(state[l], _mm_loadu_si128(reinterpret_cast<const __m128i*>(input[l] + i * 16)));
+            encryptBlock<N>(roundKeys, state);
+            #pragma GCC unroll 16
+            for (auto l = 0; l < N; l++) _mm_storeu_si128(reinterpret_cast<__m128i*>(output[l] + i * 16), state[l]);
+        }
+
+        auto last = (blocks - 1) * 16;
+        for (auto l = 0; l < N; l++) {
+            auto plaintext = lanes[l].block + blocks - 1 < lanes[l].fullBlocks ? input[l] + last : lanes[l].finalBlock;
+            state[l] = _mm_xor_si128(state[l], _mm_loadu_si128(reinterpret_cast<const __m128i*>(plaintext)));
+        }
+        encryptBlock<N>(roundKeys, state);
+        for (auto l = 0; l < N; l++) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(output[l] + last), state[l]);
+            lanes[l].chain = state[l];
+            lanes[l].block += blocks;
+        }
+    }
+
+    AESNI_TARGET void encryptLanes(const __m128i* roundKeys, Lane* lanes, int count, qsizetype blocks) {
+        switch (count) {
+            case 1:
+                encryptLanes<1>(roundKeys, lanes, blocks);
+                break;
+            case 2:
+                encryptLanes<2>(roundKeys, lanes, blocks);
+                break;
+            case 3:
+                encryptLanes<3>(roundKeys, lanes, blocks);
+                break;
+            case 4:
+                encryptLanes<4>(roundKeys, lanes, blocks);
+                break;
+            case 5:
+                encryptLanes<5>(roundKeys, lanes, blocks);
+                break;
+            case 6:
+                encryptLanes<6>(roundKeys, lanes, blocks);
+                break;
+            case 7:
+                encryptLanes<7>(roundKeys, lanes, blocks);
+                break;
+            default:
+                encryptLanes<8>(roundKeys, lanes, blocks);
+                break;
+        }
+    }
+
+    AESNI_TARGET void startLane(Lane* lane, Aes256CbcJob* job) {
+        lane->job = job;
+        lane->input = job->input;
+        lane->output = job->output;
+        lane->block = 0;
+        lane->fullBlocks = job->length / 16;
+        lane->chain = _mm_loadu_si128(reinterpret_cast<const __m128i*>(job->iv.data()));
+
+        // Copy the tail out before any output is written, since the output may overlap the input
+        auto tail = job->length % 16;
+        std::memcpy(lane->finalBlock, job->input + lane->fullBlocks * 16, tail);
+        std::memset(lane->finalBlock + tail, static_cast<char>(16 - tail), 16 - tail);
+    }
+} // namespace
+#endif
+
+AesNiCbc::AesNiCbc(const QByteArray& key) {
+    d = new AesNiCbcPrivate();
+#ifdef QNEARBYSHARE_AESNI
+    Q_ASSERT(key.length() == 32);
+    expandKey(key.constData(), d->roundKeys);
+    invertKey(d->roundKeys, d->decryptRoundKeys);
+#endif
+    if (isSupported(VaesKernel)) d->decryptKernel = VaesKernel;
+}
+
+AesNiCbc::~AesNiCbc() {
+    // Don't leave the key schedule behind on the heap
+    volatile auto bytes = reinterpret_cast<volatile char*>(d);
+    for (std::size_t i = 0; i < sizeof(AesNiCbcPrivate); i++) bytes[i] = 0;
+    delete d;
+}
+
+bool AesNiCbc::isSupported() {
+#ifdef QNEARBYSHARE_AESNI
+    static const bool supported = __builtin_cpu_supports("aes") && __builtin_cpu_supports("sse4.1");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+bool AesNiCbc::isSupported(DecryptKernel kernel) {
+#ifdef QNEARBYSHARE_AESNI
+    switch (kernel) {
+        case AesNiKernel:
+            return isSupported();
+        case VaesKernel:
+            {
+                static const bool supported = isSupported() && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("vaes");
+                return supported;
+            }
+    }
+#endif
+    return false;
+}
+
+void AesNiCbc::setDecryptKernel(DecryptKernel kernel) {
+    if (isSupported(kernel)) d->decryptKernel = kernel;
+}
+
+void AesNiCbc::encryptBatch(Aes256CbcJob* jobs, qsizetype count) {
+#ifdef QNEARBYSHARE_AESNI
+    Lane lanes[Lanes];
+    auto active = 0;
+    qsizetype nextJob = 0;
+
+    while (true) {
+        // Keep every lane busy while there are messages left
+        while (active < Lanes && nextJob < count) {
+            auto job = &jobs[nextJob++];
+            if (job->iv.size() != 16 || job->length < 0) {
+                job->written = -1;
+                continue;
+            }
+            startLane(&lanes[active++], job);
+        }
+        if (active == 0) break;
+
+        // Run every lane until the shortest one finishes
+        auto blocks = lanes[0].fullBlocks + 1 - lanes[0].block;
+        for (auto l = 1; l < active; l++) blocks = qMin(blocks, lanes[l].fullBlocks + 1 - lanes[l].block);
+        encryptLanes(d->roundKeys, lanes, active, blocks);
+
+        for (auto l = 0; l < active;) {
+            if (lanes[l].block == lanes[l].fullBlocks + 1) {
+                lanes[l].job->written = lanes[l].block * 16;
+                lanes[l] = lanes[--active];
+            } else {
+                l++;
+            }
+        }
+    }
+#else
+    for (qsizetype i = 0; i < count; i++) jobs[i].written = -1;
+#endif
+}
+
+qsizetype AesNiCbc::decrypt(const char* input, qsizetype length, char* output, QByteArrayView iv) {
+    if (length == 0 || length % 16 != 0 || iv.size() != 16) return -1;
+
+#ifdef QNEARBYSHARE_AESNI
+    auto chain = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv.data()));
+    if (d->decryptKernel == VaesKernel) {
+        decryptVaes(d->decryptRoundKeys, input, length / 16, output, &chain);
+    } else {
+        decryptAesNi(d->decryptRoundKeys, input, length / 16, output, &chain);
+    }
+
+    // Check the PKCS#7 padding without branching on the padding bytes themselves
+    auto padding = static_cast<quint8>(output[length - 1]);
+    if (padding == 0 || padding > 16) return -1;
+
+    quint8 mismatch = 0;
+    for (qsizetype i = 0; i < 16; i++) {
+        auto inPadding = static_cast<quint8>(-static_cast<int>(i < padding));
+        mismatch |= inPadding & (static_cast<quint8>(output[length - 1 - i]) ^ padding);
+    }
+    if (mismatch != 0) return -1;
+
+    return length - padding;
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_AESNICBC_H
+#define QNEARBYSHARE_AESNICBC_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+
+struct Aes256CbcJob;
+struct AesNiCbcPrivate;
+
+// AES-256-CBC using the AES-NI instructions directly, for the cases the general purpose libraries handle serially.
+//
+// CBC encryption can't be parallelised within a message since every block depends on the previous ciphertext,
+// which leaves AES-NI waiting on the latency of each round. Independent messages don't depend on each other though,
+// so encryptBatch() runs up to Lanes messages side by side with their rounds interleaved and keeps the AES units busy.
+// Messages are padded with PKCS#7 like the engines do.
+//
+// Decryption has no such dependency, so decrypt() works on many blocks of the same message at once: 8 blocks at a
+// time with AES-NI, or 16 with the VAES instructions on processors with AVX-512. The fastest kernel the processor
+// supports is picked at runtime.
+//
+// Only available on x86 processors with AES-NI; check isSupported() before creating one.
+class AesNiCbc {
+    public:
+        explicit AesNiCbc(const QByteArray& key);
+        ~AesNiCbc();
+
+        AesNiCbc(const AesNiCbc&) = delete;
+        AesNiCbc& operator=(const AesNiCbc&) = delete;
+
+        static constexpr int Lanes = 8;
+
+        enum DecryptKernel {
+            AesNiKernel,
+            VaesKernel
+        };
+
+        static bool isSupported();
+        static bool isSupported(DecryptKernel kernel);
+
+        // Overrides the kernel picked at runtime, for benchmarks and tests
+        void setDecryptKernel(DecryptKernel kernel);
+
+        void encryptBatch(Aes256CbcJob* jobs, qsizetype count);
+
+        // Output must have room for length bytes and may be the same buffer as input. Returns the plaintext length,
+        // or -1 if the length or padding is invalid.
+        qsizetype decrypt(const char* input, qsizetype length, char* output, QByteArrayView iv);
+
+    private:
+        AesNiCbcPrivate* d;
+};
+
+#endif // QNEARBYSHARE_AESNICBC_H
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "avx2hmacsha256.h"
+#include "../cryptography.h"
+#include <QCryptographicHash>
+#include <QtEndian>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define QNEARBYSHARE_AVX2
+    #include <cpuid.h>
+    #include <immintrin.h>
+    #define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+namespace {
+    constexpr quint32 RoundConstants[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+    constexpr quint32 InitialState[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+    inline quint32 rotateRight(quint32 x, int n) {
+        return (x >> n) | (x << (32 - n));
+    }
+
+    // One block at a time, which is only used to hash the padded keys when a key is created
+    void compress(quint32* state, const uchar* block) {
+        quint32 w[64];
+        for (auto t = 0; t < 16; t++) w[t] = qFromBigEndian<quint32>(block + t * 4);
+        for (auto t = 16; t < 64; t++) {
+            auto s0 = rotateRight(w[t - 15], 7) ^ rotateRight(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            auto s1 = rotateRight(w[t - 2], 17) ^ rotateRight(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+
+        quint32 v[8];
+        std::memcpy(v, state, sizeof(v));
+        for (auto t = 0; t < 64; t++) {
+            auto t1 = v[7] + (rotateRight(v[4], 6) ^ rotateRight(v[4], 11) ^ rotateRight(v[4], 25)) + ((v[4] & v[5]) ^ (~v[4] & v[6])) + RoundConstants[t] + w[t];
+            auto t2 = (rotateRight(v[0], 2) ^ rotateRight(v[0], 13) ^ rotateRight(v[0], 22)) + ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+            std::memmove(v + 1, v, 7 * sizeof(quint32));
+            v[4] += t1;
+            v[0] = t1 + t2;
+        }
+        for (auto i = 0; i < 8; i++) state[i] += v[i];
+    }
+} // namespace
+
+struct Avx2HmacSha256Private {
+        // The hash state after the key XORed with ipad and opad, which every message starts from
+        quint32 innerState[8];
+        quint32 outerState[8];
+};
+
+#ifdef QNEARBYSHARE_AVX2
+namespace {
+    // One SHA-256 message for hashBatch()
+    struct HashJob {
+            const char* input;
+            qsizetype length;
+            char* digest;
+    };
+
+    struct Lane {
+            HashJob* job;
+            qsizetype block;
+            qsizetype fullBlocks;
+            qsizetype blocks;
+
+            // The rest of the message after the full blocks, with the padding and length: one or two blocks
+            alignas(32) uchar tail[128];
+
+            const uchar* blockAt(qsizetype block) const {
+                if (block < fullBlocks) return reinterpret_cast<const uchar*>(job->input) + block * 64;
+                return tail + (block - fullBlocks) * 64;
+            }
+    };
+
+    // Hashed by lanes that have run out of messages, so every lane always has a block to load
+    alignas(32) constexpr uchar IdleBlock[64] = {};
+
+    void startLane(Lane* lane, HashJob* job) {
+        lane->job = job;
+        lane->block = 0;
+        lane->fullBlocks = job->length / 64;
+
+        // The padding needs a 0x80 byte and the 8 byte length after the message
+        auto tail = job->length % 64;
+        auto tailLength = tail + 9 <= 64 ? 64 : 128;
+        lane->blocks = lane->fullBlocks + tailLength / 64;
+
+        std::memset(lane->tail, 0, tailLength);
+        if (tail != 0) std::memcpy(lane->tail, job->input + lane->fullBlocks * 64, tail);
+        lane->tail[tail] = 0x80;
+
+        // Every message follows the block of padded key, which counts towards the length
+        qToBigEndian<quint64>(static_cast<quint64>(64 + job->length) * 8, lane->tail + tailLength - 8);
+    }
+
+    template<int N> AVX2_TARGET inline __m256i rotateRight(__m256i x) {
+        return _mm256_or_si256(_mm256_srli_epi32(x, N), _mm256_slli_epi32(x, 32 - N));
+    }
+
+    // Turns eight rows of eight words into eight columns, so that each word of a block lands in its own lane
+    AVX2_TARGET inline void transpose(__m256i* rows) {
+        __m256i pairs[8];
+        for (auto i = 0; i < 4; i++) {
+            pairs[i * 2] = _mm256_unpacklo_epi32(rows[i * 2], rows[i * 2 + 1]);
+            pairs[i * 2 + 1] = _mm256_unpackhi_epi32(rows[i * 2], rows[i * 2 + 1]);
+        }
+
+        __m256i quads[8];
+        for (auto i = 0; i < 2; i++) {
+            quads[i * 4] = _mm256_unpacklo_epi64(pairs[i * 4], pairs[i * 4 + 2]);
+            quads[i * 4 + 1] = _mm256_unpackhi_epi64(pairs[i * 4], pairs[i * 4 + 2]);
+            quads[i * 4 + 2] = _mm256_unpacklo_epi64(pairs[i * 4 + 1], pairs[i * 4 + 3]);
+            quads[i * 4 + 3] = _mm256_unpackhi_epi64(pairs[i * 4 + 1], pairs[i * 4 + 3]);
+        }
+
+        for (auto i = 0; i < 4; i++) {
+            rows[i] = _mm256_permute2x128_si256(quads[i], quads[i + 4], 0x20);
+            rows[i + 4] = _mm256_permute2x128_si256(quads[i], quads[i + 4], 0x31);
+        }
+    }
+
+    // Hashes one block of every lane. The rounds are the same as compress() with each word widened to a vector.
+    AVX2_TARGET void compressLanes(__m256i* state, const uchar* const* blocks) {
+        const auto byteSwap = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+        __m256i w[16];
+        for (auto half = 0; half < 2; half++) {
+            __m256i rows[8];
+            for (auto l = 0; l < 8; l++) rows[l] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(blocks[l] + half * 32));
+            transpose(rows);
+            for (auto t = 0; t < 8; t++) w[half * 8 + t] = _mm256_shuffle_epi8(rows[t], byteSwap);
+        }
+
+        auto a = state[0], b = state[1], c = state[2], d = state[3];
+        auto e = state[4], f = state[5], g = state[6], h = state[7];
+        #pragma GCC unroll 16
+        for (auto t = 0; t < 64; t++) {
+            // The message schedule only ever needs the last 16 words
+            if (t >= 16) {
+                auto w15 = w[(t - 15) & 15];
+                auto w2 = w[(t - 2) & 15];
+                auto s0 = _mm256_xor_si256(_mm256_xor_si256(rotateRight<7>(w15), rotateRight<18>(w15)), _mm256_srli_epi32(w15, 3));
+                auto s1 = _mm256_xor_si256(_mm256_xor_si256(rotateRight<17>(w2), rotateRight<19>(w2)), _mm256_srli_epi32(w2, 10));
+                w[t & 15] = _mm256_add_epi32(_mm256_add_epi32(w[t & 15], s0), _mm256_add_epi32(w[(t - 7) & 15], s1));
+            }
+
+            auto sigma1 = _mm256_xor_si256(_mm256_xor_si256(rotateRight<6>(e), rotateRight<11>(e)), rotateRight<25>(e));
+            auto choose = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+            auto t1 = _mm256_add_epi32(_mm256_add_epi32(h, sigma1), _mm256_add_epi32(choose, _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(RoundConstants[t])), w[t & 15])));
+
+            auto sigma0 = _mm256_xor_si256(_mm256_xor_si256(rotateRight<2>(a), rotateRight<13>(a)), rotateRight<22>(a));
+            auto majority = _mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_xor_si256(a, b)));
+            auto t2 = _mm256_add_epi32(sigma0, majority);
+
+            h = g;
+            g = f;
+            f = e;
+            e = _mm256_add_epi32(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = _mm256_add_epi32(t1, t2);
+        }
+
+        state[0] = _mm256_add_epi32(state[0], a);
+        state[1] = _mm256_add_epi32(state[1], b);
+        state[2] = _mm256_add_epi32(state[2], c);
+        state[3] = _mm256_add_epi32(state[3], d);
+        state[4] = _mm256_add_epi32(state[4], e);
+        state[5] = _mm256_add_epi32(state[5], f);
+        state[6] = _mm256_add_epi32(state[6], g);
+        state[7] = _mm256_add_epi32(state[7], h);
+    }
+
+    // SHA-256 of each message as if it followed a block that left initialState behind
+    AVX2_TARGET void hashBatch(const quint32* initialState, HashJob* jobs, qsizetype count) {
+        constexpr auto Lanes = Avx2HmacSha256::Lanes;
+        Lane lanes[Lanes];
+        bool active[Lanes] = {};
+        qsizetype nextJob = 0;
+
+        // Word i of lane l is at states[i][l], which is how compressLanes() lays it out
+        alignas(32) quint32 states[8][Lanes] = {};
+        auto startNext = [&](int l) {
+            active[l] = nextJob < count;
+            if (!active[l]) return;
+            startLane(&lanes[l], &jobs[nextJob++]);
+            for (auto i = 0; i < 8; i++) states[i][l] = initialState[i];
+        };
+        for (auto l = 0; l < Lanes; l++) startNext(l);
+
+        while (true) {
+            // Run every lane until the shortest one finishes
+            qsizetype steps = -1;
+            for (auto l = 0; l < Lanes; l++) {
+                if (active[l] && (steps == -1 || lanes[l].blocks - lanes[l].block < steps)) steps = lanes[l].blocks - lanes[l].block;
+            }
+            if (steps == -1) break;
+
+            __m256i state[8];
+            for (auto i = 0; i < 8; i++) state[i] = _mm256_load_si256(reinterpret_cast<const __m256i*>(states[i]));
+            for (qsizetype step = 0; step < steps; step++) {
+                const uchar* blocks[Lanes];
+                for (auto l = 0; l < Lanes; l++) blocks[l] = active[l] ? lanes[l].blockAt(lanes[l].block + step) : IdleBlock;
+                compressLanes(state, blocks);
+            }
+            for (auto i = 0; i < 8; i++) _mm256_store_si256(reinterpret_cast<__m256i*>(states[i]), state[i]);
+
+            for (auto l = 0; l < Lanes; l++) {
+                if (!active[l]) continue;
+                lanes[l].block += steps;
+                if (lanes[l].block != lanes[l].blocks) continue;
+
+                for (auto i = 0; i < 8; i++) qToBigEndian<quint32>(states[i][l], lanes[l].job->digest + i * 4);
+                startNext(l);
+            }
+        }
+    }
+} // namespace
+#endif
+
+Avx2HmacSha256::Avx2HmacSha256(const QByteArray& key) {
+    d = new Avx2HmacSha256Private();
+
+    // Keys longer than a block are hashed first, as HMAC does
+    auto blockKey = key.length() > 64 ? QCryptographicHash::hash(key, QCryptographicHash::Sha256) : key;
+    uchar inner[64];
+    uchar outer[64];
+    for (auto i = 0; i < 64; i++) {
+        auto byte = i < blockKey.length() ? static_cast<uchar>(blockKey.at(i)) : static_cast<uchar>(0);
+        inner[i] = byte ^ 0x36;
+        outer[i] = byte ^ 0x5c;
+    }
+
+    std::memcpy(d->innerState, InitialState, sizeof(InitialState));
+    compress(d->innerState, inner);
+    std::memcpy(d->outerState, InitialState, sizeof(InitialState));
+    compress(d->outerState, outer);
+}
+
+Avx2HmacSha256::~Avx2HmacSha256() {
+    // Don't leave the keyed states behind on the heap
+    volatile auto bytes = reinterpret_cast<volatile char*>(d);
+    for (std::size_t i = 0; i < sizeof(Avx2HmacSha256Private); i++) bytes[i] = 0;
+    delete d;
+}
+
+bool Avx2HmacSha256::isSupported() {
+#ifdef QNEARBYSHARE_AVX2
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+bool Avx2HmacSha256::isPreferred() {
+#ifdef QNEARBYSHARE_AVX2
+    static const bool preferred = [] {
+        if (!isSupported()) return false;
+
+        // The SHA extensions are bit 29 of EBX in leaf 7. Older compilers don't know "sha" for __builtin_cpu_supports.
+        unsigned int eax, ebx, ecx, edx;
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) return true;
+        return (ebx & (1u << 29)) == 0;
+    }();
+    return preferred;
+#else
+    return false;
+#endif
+}
+
+void Avx2HmacSha256::signBatch(HmacSha256Job* jobs, qsizetype count) {
+#ifdef QNEARBYSHARE_AVX2
+    // The inner hash of every message, then the outer hash of each inner digest
+    std::vector<char> innerDigests(count * 32);
+    std::vector<HashJob> hashJobs(count);
+    for (qsizetype i = 0; i < count; i++) hashJobs[i] = {jobs[i].input, jobs[i].length, innerDigests.data() + i * 32};
+    hashBatch(d->innerState, hashJobs.data(), count);
+
+    for (qsizetype i = 0; i < count; i++) hashJobs[i] = {innerDigests.data() + i * 32, 32, jobs[i].output};
+    hashBatch(d->outerState, hashJobs.data(), count);
+#else
+    Q_UNUSED(jobs)
+    Q_UNUSED(count)
+#endif
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_AVX2HMACSHA256_H
+#define QNEARBYSHARE_AVX2HMACSHA256_H
+
+#include <QByteArray>
+
+struct HmacSha256Job;
+struct Avx2HmacSha256Private;
+
+// HMAC-SHA256 over several messages at once using AVX2, for processors without the SHA extensions.
+//
+// SHA-256 can't be parallelised within a message since every block starts from the state the previous one left,
+// so a single message only ever uses one 32 bit lane of the vector units. Independent messages don't depend on each
+// other though, so signBatch() hashes up to Lanes messages side by side, one in each lane of a 256 bit register.
+//
+// With the SHA extensions a single message hashes about as fast as this does eight, and the engines' own HMAC uses
+// them, so the engines only batch through here where isPreferred() says so.
+//
+// Only available on x86 processors with AVX2; check isSupported() before creating one.
+class Avx2HmacSha256 {
+    public:
+        explicit Avx2HmacSha256(const QByteArray& key);
+        ~Avx2HmacSha256();
+
+        Avx2HmacSha256(const Avx2HmacSha256&) = delete;
+        Avx2HmacSha256& operator=(const Avx2HmacSha256&) = delete;
+
+        static constexpr int Lanes = 8;
+
+        static bool isSupported();
+
+        // AVX2 without the SHA extensions
+        static bool isPreferred();
+
+        void signBatch(HmacSha256Job* jobs, qsizetype count);
+
+    private:
+        Avx2HmacSha256Private* d;
+};
+
+#endif // QNEARBYSHARE_AVX2HMACSHA256_H
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_CRYPTOENGINE_H
+#define QNEARBYSHARE_CRYPTOENGINE_H
+
+#include "../cryptography.h"
+#include <QByteArrayView>
+#include <QString>
+#include <cstring>
+
+// Keys are created and used by a single engine, which derives its own key types from these
+struct EcKey {
+        virtual ~EcKey() = default;
+};
+
+struct AesKey {
+        virtual ~AesKey() = default;
+};
+
+struct HmacKey {
+        virtual ~HmacKey() = default;
+};
+
+// A cryptography backend. Both the OpenSSL and Crypto++ engines can be built into the library at the same time;
+// the free functions in the Cryptography namespace forward to whichever one Cryptography::engine() picked.
+class CryptoEngine {
+    public:
+        virtual ~CryptoEngine() = default;
+
+        virtual QString name() = 0;
+
+        virtual EcKey* generateEcdsaKeyPair() = 0;
+        virtual QByteArray ecdsaX(EcKey* key) = 0;
+        virtual QByteArray ecdsaY(EcKey* key) = 0;
+        virtual QByteArray diffieHellman(EcKey* ourKey, const QByteArray& peerX, const QByteArray& peerY) = 0;
+
+        // Curve25519 keys share the EcKey handle type; public keys are the raw 32 byte encoding from RFC 7748
+        virtual EcKey* generateX25519KeyPair() = 0;
+        virtual QByteArray x25519PublicKey(EcKey* key) = 0;
+        virtual QByteArray x25519DiffieHellman(EcKey* ourKey, const QByteArray& peerPublicKey) = 0;
+
+        virtual QByteArray hkdfExtractExpand(const QByteArray& salt, const QByteArray& ikm, const QByteArray& info, size_t length) = 0;
+        virtual QByteArray hkdfExtract(const QByteArray& salt, const QByteArray& ikm) = 0;
+        virtual QByteArray hkdfExpand(const QByteArray& prk, const QByteArray& info, size_t length) = 0;
+
+        virtual qsizetype aes256cbc(const char* input, qsizetype length, char* output, const QByteArray& key, const QByteArray& iv, bool isEncrypt) = 0;
+        virtual AesKey* createAes256CbcKey(const QByteArray& key, bool isEncrypt) = 0;
+        virtual qsizetype aes256cbc(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv) = 0;
+
+        // Engines that can't do better encrypt the messages one after another
+        virtual void aes256cbcEncryptBatch(AesKey* key, Aes256CbcJob* jobs, qsizetype count) {
+            for (qsizetype i = 0; i < count; i++) {
+                jobs[i].written = aes256cbc(key, jobs[i].input, jobs[i].length, jobs[i].output, jobs[i].iv);
+            }
+        }
+
+        virtual AesKey* createAes256GcmKey(const QByteArray& key, bool isEncrypt) = 0;
+        virtual qsizetype aes256gcmEncrypt(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, char* tag) = 0;
+        virtual qsizetype aes256gcmDecrypt(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, QByteArrayView tag) = 0;
+
+        virtual HmacKey* createHmacSha256Key(const QByteArray& key) = 0;
+        virtual void hmacSha256Begin(HmacKey* key) = 0;
+        virtual void hmacSha256Update(HmacKey* key, const char* data, qsizetype length) = 0;
+        virtual QByteArray hmacSha256Finish(HmacKey* key) = 0;
+
+        // Engines that can't do better sign the messages one after another
+        virtual void hmacSha256Batch(HmacKey* key, HmacSha256Job* jobs, qsizetype count) {
+            for (qsizetype i = 0; i < count; i++) {
+                hmacSha256Begin(key);
+                hmacSha256Update(key, jobs[i].input, jobs[i].length);
+                auto signature = hmacSha256Finish(key);
+                std::memcpy(jobs[i].output, signature.constData(), signature.size());
+            }
+        }
+
+        // Compares every byte whatever the contents, so that the time taken doesn't say where they differ
+        virtual bool constantTimeEquals(QByteArrayView first, QByteArrayView second) = 0;
+};
+
+#ifdef HAVE_OPENSSL
+CryptoEngine* createOpenSSLCryptoEngine();
+#endif
+
+#ifdef HAVE_CRYPTOPP
+CryptoEngine* createCryptoPPCryptoEngine();
+#endif
+
+#endif // QNEARBYSHARE_CRYPTOENGINE_H
@@ -22,66 +22,160 @@
  * SOFTWARE.
  */
 
-#include "../cryptography.h"
+#include "aesnicbc.h"
+#include "avx2hmacsha256.h"
+#include "cryptoengine.h"
 
 #include <cryptopp/eccrypto.h>
-#include <cryptopp/filters.h>
+#include <cryptopp/gcm.h>
 #include <cryptopp/hkdf.h>
+#include <cryptopp/hmac.h>
+#include <cryptopp/misc.h>
 #include <cryptopp/modes.h>
 #include <cryptopp/oids.h>
 #include <cryptopp/osrng.h>
 #include <cryptopp/rijndael.h>
+#include <cryptopp/sha.h>
+#include <cryptopp/xed25519.h>
+#include <cstring>
+#include <memory>
 
 using namespace CryptoPP;
 
 namespace CryptoPPSupport {
+    const DL_GroupParameters_EC<ECP>& secp256r1();
+    const ECDH<ECP>::Domain& ecdhDomain();
+    RandomNumberGenerator& rng();
 
-    QByteArray transform(StreamTransformationFilter* stf, const QByteArray& input);
-}
+    qsizetype cbcEncrypt(SymmetricCipher& cipher, const char* input, qsizetype length, char* output);
+    qsizetype cbcDecrypt(SymmetricCipher& cipher, const char* input, qsizetype length, char* output);
+    qsizetype cbc(SymmetricCipher& cipher, const char* input, qsizetype length, char* output);
+} // namespace CryptoPPSupport
+
+struct CryptoPPEcKey : EcKey {
+        SecByteBlock sk, pk;
+        ECP::Point publicPoint;
+};
 
-struct EcKey {
+struct CryptoPPX25519Key : EcKey {
         SecByteBlock sk, pk;
 };
 
-EcKey* Cryptography::generateEcdsaKeyPair() {
-    AutoSeededRandomPool prng;
-    ECDH<ECP>::Domain ecdh((ASN1::secp256r1()));
+struct CryptoPPAesKey : AesKey {
+        std::unique_ptr<SymmetricCipher> cipher;
+
+        // Used for batches of messages when encrypting and for every message when decrypting
+        std::unique_ptr<AesNiCbc> aesNi;
+};
+
+struct CryptoPPAesGcmKey : AesKey {
+        std::unique_ptr<AuthenticatedSymmetricCipher> cipher;
+};
+
+struct CryptoPPHmacKey : HmacKey {
+        // Hash states after absorbing the inner and outer padded keys
+        SHA256 innerKeyed, outerKeyed;
+        SHA256 inner;
+
+        // Used for batches of messages where the processor has no SHA extensions
+        std::unique_ptr<Avx2HmacSha256> avx2;
+};
+
+class CryptoPPCryptoEngine : public CryptoEngine {
+    public:
+        QString name() override;
+
+        EcKey* generateEcdsaKeyPair() override;
+        QByteArray ecdsaX(EcKey* key) override;
+        QByteArray ecdsaY(EcKey* key) override;
+        QByteArray diffieHellman(EcKey* ourKey, const QByteArray& peerX, const QByteArray& peerY) override;
+
+        EcKey* generateX25519KeyPair() override;
+        QByteArray x25519PublicKey(EcKey* key) override;
+        QByteArray x25519DiffieHellman(EcKey* ourKey, const QByteArray& peerPublicKey) override;
+
+        QByteArray hkdfExtractExpand(const QByteArray& salt, const QByteArray& ikm, const QByteArray& info, size_t length) override;
+        QByteArray hkdfExtract(const QByteArray& salt, const QByteArray& ikm) override;
+        QByteArray hkdfExpand(const QByteArray& prk, const QByteArray& info, size_t length) override;
+
+        qsizetype aes256cbc(const char* input, qsizetype length, char* output, const QByteArray& key, const QByteArray& iv, bool isEncrypt) override;
+        AesKey* createAes256CbcKey(const QByteArray& key, bool isEncrypt) override;
+        qsizetype aes256cbc(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv) override;
+        void aes256cbcEncryptBatch(AesKey* key, Aes256CbcJob* jobs, qsizetype count) override;
+
+        AesKey* createAes256GcmKey(const QByteArray& key, bool isEncrypt) override;
+        qsizetype aes256gcmEncrypt(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, char* tag) override;
+        qsizetype aes256gcmDecrypt(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, QByteArrayView tag) override;
+
+        HmacKey* createHmacSha256Key(const QByteArray& key) override;
+        void hmacSha256Begin(HmacKey* key) override;
+        void hmacSha256Update(HmacKey* key, const char* data, qsizetype length) override;
+        QByteArray hmacSha256Finish(HmacKey* key) override;
+        void hmacSha256Batch(HmacKey* key, HmacSha256Job* jobs, qsizetype count) override;
+
+        bool constantTimeEquals(QByteArrayView first, QByteArrayView second) override;
+};
+
+CryptoEngine* createCryptoPPCryptoEngine() {
+    return new CryptoPPCryptoEngine();
+}
+
+QString CryptoPPCryptoEngine::name() {
+    return QStringLiteral("cryptopp");
+}
+
+const DL_GroupParameters_EC<ECP>& CryptoPPSupport::secp256r1() {
+    // Building the curve parameters is expensive, so only do it once
+    static const DL_GroupParameters_EC<ECP> params(ASN1::secp256r1());
+    return params;
+}
+
+const ECDH<ECP>::Domain& CryptoPPSupport::ecdhDomain() {
+    static const ECDH<ECP>::Domain ecdh(secp256r1());
+    return ecdh;
+}
+
+RandomNumberGenerator& CryptoPPSupport::rng() {
+    static thread_local AutoSeededRandomPool prng;
+    return prng;
+}
+
+EcKey* CryptoPPCryptoEngine::generateEcdsaKeyPair() {
+    auto& ecdh = CryptoPPSupport::ecdhDomain();
 
     SecByteBlock sk(ecdh.PrivateKeyLength());
     SecByteBlock pk(ecdh.PublicKeyLength());
 
-    ecdh.GenerateKeyPair(prng, sk, pk);
-
-    DL_GroupParameters_EC<ECP> params(ASN1::secp256r1());
-    auto element = params.DecodeElement(pk, false);
+    ecdh.GenerateKeyPair(CryptoPPSupport::rng(), sk, pk);
 
-    return new EcKey{sk, pk};
+    auto key = new CryptoPPEcKey();
+    key->sk = sk;
+    key->pk = pk;
+    key->publicPoint = CryptoPPSupport::secp256r1().DecodeElement(pk, false);
+    return key;
 }
 
-QByteArray Cryptography::ecdsaX(EcKey* key) {
-    DL_GroupParameters_EC<ECP> params(ASN1::secp256r1());
-    auto element = params.DecodeElement(key->pk, false);
+QByteArray CryptoPPCryptoEngine::ecdsaX(EcKey* key) {
+    auto& publicPoint = static_cast<CryptoPPEcKey*>(key)->publicPoint;
 
-    QByteArray xBa(element.x.MinEncodedSize(Integer::SIGNED), Qt::Uninitialized);
-    element.x.Encode(reinterpret_cast<byte*>(xBa.data()), xBa.size(), Integer::SIGNED);
+    QByteArray xBa(publicPoint.x.MinEncodedSize(Integer::SIGNED), Qt::Uninitialized);
+    publicPoint.x.Encode(reinterpret_cast<byte*>(xBa.data()), xBa.size(), Integer::SIGNED);
 
     return xBa;
 }
 
-QByteArray Cryptography::ecdsaY(EcKey* key) {
-    DL_GroupParameters_EC<ECP> params(ASN1::secp256r1());
-    auto element = params.DecodeElement(key->pk, false);
+QByteArray CryptoPPCryptoEngine::ecdsaY(EcKey* key) {
+    auto& publicPoint = static_cast<CryptoPPEcKey*>(key)->publicPoint;
 
-    QByteArray yBa(element.y.MinEncodedSize(Integer::SIGNED), Qt::Uninitialized);
-    element.y.Encode(reinterpret_cast<byte*>(yBa.data()), yBa.size(), Integer::SIGNED);
+    QByteArray yBa(publicPoint.y.MinEncodedSize(Integer::SIGNED), Qt::Uninitialized);
+    publicPoint.y.Encode(reinterpret_cast<byte*>(yBa.data()), yBa.size(), Integer::SIGNED);
 
     return yBa;
 }
 
-QByteArray Cryptography::diffieHellman(EcKey* ourKey, const QByteArray& peerX, const QByteArray& peerY) {
-    AutoSeededRandomPool prng;
-    ECDH<ECP>::Domain ecdh((ASN1::secp256r1()));
-    DL_GroupParameters_EC<ECP> params(ASN1::secp256r1());
+QByteArray CryptoPPCryptoEngine::diffieHellman(EcKey* ourKey, const QByteArray& peerX, const QByteArray& peerY) {
+    auto& ecdh = CryptoPPSupport::ecdhDomain();
+    auto& params = CryptoPPSupport::secp256r1();
 
     Integer x, y;
     x.Decode(reinterpret_cast<const byte*>(peerX.constData()), peerX.size(), Integer::SIGNED);
@@ -90,14 +184,44 @@ QByteArray Cryptography::diffieHellman(EcKey* ourKey, const QByteArray& peerX, c
     QByteArray otherPk(params.GetEncodedElementSize(true), Qt::Uninitialized);
     params.EncodeElement(true, ECP::Point(x, y), reinterpret_cast<byte*>(otherPk.data()));
 
-    ECP::Point q(x, y);
     SecByteBlock output(ecdh.AgreedValueLength());
-    ecdh.Agree(output, ourKey->sk, reinterpret_cast<const byte*>(otherPk.constData()));
+    if (!ecdh.Agree(output, static_cast<CryptoPPEcKey*>(ourKey)->sk, reinterpret_cast<const byte*>(otherPk.constData()))) {
+        // The peer's point is not on the curve
+        return {};
+    }
+
+    return {reinterpret_cast<const char*>(output.data()), static_cast<qsizetype>(output.size())};
+}
+
+EcKey* CryptoPPCryptoEngine::generateX25519KeyPair() {
+    x25519 domain;
+
+    auto key = new CryptoPPX25519Key();
+    key->sk.New(domain.PrivateKeyLength());
+    key->pk.New(domain.PublicKeyLength());
+    domain.GenerateKeyPair(CryptoPPSupport::rng(), key->sk, key->pk);
+    return key;
+}
+
+QByteArray CryptoPPCryptoEngine::x25519PublicKey(EcKey* key) {
+    auto& pk = static_cast<CryptoPPX25519Key*>(key)->pk;
+    return {reinterpret_cast<const char*>(pk.data()), static_cast<qsizetype>(pk.size())};
+}
+
+QByteArray CryptoPPCryptoEngine::x25519DiffieHellman(EcKey* ourKey, const QByteArray& peerPublicKey) {
+    x25519 domain;
+    if (peerPublicKey.length() != static_cast<qsizetype>(domain.PublicKeyLength())) return {};
+
+    SecByteBlock output(domain.AgreedValueLength());
+    if (!domain.Agree(output, static_cast<CryptoPPX25519Key*>(ourKey)->sk, reinterpret_cast<const byte*>(peerPublicKey.constData()))) {
+        // The peer sent a low order point
+        return {};
+    }
 
     return {reinterpret_cast<const char*>(output.data()), static_cast<qsizetype>(output.size())};
 }
 
-QByteArray Cryptography::hkdfExtractExpand(const QByteArray& salt, const QByteArray& ikm, const QByteArray& info, size_t length) {
+QByteArray CryptoPPCryptoEngine::hkdfExtractExpand(const QByteArray& salt, const QByteArray& ikm, const QByteArray& info, size_t length) {
     HKDF<SHA256> hkdf;
 
     QByteArray output(length, Qt::Uninitialized);
@@ -106,32 +230,258 @@ QByteArray Cryptography::hkdfExtractExpand(const QByteArray& salt, const QByteAr
     return output;
 }
 
-QByteArray Cryptography::aes256cbc(const QByteArray& input, const QByteArray& key, const QByteArray& iv, bool isEncrypt) {
-    if (isEncrypt) {
-        CBC_Mode<AES>::Encryption e;
-        e.SetKeyWithIV(reinterpret_cast<const byte*>(key.constData()), key.length(), reinterpret_cast<const byte*>(iv.constData()), iv.length());
-        StreamTransformationFilter stf(e, nullptr, CryptoPP::BlockPaddingSchemeDef::PKCS_PADDING);
-        return CryptoPPSupport::transform(&stf, input);
+QByteArray CryptoPPCryptoEngine::hkdfExtract(const QByteArray& salt, const QByteArray& ikm) {
+    // An empty salt is the same as HashLen zero bytes once HMAC pads the key
+    HMAC<SHA256> hmac(reinterpret_cast<const byte*>(salt.constData()), salt.size());
+
+    QByteArray prk(SHA256::DIGESTSIZE, Qt::Uninitialized);
+    hmac.CalculateDigest(reinterpret_cast<byte*>(prk.data()), reinterpret_cast<const byte*>(ikm.constData()), ikm.size());
+    return prk;
+}
+
+QByteArray CryptoPPCryptoEngine::hkdfExpand(const QByteArray& prk, const QByteArray& info, size_t length) {
+    if (length > 255 * SHA256::DIGESTSIZE) return {};
+
+    HMAC<SHA256> hmac(reinterpret_cast<const byte*>(prk.constData()), prk.size());
+
+    // T(i) = HMAC(PRK, T(i - 1) | info | i)
+    QByteArray output(length, Qt::Uninitialized);
+    byte block[SHA256::DIGESTSIZE];
+    size_t written = 0;
+    for (byte counter = 1; written < length; counter++) {
+        if (counter > 1) hmac.Update(block, sizeof(block));
+        hmac.Update(reinterpret_cast<const byte*>(info.constData()), info.size());
+        hmac.Update(&counter, 1);
+        hmac.Final(block);
+
+        auto take = qMin(length - written, sizeof(block));
+        std::memcpy(output.data() + written, block, take);
+        written += take;
+    }
+    return output;
+}
+
+qsizetype CryptoPPCryptoEngine::aes256cbc(const char* input, qsizetype length, char* output, const QByteArray& key, const QByteArray& iv, bool isEncrypt) {
+    try {
+        if (isEncrypt) {
+            CBC_Mode<AES>::Encryption e;
+            e.SetKeyWithIV(reinterpret_cast<const byte*>(key.constData()), key.length(), reinterpret_cast<const byte*>(iv.constData()), iv.length());
+            return CryptoPPSupport::cbcEncrypt(e, input, length, output);
+        } else {
+            CBC_Mode<AES>::Decryption d;
+            d.SetKeyWithIV(reinterpret_cast<const byte*>(key.constData()), key.length(), reinterpret_cast<const byte*>(iv.constData()), iv.length());
+            return CryptoPPSupport::cbcDecrypt(d, input, length, output);
+        }
+    } catch (const Exception& ex) {
+        // Invalid key or IV length
+        return -1;
+    }
+}
+
+qsizetype CryptoPPSupport::cbcEncrypt(SymmetricCipher& cipher, const char* input, qsizetype length, char* output) {
+    // Run all the whole blocks through the cipher in one call, then pad the tail ourselves (PKCS#7)
+    auto fullLength = length - length % AES::BLOCKSIZE;
+    if (fullLength > 0) {
+        cipher.ProcessData(reinterpret_cast<byte*>(output), reinterpret_cast<const byte*>(input), fullLength);
+    }
+
+    byte lastBlock[AES::BLOCKSIZE];
+    auto remaining = length - fullLength;
+    std::memcpy(lastBlock, input + fullLength, remaining);
+    std::memset(lastBlock + remaining, static_cast<int>(AES::BLOCKSIZE - remaining), AES::BLOCKSIZE - remaining);
+    cipher.ProcessData(reinterpret_cast<byte*>(output + fullLength), lastBlock, AES::BLOCKSIZE);
+
+    return fullLength + AES::BLOCKSIZE;
+}
+
+qsizetype CryptoPPSupport::cbcDecrypt(SymmetricCipher& cipher, const char* input, qsizetype length, char* output) {
+    if (length == 0 || length % AES::BLOCKSIZE != 0) return -1;
+
+    cipher.ProcessData(reinterpret_cast<byte*>(output), reinterpret_cast<const byte*>(input), length);
+
+    // Check the PKCS#7 padding without branching on the padding bytes themselves
+    auto padding = static_cast<byte>(output[length - 1]);
+    if (padding == 0 || padding > AES::BLOCKSIZE) return -1;
+
+    byte mismatch = 0;
+    for (qsizetype i = 0; i < AES::BLOCKSIZE; i++) {
+        auto inPadding = static_cast<byte>(-static_cast<int>(i < padding));
+        mismatch |= inPadding & (static_cast<byte>(output[length - 1 - i]) ^ padding);
+    }
+    if (mismatch != 0) return -1;
+
+    return length - padding;
+}
+
+qsizetype CryptoPPSupport::cbc(SymmetricCipher& cipher, const char* input, qsizetype length, char* output) {
+    if (cipher.IsForwardTransformation()) {
+        return cbcEncrypt(cipher, input, length, output);
     } else {
-        CBC_Mode<AES>::Decryption d;
-        d.SetKeyWithIV(reinterpret_cast<const byte*>(key.constData()), key.length(), reinterpret_cast<const byte*>(iv.constData()), iv.length());
-        StreamTransformationFilter stf(d, nullptr, CryptoPP::BlockPaddingSchemeDef::PKCS_PADDING);
-        return CryptoPPSupport::transform(&stf, input);
+        return cbcDecrypt(cipher, input, length, output);
+    }
+}
+
+AesKey* CryptoPPCryptoEngine::createAes256CbcKey(const QByteArray& key, bool isEncrypt) {
+    try {
+        // The key schedule is expanded here; the IV is only a placeholder until the first message
+        byte iv[AES::BLOCKSIZE] = {};
+        std::unique_ptr<SymmetricCipher> cipher;
+        if (isEncrypt) {
+            cipher = std::make_unique<CBC_Mode<AES>::Encryption>();
+        } else {
+            cipher = std::make_unique<CBC_Mode<AES>::Decryption>();
+        }
+        cipher->SetKeyWithIV(reinterpret_cast<const byte*>(key.constData()), key.length(), iv, sizeof(iv));
+        auto aesKey = new CryptoPPAesKey();
+        aesKey->cipher = std::move(cipher);
+        if (key.length() == 32 && AesNiCbc::isSupported()) aesKey->aesNi = std::make_unique<AesNiCbc>(key);
+        return aesKey;
+    } catch (const Exception& ex) {
+        // Invalid key length
+        return nullptr;
     }
 }
 
-QByteArray CryptoPPSupport::transform(StreamTransformationFilter* stf, const QByteArray& input) {
-    for (char i : input) {
-        stf->Put(i);
+qsizetype CryptoPPCryptoEngine::aes256cbc(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv) {
+    auto aesKey = static_cast<CryptoPPAesKey*>(key);
+    if (!aesKey->cipher->IsForwardTransformation() && aesKey->aesNi) {
+        return aesKey->aesNi->decrypt(input, length, output, iv);
     }
-    stf->MessageEnd();
 
-    QByteArray output(stf->MaxRetrievable(), Qt::Uninitialized);
-    stf->Get(reinterpret_cast<byte*>(output.data()), output.size());
+    auto& cipher = *aesKey->cipher;
 
-    return output;
+    try {
+        cipher.Resynchronize(reinterpret_cast<const byte*>(iv.data()), static_cast<int>(iv.size()));
+        return CryptoPPSupport::cbc(cipher, input, length, output);
+    } catch (const Exception& ex) {
+        // Invalid IV length
+        return -1;
+    }
+}
+
+void CryptoPPCryptoEngine::aes256cbcEncryptBatch(AesKey* key, Aes256CbcJob* jobs, qsizetype count) {
+    auto aesKey = static_cast<CryptoPPAesKey*>(key);
+    if (!aesKey->cipher->IsForwardTransformation() || !aesKey->aesNi) {
+        CryptoEngine::aes256cbcEncryptBatch(key, jobs, count);
+        return;
+    }
+    aesKey->aesNi->encryptBatch(jobs, count);
+}
+
+AesKey* CryptoPPCryptoEngine::createAes256GcmKey(const QByteArray& key, bool isEncrypt) {
+    if (key.length() != 32) {
+        return nullptr;
+    }
+
+    try {
+        // As with CBC the key schedule is expanded here and the IV is supplied with each message
+        byte iv[Cryptography::Aes256GcmIvLength] = {};
+        std::unique_ptr<AuthenticatedSymmetricCipher> cipher;
+        if (isEncrypt) {
+            cipher = std::make_unique<GCM<AES>::Encryption>();
+        } else {
+            cipher = std::make_unique<GCM<AES>::Decryption>();
+        }
+        cipher->SetKeyWithIV(reinterpret_cast<const byte*>(key.constData()), key.length(), iv, sizeof(iv));
+        auto aesKey = new CryptoPPAesGcmKey();
+        aesKey->cipher = std::move(cipher);
+        return aesKey;
+    } catch (const Exception& ex) {
+        return nullptr;
+    }
+}
+
+qsizetype CryptoPPCryptoEngine::aes256gcmEncrypt(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, char* tag) {
+    auto& cipher = *static_cast<CryptoPPAesGcmKey*>(key)->cipher;
+    if (iv.size() != Cryptography::Aes256GcmIvLength) {
+        return -1;
+    }
+
+    try {
+        cipher.EncryptAndAuthenticate(reinterpret_cast<byte*>(output), reinterpret_cast<byte*>(tag), Cryptography::Aes256GcmTagLength,
+            reinterpret_cast<const byte*>(iv.data()), static_cast<int>(iv.size()),
+            reinterpret_cast<const byte*>(associatedData.data()), associatedData.size(),
+            reinterpret_cast<const byte*>(input), length);
+        return length;
+    } catch (const Exception& ex) {
+        return -1;
+    }
+}
+
+qsizetype CryptoPPCryptoEngine::aes256gcmDecrypt(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, QByteArrayView tag) {
+    auto& cipher = *static_cast<CryptoPPAesGcmKey*>(key)->cipher;
+    if (iv.size() != Cryptography::Aes256GcmIvLength || tag.size() != Cryptography::Aes256GcmTagLength) {
+        return -1;
+    }
+
+    try {
+        auto verified = cipher.DecryptAndVerify(reinterpret_cast<byte*>(output), reinterpret_cast<const byte*>(tag.data()), tag.size(),
+            reinterpret_cast<const byte*>(iv.data()), static_cast<int>(iv.size()),
+            reinterpret_cast<const byte*>(associatedData.data()), associatedData.size(),
+            reinterpret_cast<const byte*>(input), length);
+        return verified ? length : -1;
+    } catch (const Exception& ex) {
+        return -1;
+    }
+}
+
+HmacKey* CryptoPPCryptoEngine::createHmacSha256Key(const QByteArray& key) {
+    // Keys longer than a block are hashed first (RFC 2104)
+    byte paddedKey[SHA256::BLOCKSIZE] = {};
+    if (key.length() > SHA256::BLOCKSIZE) {
+        SHA256().CalculateDigest(paddedKey, reinterpret_cast<const byte*>(key.constData()), key.length());
+    } else {
+        std::memcpy(paddedKey, key.constData(), key.length());
+    }
+
+    auto hmacKey = new CryptoPPHmacKey();
+
+    byte pad[SHA256::BLOCKSIZE];
+    for (auto i = 0; i < SHA256::BLOCKSIZE; i++) pad[i] = paddedKey[i] ^ 0x36;
+    hmacKey->innerKeyed.Update(pad, sizeof(pad));
+    for (auto i = 0; i < SHA256::BLOCKSIZE; i++) pad[i] = paddedKey[i] ^ 0x5C;
+    hmacKey->outerKeyed.Update(pad, sizeof(pad));
+
+    SecureWipeArray(paddedKey, sizeof(paddedKey));
+    SecureWipeArray(pad, sizeof(pad));
+
+    if (Avx2HmacSha256::isPreferred()) hmacKey->avx2 = std::make_unique<Avx2HmacSha256>(key);
+    return hmacKey;
+}
+
+void CryptoPPCryptoEngine::hmacSha256Begin(HmacKey* key) {
+    auto hmacKey = static_cast<CryptoPPHmacKey*>(key);
+    hmacKey->inner = hmacKey->innerKeyed;
+}
+
+void CryptoPPCryptoEngine::hmacSha256Update(HmacKey* key, const char* data, qsizetype length) {
+    static_cast<CryptoPPHmacKey*>(key)->inner.Update(reinterpret_cast<const byte*>(data), length);
+}
+
+QByteArray CryptoPPCryptoEngine::hmacSha256Finish(HmacKey* key) {
+    auto hmacKey = static_cast<CryptoPPHmacKey*>(key);
+
+    byte innerDigest[SHA256::DIGESTSIZE];
+    hmacKey->inner.Final(innerDigest);
+
+    SHA256 outer(hmacKey->outerKeyed);
+    outer.Update(innerDigest, sizeof(innerDigest));
+
+    QByteArray signature(SHA256::DIGESTSIZE, Qt::Uninitialized);
+    outer.Final(reinterpret_cast<byte*>(signature.data()));
+    return signature;
+}
+
+void CryptoPPCryptoEngine::hmacSha256Batch(HmacKey* key, HmacSha256Job* jobs, qsizetype count) {
+    auto hmacKey = static_cast<CryptoPPHmacKey*>(key);
+    // A single message would leave seven of the eight lanes idle
+    if (!hmacKey->avx2 || count < 2) {
+        CryptoEngine::hmacSha256Batch(key, jobs, count);
+        return;
+    }
+    hmacKey->avx2->signBatch(jobs, count);
 }
 
-void Cryptography::deleteEcdsaKeyPair(EcKey* key) {
-    delete key;
+bool CryptoPPCryptoEngine::constantTimeEquals(QByteArrayView first, QByteArrayView second) {
+    return VerifyBufsEqual(reinterpret_cast<const byte*>(first.data()), reinterpret_cast<const byte*>(second.data()), first.size());
 }
@@ -22,26 +22,127 @@
  * SOFTWARE.
  */
 
-#include "../cryptography.h"
+#include "aesnicbc.h"
+#include "avx2hmacsha256.h"
+#include "cryptoengine.h"
 
 #include <QTextStream>
 #include <openssl/bn.h>
 #include <openssl/core_names.h>
+#include <openssl/crypto.h>
 #include <openssl/ec.h>
 #include <openssl/evp.h>
 #include <openssl/kdf.h>
+#include <openssl/params.h>
 
 namespace OpenSSLSupport {
     QByteArray bignumToBytes(BIGNUM* bn);
     BIGNUM* bytesToBignum(QByteArray ba);
     QByteArray ecdsaBignumParam(EcKey* key, const char* paramName);
+    QByteArray hkdf(EVP_KDF* kdf, int mode, const QByteArray& salt, const QByteArray& key, const QByteArray& info, size_t length);
 } // namespace OpenSSLSupport
 
-struct EcKey {
+struct OpenSSLEcKey : EcKey {
+        explicit OpenSSLEcKey(EVP_PKEY* key) :
+            key(key) {
+        }
+        ~OpenSSLEcKey() override {
+            EVP_PKEY_free(key);
+        }
+
         EVP_PKEY* key;
 };
 
-EcKey* Cryptography::generateEcdsaKeyPair() {
+struct OpenSSLAesKey : AesKey {
+        explicit OpenSSLAesKey(EVP_CIPHER_CTX* ctx) :
+            ctx(ctx) {
+        }
+        ~OpenSSLAesKey() override {
+            EVP_CIPHER_CTX_free(ctx);
+            delete aesNi;
+        }
+
+        EVP_CIPHER_CTX* ctx;
+        bool isEncrypt = true;
+
+        // Used for batches of messages when encrypting and for every message when decrypting
+        AesNiCbc* aesNi = nullptr;
+};
+
+struct OpenSSLHmacKey : HmacKey {
+        explicit OpenSSLHmacKey(EVP_MAC_CTX* ctx) :
+            ctx(ctx) {
+        }
+        ~OpenSSLHmacKey() override {
+            EVP_MAC_CTX_free(ctx);
+            delete avx2;
+        }
+
+        EVP_MAC_CTX* ctx;
+
+        // Used for batches of messages where the processor has no SHA extensions
+        Avx2HmacSha256* avx2 = nullptr;
+};
+
+class OpenSSLCryptoEngine : public CryptoEngine {
+    public:
+        OpenSSLCryptoEngine();
+        ~OpenSSLCryptoEngine() override;
+
+        QString name() override;
+
+        EcKey* generateEcdsaKeyPair() override;
+        QByteArray ecdsaX(EcKey* key) override;
+        QByteArray ecdsaY(EcKey* key) override;
+        QByteArray diffieHellman(EcKey* ourKey, const QByteArray& peerX, const QByteArray& peerY) override;
+
+        EcKey* generateX25519KeyPair() override;
+        QByteArray x25519PublicKey(EcKey* key) override;
+        QByteArray x25519DiffieHellman(EcKey* ourKey, const QByteArray& peerPublicKey) override;
+
+        QByteArray hkdfExtractExpand(const QByteArray& salt, const QByteArray& ikm, const QByteArray& info, size_t length) override;
+        QByteArray hkdfExtract(const QByteArray& salt, const QByteArray& ikm) override;
+        QByteArray hkdfExpand(const QByteArray& prk, const QByteArray& info, size_t length) override;
+
+        qsizetype aes256cbc(const char* input, qsizetype length, char* output, const QByteArray& key, const QByteArray& iv, bool isEncrypt) override;
+        AesKey* createAes256CbcKey(const QByteArray& key, bool isEncrypt) override;
+        qsizetype aes256cbc(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv) override;
+        void aes256cbcEncryptBatch(AesKey* key, Aes256CbcJob* jobs, qsizetype count) override;
+
+        AesKey* createAes256GcmKey(const QByteArray& key, bool isEncrypt) override;
+        qsizetype aes256gcmEncrypt(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, char* tag) override;
+        qsizetype aes256gcmDecrypt(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, QByteArrayView tag) override;
+
+        HmacKey* createHmacSha256Key(const QByteArray& key) override;
+        void hmacSha256Begin(HmacKey* key) override;
+        void hmacSha256Update(HmacKey* key, const char* data, qsizetype length) override;
+        QByteArray hmacSha256Finish(HmacKey* key) override;
+        void hmacSha256Batch(HmacKey* key, HmacSha256Job* jobs, qsizetype count) override;
+
+        bool constantTimeEquals(QByteArrayView first, QByteArrayView second) override;
+
+    private:
+        // Fetched once; looking the algorithm up is a large part of the cost of a single derivation
+        EVP_KDF* hkdf;
+};
+
+CryptoEngine* createOpenSSLCryptoEngine() {
+    return new OpenSSLCryptoEngine();
+}
+
+OpenSSLCryptoEngine::OpenSSLCryptoEngine() {
+    hkdf = EVP_KDF_fetch(nullptr, OSSL_KDF_NAME_HKDF, nullptr);
+}
+
+OpenSSLCryptoEngine::~OpenSSLCryptoEngine() {
+    EVP_KDF_free(hkdf);
+}
+
+QString OpenSSLCryptoEngine::name() {
+    return QStringLiteral("openssl");
+}
+
+EcKey* OpenSSLCryptoEngine::generateEcdsaKeyPair() {
     auto ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
     if (ctx == nullptr) {
         return nullptr;
@@ -60,19 +161,19 @@ EcKey* Cryptography::generateEcdsaKeyPair() {
     }
 
     // Generate the ECDSA key pair
-    EVP_PKEY* clientKey;
+    EVP_PKEY* clientKey = nullptr;
     if (EVP_PKEY_keygen(ctx, &clientKey) <= 0) {
         EVP_PKEY_CTX_free(ctx);
         return nullptr;
     }
 
     EVP_PKEY_CTX_free(ctx);
-    return new EcKey{clientKey};
+    return new OpenSSLEcKey(clientKey);
 }
 
 QByteArray OpenSSLSupport::ecdsaBignumParam(EcKey* key, const char* paramName) {
     auto n = BN_new();
-    auto ok = EVP_PKEY_get_bn_param(key->key, paramName, &n);
+    auto ok = EVP_PKEY_get_bn_param(static_cast<OpenSSLEcKey*>(key)->key, paramName, &n);
     if (!ok) {
         BN_free(n);
         return {};
@@ -85,15 +186,15 @@ QByteArray OpenSSLSupport::ecdsaBignumParam(EcKey* key, const char* paramName) {
     return nBytes;
 }
 
-QByteArray Cryptography::ecdsaX(EcKey* key) {
+QByteArray OpenSSLCryptoEngine::ecdsaX(EcKey* key) {
     return OpenSSLSupport::ecdsaBignumParam(key, OSSL_PKEY_PARAM_EC_PUB_X);
 }
 
-QByteArray Cryptography::ecdsaY(EcKey* key) {
+QByteArray OpenSSLCryptoEngine::ecdsaY(EcKey* key) {
     return OpenSSLSupport::ecdsaBignumParam(key, OSSL_PKEY_PARAM_EC_PUB_Y);
 }
 
-QByteArray Cryptography::diffieHellman(EcKey* ourKey, const QByteArray& peerX, const QByteArray& peerY) {
+QByteArray OpenSSLCryptoEngine::diffieHellman(EcKey* ourKey, const QByteArray& peerX, const QByteArray& peerY) {
     auto bnX = OpenSSLSupport::bytesToBignum(peerX);
     auto bnY = OpenSSLSupport::bytesToBignum(peerY);
 
@@ -110,7 +211,7 @@ QByteArray Cryptography::diffieHellman(EcKey* ourKey, const QByteArray& peerX, c
     EVP_PKEY_assign_EC_KEY(peerKey, ecPeerKey);
 
     /* Create the context for the shared secret derivation */
-    auto ctx = EVP_PKEY_CTX_new(ourKey->key, nullptr);
+    auto ctx = EVP_PKEY_CTX_new(static_cast<OpenSSLEcKey*>(ourKey)->key, nullptr);
     if (ctx == nullptr) {
         EVP_PKEY_free(peerKey);
         return {};
@@ -156,7 +257,62 @@ QByteArray Cryptography::diffieHellman(EcKey* ourKey, const QByteArray& peerX, c
     return secret;
 }
 
-QByteArray Cryptography::hkdfExtractExpand(const QByteArray& salt, const QByteArray& ikm, const QByteArray& info, size_t length) {
+EcKey* OpenSSLCryptoEngine::generateX25519KeyPair() {
+    auto ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, nullptr);
+    if (ctx == nullptr) {
+        return nullptr;
+    }
+
+    EVP_PKEY* key = nullptr;
+    if (EVP_PKEY_keygen_init(ctx) <= 0 || EVP_PKEY_keygen(ctx, &key) <= 0) {
+        EVP_PKEY_CTX_free(ctx);
+        return nullptr;
+    }
+
+    EVP_PKEY_CTX_free(ctx);
+    return new OpenSSLEcKey(key);
+}
+
+QByteArray OpenSSLCryptoEngine::x25519PublicKey(EcKey* key) {
+    QByteArray publicKey(32, Qt::Uninitialized);
+    size_t length = publicKey.size();
+    if (EVP_PKEY_get_raw_public_key(static_cast<OpenSSLEcKey*>(key)->key, reinterpret_cast<unsigned char*>(publicKey.data()), &length) <= 0 || length != 32) {
+        return {};
+    }
+    return publicKey;
+}
+
+QByteArray OpenSSLCryptoEngine::x25519DiffieHellman(EcKey* ourKey, const QByteArray& peerPublicKey) {
+    if (peerPublicKey.length() != 32) return {};
+
+    auto peerKey = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, nullptr, reinterpret_cast<const unsigned char*>(peerPublicKey.constData()), peerPublicKey.length());
+    if (peerKey == nullptr) {
+        return {};
+    }
+
+    auto ctx = EVP_PKEY_CTX_new(static_cast<OpenSSLEcKey*>(ourKey)->key, nullptr);
+    if (ctx == nullptr) {
+        EVP_PKEY_free(peerKey);
+        return {};
+    }
+
+    // Deriving fails if the peer sent a low order point, which would give an all zero secret
+    QByteArray secret(32, Qt::Uninitialized);
+    size_t secretLen = secret.size();
+    if (EVP_PKEY_derive_init(ctx) <= 0 ||
+        EVP_PKEY_derive_set_peer(ctx, peerKey) <= 0 ||
+        EVP_PKEY_derive(ctx, reinterpret_cast<unsigned char*>(secret.data()), &secretLen) <= 0) {
+        EVP_PKEY_CTX_free(ctx);
+        EVP_PKEY_free(peerKey);
+        return {};
+    }
+
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(peerKey);
+    return secret;
+}
+
+QByteArray OpenSSLCryptoEngine::hkdfExtractExpand(const QByteArray& salt, const QByteArray& ikm, const QByteArray& info, size_t length) {
     EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
     if (!ctx) {
         // Clean up
@@ -188,43 +344,243 @@ QByteArray Cryptography::hkdfExtractExpand(const QByteArray& salt, const QByteAr
     return outputKey;
 }
 
-QByteArray Cryptography::aes256cbc(const QByteArray& input, const QByteArray& key, const QByteArray& iv, bool isEncrypt) {
+QByteArray OpenSSLCryptoEngine::hkdfExtract(const QByteArray& salt, const QByteArray& ikm) {
+    return OpenSSLSupport::hkdf(hkdf, EVP_KDF_HKDF_MODE_EXTRACT_ONLY, salt, ikm, {}, 32);
+}
+
+QByteArray OpenSSLCryptoEngine::hkdfExpand(const QByteArray& prk, const QByteArray& info, size_t length) {
+    return OpenSSLSupport::hkdf(hkdf, EVP_KDF_HKDF_MODE_EXPAND_ONLY, {}, prk, info, length);
+}
+
+qsizetype OpenSSLCryptoEngine::aes256cbc(const char* input, qsizetype length, char* output, const QByteArray& key, const QByteArray& iv, bool isEncrypt) {
     EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
     if (!ctx) {
-        return {};
+        return -1;
     }
 
     EVP_CIPHER_CTX_set_padding(ctx, EVP_PADDING_PKCS7);
 
     if (EVP_CipherInit_ex(ctx, EVP_aes_256_cbc(), nullptr, reinterpret_cast<const unsigned char*>(key.constData()), reinterpret_cast<const unsigned char*>(iv.constData()), isEncrypt) <= 0) {
         EVP_CIPHER_CTX_free(ctx);
-        return {};
+        return -1;
     }
 
-    QByteArray output(input.length() + 32, Qt::Uninitialized);
     int outputLength;
-    if (EVP_CipherUpdate(ctx, reinterpret_cast<unsigned char*>(output.data()), &outputLength, reinterpret_cast<const unsigned char*>(input.constData()), input.length()) <= 0) {
+    if (EVP_CipherUpdate(ctx, reinterpret_cast<unsigned char*>(output), &outputLength, reinterpret_cast<const unsigned char*>(input), static_cast<int>(length)) <= 0) {
         EVP_CIPHER_CTX_free(ctx);
-        return {};
+        return -1;
     }
 
     auto fullOutputLength = outputLength;
-    if (EVP_CipherFinal_ex(ctx, reinterpret_cast<unsigned char*>(output.data() + outputLength), &outputLength) <= 0) {
+    if (EVP_CipherFinal_ex(ctx, reinterpret_cast<unsigned char*>(output + outputLength), &outputLength) <= 0) {
         EVP_CIPHER_CTX_free(ctx);
-        return {};
+        return -1;
     }
     fullOutputLength += outputLength;
 
-    output.truncate(fullOutputLength);
-
     /* Clean up */
     EVP_CIPHER_CTX_free(ctx);
 
-    return output;
+    return fullOutputLength;
 }
 
-void Cryptography::deleteEcdsaKeyPair(EcKey* key) {
-    delete key;
+AesKey* OpenSSLCryptoEngine::createAes256CbcKey(const QByteArray& key, bool isEncrypt) {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        return nullptr;
+    }
+
+    // Expand the key schedule now; the IV is supplied with each message
+    if (EVP_CipherInit_ex(ctx, EVP_aes_256_cbc(), nullptr, reinterpret_cast<const unsigned char*>(key.constData()), nullptr, isEncrypt) <= 0) {
+        EVP_CIPHER_CTX_free(ctx);
+        return nullptr;
+    }
+    EVP_CIPHER_CTX_set_padding(ctx, EVP_PADDING_PKCS7);
+
+    auto aesKey = new OpenSSLAesKey(ctx);
+    aesKey->isEncrypt = isEncrypt;
+    if (key.length() == 32 && AesNiCbc::isSupported()) aesKey->aesNi = new AesNiCbc(key);
+    return aesKey;
+}
+
+qsizetype OpenSSLCryptoEngine::aes256cbc(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv) {
+    auto aesKey = static_cast<OpenSSLAesKey*>(key);
+    if (!aesKey->isEncrypt && aesKey->aesNi != nullptr) {
+        return aesKey->aesNi->decrypt(input, length, output, iv);
+    }
+
+    auto ctx = aesKey->ctx;
+
+    // Passing only the IV keeps the cipher and key schedule set up in createAes256CbcKey
+    if (EVP_CipherInit_ex(ctx, nullptr, nullptr, nullptr, reinterpret_cast<const unsigned char*>(iv.data()), -1) <= 0) {
+        return -1;
+    }
+
+    int outputLength;
+    if (EVP_CipherUpdate(ctx, reinterpret_cast<unsigned char*>(output), &outputLength, reinterpret_cast<const unsigned char*>(input), static_cast<int>(length)) <= 0) {
+        return -1;
+    }
+
+    auto fullOutputLength = outputLength;
+    if (EVP_CipherFinal_ex(ctx, reinterpret_cast<unsigned char*>(output + outputLength), &outputLength) <= 0) {
+        return -1;
+    }
+    fullOutputLength += outputLength;
+
+    return fullOutputLength;
+}
+
+void OpenSSLCryptoEngine::aes256cbcEncryptBatch(AesKey* key, Aes256CbcJob* jobs, qsizetype count) {
+    auto aesKey = static_cast<OpenSSLAesKey*>(key);
+    if (!aesKey->isEncrypt || aesKey->aesNi == nullptr) {
+        CryptoEngine::aes256cbcEncryptBatch(key, jobs, count);
+        return;
+    }
+    aesKey->aesNi->encryptBatch(jobs, count);
+}
+
+AesKey* OpenSSLCryptoEngine::createAes256GcmKey(const QByteArray& key, bool isEncrypt) {
+    if (key.length() != 32) {
+        return nullptr;
+    }
+
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) {
+        return nullptr;
+    }
+
+    // As with CBC the key schedule (and the GHASH key) is set up once and each message only sets the IV
+    if (EVP_CipherInit_ex(ctx, EVP_aes_256_gcm(), nullptr, reinterpret_cast<const unsigned char*>(key.constData()), nullptr, isEncrypt) <= 0) {
+        EVP_CIPHER_CTX_free(ctx);
+        return nullptr;
+    }
+
+    auto aesKey = new OpenSSLAesKey(ctx);
+    aesKey->isEncrypt = isEncrypt;
+    return aesKey;
+}
+
+qsizetype OpenSSLCryptoEngine::aes256gcmEncrypt(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, char* tag) {
+    auto ctx = static_cast<OpenSSLAesKey*>(key)->ctx;
+    if (iv.size() != Cryptography::Aes256GcmIvLength) {
+        return -1;
+    }
+
+    int outputLength;
+    if (EVP_EncryptInit_ex(ctx, nullptr, nullptr, nullptr, reinterpret_cast<const unsigned char*>(iv.data())) <= 0) {
+        return -1;
+    }
+    if (!associatedData.isEmpty() && EVP_EncryptUpdate(ctx, nullptr, &outputLength, reinterpret_cast<const unsigned char*>(associatedData.data()), static_cast<int>(associatedData.size())) <= 0) {
+        return -1;
+    }
+    if (EVP_EncryptUpdate(ctx, reinterpret_cast<unsigned char*>(output), &outputLength, reinterpret_cast<const unsigned char*>(input), static_cast<int>(length)) <= 0) {
+        return -1;
+    }
+
+    auto fullOutputLength = outputLength;
+    if (EVP_EncryptFinal_ex(ctx, reinterpret_cast<unsigned char*>(output + outputLength), &outputLength) <= 0) {
+        return -1;
+    }
+    fullOutputLength += outputLength;
+
+    if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, Cryptography::Aes256GcmTagLength, tag) <= 0) {
+        return -1;
+    }
+    return fullOutputLength;
+}
+
+qsizetype OpenSSLCryptoEngine::aes256gcmDecrypt(AesKey* key, const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, QByteArrayView tag) {
+    auto ctx = static_cast<OpenSSLAesKey*>(key)->ctx;
+    if (iv.size() != Cryptography::Aes256GcmIvLength || tag.size() != Cryptography::Aes256GcmTagLength) {
+        return -1;
+    }
+
+    int outputLength;
+    if (EVP_DecryptInit_ex(ctx, nullptr, nullptr, nullptr, reinterpret_cast<const unsigned char*>(iv.data())) <= 0) {
+        return -1;
+    }
+    if (!associatedData.isEmpty() && EVP_DecryptUpdate(ctx, nullptr, &outputLength, reinterpret_cast<const unsigned char*>(associatedData.data()), static_cast<int>(associatedData.size())) <= 0) {
+        return -1;
+    }
+    if (EVP_DecryptUpdate(ctx, reinterpret_cast<unsigned char*>(output), &outputLength, reinterpret_cast<const unsigned char*>(input), static_cast<int>(length)) <= 0) {
+        return -1;
+    }
+
+    // OpenSSL doesn't write to the tag, it only takes it as non-const
+    if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, static_cast<int>(tag.size()), const_cast<char*>(tag.data())) <= 0) {
+        return -1;
+    }
+
+    auto fullOutputLength = outputLength;
+    if (EVP_DecryptFinal_ex(ctx, reinterpret_cast<unsigned char*>(output + outputLength), &outputLength) <= 0) {
+        // Tag mismatch
+        return -1;
+    }
+    fullOutputLength += outputLength;
+
+    return fullOutputLength;
+}
+
+HmacKey* OpenSSLCryptoEngine::createHmacSha256Key(const QByteArray& key) {
+    EVP_MAC* mac = EVP_MAC_fetch(nullptr, "HMAC", nullptr);
+    if (!mac) {
+        return nullptr;
+    }
+
+    EVP_MAC_CTX* ctx = EVP_MAC_CTX_new(mac);
+    EVP_MAC_free(mac);
+    if (!ctx) {
+        return nullptr;
+    }
+
+    char digest[] = "SHA256";
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+        OSSL_PARAM_construct_end()};
+
+    // Initialising with the key computes the inner and outer pad states once
+    if (EVP_MAC_init(ctx, reinterpret_cast<const unsigned char*>(key.constData()), key.length(), params) <= 0) {
+        EVP_MAC_CTX_free(ctx);
+        return nullptr;
+    }
+
+    auto hmacKey = new OpenSSLHmacKey(ctx);
+    if (Avx2HmacSha256::isPreferred()) hmacKey->avx2 = new Avx2HmacSha256(key);
+    return hmacKey;
+}
+
+void OpenSSLCryptoEngine::hmacSha256Begin(HmacKey* key) {
+    // Without a key, this restarts from the precomputed pad states
+    EVP_MAC_init(static_cast<OpenSSLHmacKey*>(key)->ctx, nullptr, 0, nullptr);
+}
+
+void OpenSSLCryptoEngine::hmacSha256Update(HmacKey* key, const char* data, qsizetype length) {
+    EVP_MAC_update(static_cast<OpenSSLHmacKey*>(key)->ctx, reinterpret_cast<const unsigned char*>(data), length);
+}
+
+QByteArray OpenSSLCryptoEngine::hmacSha256Finish(HmacKey* key) {
+    QByteArray signature(32, Qt::Uninitialized);
+    size_t signatureLength;
+    if (EVP_MAC_final(static_cast<OpenSSLHmacKey*>(key)->ctx, reinterpret_cast<unsigned char*>(signature.data()), &signatureLength, signature.size()) <= 0) {
+        return {};
+    }
+
+    signature.truncate(signatureLength);
+    return signature;
+}
+
+void OpenSSLCryptoEngine::hmacSha256Batch(HmacKey* key, HmacSha256Job* jobs, qsizetype count) {
+    auto hmacKey = static_cast<OpenSSLHmacKey*>(key);
+    // A single message would leave seven of the eight lanes idle
+    if (hmacKey->avx2 == nullptr || count < 2) {
+        CryptoEngine::hmacSha256Batch(key, jobs, count);
+        return;
+    }
+    hmacKey->avx2->signBatch(jobs, count);
+}
+
+bool OpenSSLCryptoEngine::constantTimeEquals(QByteArrayView first, QByteArrayView second) {
+    return CRYPTO_memcmp(first.data(), second.data(), first.size()) == 0;
 }
 
 QByteArray OpenSSLSupport::bignumToBytes(BIGNUM* bn) {
@@ -267,3 +623,28 @@ BIGNUM* OpenSSLSupport::bytesToBignum(QByteArray ba) {
     auto bn = BN_bin2bn(reinterpret_cast<const unsigned char*>(ba.constData()), ba.length(), nullptr);
     return bn;
 }
+
+QByteArray OpenSSLSupport::hkdf(EVP_KDF* kdf, int mode, const QByteArray& salt, const QByteArray& key, const QByteArray& info, size_t length) {
+    if (kdf == nullptr) return {};
+
+    EVP_KDF_CTX* ctx = EVP_KDF_CTX_new(kdf);
+    if (!ctx) return {};
+
+    OSSL_PARAM params[6];
+    auto param = params;
+    *param++ = OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST, const_cast<char*>("SHA256"), 0);
+    *param++ = OSSL_PARAM_construct_int(OSSL_KDF_PARAM_MODE, &mode);
+    *param++ = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_KEY, const_cast<char*>(key.constData()), key.length());
+    if (!salt.isEmpty()) *param++ = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SALT, const_cast<char*>(salt.constData()), salt.length());
+    if (!info.isEmpty()) *param++ = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_INFO, const_cast<char*>(info.constData()), info.length());
+    *param = OSSL_PARAM_construct_end();
+
+    QByteArray output(length, Qt::Uninitialized);
+    if (EVP_KDF_derive(ctx, reinterpret_cast<unsigned char*>(output.data()), length, params) <= 0) {
+        EVP_KDF_CTX_free(ctx);
+        return {};
+    }
+
+    EVP_KDF_CTX_free(ctx);
+    return output;
+}
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "cryptosession.h"
+
+struct CryptoSessionPrivate {
+        CryptoSession::Cipher cipher;
+        QByteArray encryptKeyBytes;
+        QByteArray decryptKeyBytes;
+        QByteArray sendHmacKeyBytes;
+        QByteArray receiveHmacKeyBytes;
+
+        AesKey* encryptKey = nullptr;
+        AesKey* decryptKey = nullptr;
+        HmacKey* sendHmacKey = nullptr;
+        HmacKey* receiveHmacKey = nullptr;
+};
+
+CryptoSession::CryptoSession(const QByteArray& encryptKey, const QByteArray& decryptKey, const QByteArray& sendHmacKey, const QByteArray& receiveHmacKey, Cipher cipher) {
+    d = new CryptoSessionPrivate();
+    d->cipher = cipher;
+    d->encryptKeyBytes = encryptKey;
+    d->decryptKeyBytes = decryptKey;
+    d->sendHmacKeyBytes = sendHmacKey;
+    d->receiveHmacKeyBytes = receiveHmacKey;
+    if (cipher == Aes256Gcm) {
+        d->encryptKey = Cryptography::createAes256GcmKey(encryptKey, true);
+        d->decryptKey = Cryptography::createAes256GcmKey(decryptKey, false);
+        return;
+    }
+
+    d->encryptKey = Cryptography::createAes256CbcKey(encryptKey, true);
+    d->decryptKey = Cryptography::createAes256CbcKey(decryptKey, false);
+    d->sendHmacKey = Cryptography::createHmacSha256Key(sendHmacKey);
+    d->receiveHmacKey = Cryptography::createHmacSha256Key(receiveHmacKey);
+}
+
+CryptoSession::~CryptoSession() {
+    Cryptography::deleteAesKey(d->encryptKey);
+    Cryptography::deleteAesKey(d->decryptKey);
+    Cryptography::deleteHmacKey(d->sendHmacKey);
+    Cryptography::deleteHmacKey(d->receiveHmacKey);
+    delete d;
+}
+
+CryptoSession* CryptoSession::clone() {
+    return new CryptoSession(d->encryptKeyBytes, d->decryptKeyBytes, d->sendHmacKeyBytes, d->receiveHmacKeyBytes, d->cipher);
+}
+
+bool CryptoSession::isValid() {
+    if (d->cipher == Aes256Gcm) return d->encryptKey && d->decryptKey;
+    return d->encryptKey && d->decryptKey && d->sendHmacKey && d->receiveHmacKey;
+}
+
+CryptoSession::Cipher CryptoSession::cipher() {
+    return d->cipher;
+}
+
+qsizetype CryptoSession::ivLength() {
+    return d->cipher == Aes256Gcm ? Cryptography::Aes256GcmIvLength : 16;
+}
+
+qsizetype CryptoSession::encrypt(const char* input, qsizetype length, char* output, QByteArrayView iv) {
+    return Cryptography::aes256cbc(d->encryptKey, input, length, output, iv);
+}
+
+void CryptoSession::encryptBatch(Aes256CbcJob* jobs, qsizetype count) {
+    Cryptography::aes256cbcEncryptBatch(d->encryptKey, jobs, count);
+}
+
+qsizetype CryptoSession::decrypt(const char* input, qsizetype length, char* output, QByteArrayView iv) {
+    return Cryptography::aes256cbc(d->decryptKey, input, length, output, iv);
+}
+
+qsizetype CryptoSession::encrypt(const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, char* tag) {
+    return Cryptography::aes256gcmEncrypt(d->encryptKey, input, length, output, iv, associatedData, tag);
+}
+
+qsizetype CryptoSession::decrypt(const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, QByteArrayView tag) {
+    return Cryptography::aes256gcmDecrypt(d->decryptKey, input, length, output, iv, associatedData, tag);
+}
+
+QByteArray CryptoSession::sign(QByteArrayView data) {
+    return Cryptography::hmacSha256Signature(data, d->sendHmacKey);
+}
+
+void CryptoSession::signBatch(HmacSha256Job* jobs, qsizetype count) {
+    Cryptography::hmacSha256Batch(d->sendHmacKey, jobs, count);
+}
+
+bool CryptoSession::verify(QByteArrayView data, QByteArrayView signature) {
+    auto expected = Cryptography::hmacSha256Signature(data, d->receiveHmacKey);
+    return Cryptography::constantTimeEquals(expected, signature);
+}
+
+HmacKey* CryptoSession::sendHmacKey() {
+    return d->sendHmacKey;
+}
+
+HmacKey* CryptoSession::receiveHmacKey() {
+    return d->receiveHmacKey;
+}
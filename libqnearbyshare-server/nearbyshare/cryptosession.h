@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_CRYPTOSESSION_H
+#define QNEARBYSHARE_CRYPTOSESSION_H
+
+#include "cryptography.h"
+#include <QByteArray>
+
+struct CryptoSessionPrivate;
+
+// Holds the keys agreed in the UKEY2 handshake, prepared once so that encrypting, decrypting and signing each
+// frame only does the bulk work.
+//
+// Sessions use AES-256-CBC with a separate HMAC-SHA256 signature, as every Nearby Share peer does, or AES-256-GCM
+// when both ends are QNearbyShare. GCM sessions have no HMAC keys; the tag takes the place of the signature.
+class CryptoSession {
+    public:
+        enum Cipher {
+            Aes256CbcHmacSha256,
+            Aes256Gcm
+        };
+
+        CryptoSession(const QByteArray& encryptKey, const QByteArray& decryptKey, const QByteArray& sendHmacKey, const QByteArray& receiveHmacKey, Cipher cipher = Aes256CbcHmacSha256);
+        ~CryptoSession();
+
+        CryptoSession(const CryptoSession&) = delete;
+        CryptoSession& operator=(const CryptoSession&) = delete;
+
+        // Keys keep per message state, so a session must only be used by one thread at a time. Other threads
+        // each work on their own clone, which has the same keys.
+        CryptoSession* clone();
+
+        bool isValid();
+        Cipher cipher();
+        qsizetype ivLength();
+
+        // Output must have room for length + 16 bytes. Returns the number of bytes written, or -1 on failure.
+        qsizetype encrypt(const char* input, qsizetype length, char* output, QByteArrayView iv);
+        qsizetype decrypt(const char* input, qsizetype length, char* output, QByteArrayView iv);
+
+        // For GCM sessions; see Cryptography::aes256gcmEncrypt
+        qsizetype encrypt(const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, char* tag);
+        qsizetype decrypt(const char* input, qsizetype length, char* output, QByteArrayView iv, QByteArrayView associatedData, QByteArrayView tag);
+
+        // Encrypts several independent messages at once; see Cryptography::aes256cbcEncryptBatch
+        void encryptBatch(Aes256CbcJob* jobs, qsizetype count);
+
+        QByteArray sign(QByteArrayView data);
+
+        // Signs several independent messages at once; see Cryptography::hmacSha256Batch
+        void signBatch(HmacSha256Job* jobs, qsizetype count);
+        bool verify(QByteArrayView data, QByteArrayView signature);
+
+        // For callers that feed the signature incrementally
+        HmacKey* sendHmacKey();
+        HmacKey* receiveHmacKey();
+
+    private:
+        CryptoSessionPrivate* d;
+};
+
+#endif // QNEARBYSHARE_CRYPTOSESSION_H
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "eckeypool.h"
+#include "cryptography.h"
+#include <QMutex>
+#include <QMutexLocker>
+#include <QQueue>
+#include <QThreadPool>
+
+struct EcKeyPoolPrivate {
+        QMutex mutex;
+        QQueue<EcKey*> keys;
+        int size = EcKeyPool::DefaultSize;
+        bool refilling = false;
+};
+
+EcKeyPool* EcKeyPool::instance() {
+    // Intentionally never destroyed so that a refill still running at exit never touches a dead pool
+    static auto pool = new EcKeyPool();
+    return pool;
+}
+
+EcKeyPool::EcKeyPool() {
+    d = new EcKeyPoolPrivate();
+
+    bool ok;
+    auto size = qEnvironmentVariableIntValue("QNEARBYSHARE_KEY_POOL_SIZE", &ok);
+    if (ok && size >= 0) d->size = size;
+}
+
+EcKeyPool::~EcKeyPool() {
+    for (auto key : d->keys) {
+        Cryptography::deleteEcdsaKeyPair(key);
+    }
+    delete d;
+}
+
+EcKey* EcKeyPool::takeKey() {
+    EcKey* key = nullptr;
+    {
+        QMutexLocker locker(&d->mutex);
+        if (!d->keys.isEmpty()) key = d->keys.dequeue();
+    }
+    scheduleRefill();
+
+    // The pool ran dry; don't make the peer wait for the refill
+    if (key == nullptr) key = Cryptography::generateEcdsaKeyPair();
+    return key;
+}
+
+void EcKeyPool::setSize(int size) {
+    QList<EcKey*> excess;
+    {
+        QMutexLocker locker(&d->mutex);
+        d->size = qMax(size, 0);
+        while (d->keys.size() > d->size) excess.append(d->keys.dequeue());
+    }
+    for (auto key : excess) {
+        Cryptography::deleteEcdsaKeyPair(key);
+    }
+    scheduleRefill();
+}
+
+int EcKeyPool::size() {
+    QMutexLocker locker(&d->mutex);
+    return d->size;
+}
+
+int EcKeyPool::available() {
+    QMutexLocker locker(&d->mutex);
+    return d->keys.size();
+}
+
+void EcKeyPool::prefill() {
+    scheduleRefill();
+}
+
+void EcKeyPool::scheduleRefill() {
+    {
+        QMutexLocker locker(&d->mutex);
+        if (d->refilling || d->keys.size() >= d->size) return;
+        d->refilling = true;
+    }
+
+    QThreadPool::globalInstance()->start([this] {
+        refill();
+    });
+}
+
+void EcKeyPool::refill() {
+    forever {
+        {
+            QMutexLocker locker(&d->mutex);
+            if (d->keys.size() >= d->size) {
+                d->refilling = false;
+                return;
+            }
+        }
+
+        // Generate without holding the lock so takeKey() never blocks on key generation
+        auto key = Cryptography::generateEcdsaKeyPair();
+
+        QMutexLocker locker(&d->mutex);
+        d->keys.enqueue(key);
+    }
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_ECKEYPOOL_H
+#define QNEARBYSHARE_ECKEYPOOL_H
+
+#include <QtGlobal>
+
+struct EcKey;
+struct EcKeyPoolPrivate;
+
+// Keeps a number of freshly generated single use P-256 key pairs ready for the UKEY2 handshake.
+//
+// Every key handed out by takeKey() is removed from the pool, so no key is ever used for more than one connection.
+// Whenever the pool drops below its target size it is topped up on QThreadPool::globalInstance(), keeping key
+// generation off the event loop. If the pool runs dry (for example during a burst of incoming connections) a key
+// is generated inline instead, so callers never wait for the refill.
+//
+// The target size defaults to DefaultSize and can be overridden with the QNEARBYSHARE_KEY_POOL_SIZE environment
+// variable or setSize(). A size of 0 disables the pool.
+class EcKeyPool {
+    public:
+        static EcKeyPool* instance();
+
+        EcKeyPool(const EcKeyPool&) = delete;
+        EcKeyPool& operator=(const EcKeyPool&) = delete;
+
+        static constexpr int DefaultSize = 4;
+
+        // Ownership of the returned key passes to the caller, which frees it with Cryptography::deleteEcdsaKeyPair
+        EcKey* takeKey();
+
+        void setSize(int size);
+        int size();
+        int available();
+
+        // Starts filling the pool ahead of the first connection
+        void prefill();
+
+    private:
+        EcKeyPool();
+        ~EcKeyPool();
+
+        EcKeyPoolPrivate* d;
+
+        void scheduleRefill();
+        void refill();
+};
+
+#endif // QNEARBYSHARE_ECKEYPOOL_H
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "filereadahead.h"
+#include "bufferpool.h"
+#include "spscqueue.h"
+#include <QFileDevice>
+#include <QList>
+#include <QThread>
+#include <QThreadPool>
+#include <atomic>
+
+#ifdef Q_OS_LINUX
+    #include <fcntl.h>
+#endif
+
+namespace {
+    // Buffers kept for reuse on top of the ones in the queue, for chunks the socket is still holding on to
+    constexpr int SpareBuffers = 4;
+
+    QThreadPool* ioThreadPool() {
+        static QThreadPool* pool = [] {
+            auto pool = new QThreadPool();
+            pool->setMaxThreadCount(FileReadAhead::MaxIoThreads);
+            return pool;
+        }();
+        return pool;
+    }
+} // namespace
+
+struct FileReadAheadPrivate {
+        FileReadAheadPrivate(int depth) :
+            depth(depth), chunks(depth) {
+        }
+
+        QIODevice* device;
+        quint64 size;
+        int depth;
+        std::function<void()> dataReady;
+
+        SpscQueue<QByteArray> chunks;
+        std::atomic<int> queued = 0;
+        std::atomic<qint64> chunkSize;
+        std::atomic<bool> running = false;
+        std::atomic<bool> notified = false;
+        std::atomic<bool> stopping = false;
+        std::atomic<int> activeTasks = 0;
+
+        // Only used on the I/O thread
+        quint64 readPosition = 0;
+        bool failed = false;
+        QList<QByteArray> buffers;
+
+        // Only used on the consumer's thread
+        quint64 taken = 0;
+
+        bool wantsToRead() {
+            return queued < depth && !failed && readPosition < size && !stopping;
+        }
+
+        QByteArray* freeBuffer(qint64 length) {
+            // A buffer nothing else refers to can be written to without being copied
+            for (auto& buffer : buffers) {
+                if (buffer.isDetached()) return &buffer;
+            }
+            if (buffers.size() == depth + SpareBuffers) return nullptr;
+            buffers.append(BufferPool::instance()->take(length));
+            return &buffers.last();
+        }
+};
+
+FileReadAhead::FileReadAhead(QIODevice* device, quint64 size, qint64 chunkSize, std::function<void()> dataReady, int depth) {
+    d = new FileReadAheadPrivate(qMax(1, depth));
+    d->device = device;
+    d->size = size;
+    d->chunkSize = chunkSize;
+    d->dataReady = std::move(dataReady);
+
+#ifdef Q_OS_LINUX
+    // Let the kernel read further ahead of us
+    auto file = qobject_cast<QFileDevice*>(device);
+    if (file && file->handle() != -1) posix_fadvise(file->handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    start();
+}
+
+FileReadAhead::~FileReadAhead() {
+    // A read that has already started still has to finish
+    d->stopping = true;
+    while (d->activeTasks > 0) QThread::yieldCurrentThread();
+    for (auto& buffer : d->buffers) {
+        BufferPool::instance()->recycle(std::move(buffer));
+    }
+    delete d;
+}
+
+void FileReadAhead::setChunkSize(qint64 chunkSize) {
+    d->chunkSize = chunkSize;
+}
+
+bool FileReadAhead::take(QByteArray* chunk) {
+    // Anything read from here on needs a new notification
+    d->notified = false;
+
+    if (!d->chunks.pop(chunk)) return false;
+    d->queued--;
+    d->taken += chunk->size();
+
+    // There is room in the queue again
+    start();
+    return true;
+}
+
+bool FileReadAhead::isReady() {
+    return !d->chunks.isEmpty();
+}
+
+bool FileReadAhead::atEnd() {
+    return d->taken == d->size;
+}
+
+void FileReadAhead::start() {
+    if (d->stopping || d->running.exchange(true)) return;
+    d->activeTasks++;
+    ioThreadPool()->start([this] {
+        run();
+    });
+}
+
+void FileReadAhead::run() {
+    do {
+        while (d->wantsToRead()) {
+            auto length = static_cast<qint64>(qMin<quint64>(d->chunkSize, d->size - d->readPosition));
+
+            QByteArray standalone;
+            auto buffer = d->freeBuffer(length);
+            if (!buffer) buffer = &standalone;
+            buffer->resize(length);
+
+            QByteArray chunk;
+            auto read = d->device->read(buffer->data(), length);
+            if (read > 0) {
+                buffer->resize(read);
+                d->readPosition += read;
+                chunk = *buffer;
+            } else {
+                // The file is shorter than it said it was, or couldn't be read at all
+                d->failed = true;
+            }
+
+            d->queued++;
+            auto pushed = d->chunks.push(std::move(chunk));
+            Q_ASSERT(pushed);
+            if (!d->notified.exchange(true) && !d->stopping) d->dataReady();
+        }
+        d->running = false;
+
+        // A chunk taken after the last check but before running was cleared didn't start the reader again
+    } while (d->wantsToRead() && !d->running.exchange(true));
+
+    // Nothing may touch the reader after this
+    d->activeTasks--;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_FILEREADAHEAD_H
+#define QNEARBYSHARE_FILEREADAHEAD_H
+
+#include <QByteArray>
+#include <functional>
+
+class QIODevice;
+struct FileReadAheadPrivate;
+
+// Reads an outgoing file ahead of the network on an I/O thread, so the thread that owns the socket never blocks on
+// the disk.
+//
+// Up to depth chunks are read ahead into a lock free single producer, single consumer queue and taken out with
+// take() as the socket has room for them. Once the queue is full the I/O thread stops until a chunk is taken. Chunk
+// buffers come from the BufferPool and are reused once nothing else refers to them any more, so a steady transfer
+// doesn't allocate a new buffer for every chunk. Files are read on their own small thread pool, separate from the encryption lanes on
+// QThreadPool::globalInstance(), so a slow disk can't hold up encryption for other transfers.
+//
+// The device belongs to the I/O thread until the FileReadAhead is deleted and mustn't be touched in the meantime.
+class FileReadAhead {
+    public:
+        // dataReady is called from the I/O thread when a chunk is waiting. It isn't called again until take() has been
+        // called, so it can simply post an event to the consumer's thread.
+        FileReadAhead(QIODevice* device, quint64 size, qint64 chunkSize, std::function<void()> dataReady, int depth = DefaultDepth);
+        ~FileReadAhead();
+
+        FileReadAhead(const FileReadAhead&) = delete;
+        FileReadAhead& operator=(const FileReadAhead&) = delete;
+
+        static constexpr int DefaultDepth = 2;
+        static constexpr int MaxIoThreads = 4;
+
+        // Takes effect from the next chunk read
+        void setChunkSize(qint64 chunkSize);
+
+        // Moves the next chunk read to chunk. Returns false if nothing is ready yet. An empty chunk means the
+        // file could not be read.
+        bool take(QByteArray* chunk);
+
+        bool isReady();
+        bool atEnd();
+
+    private:
+        FileReadAheadPrivate* d;
+
+        void start();
+        void run();
+};
+
+#endif // QNEARBYSHARE_FILEREADAHEAD_H
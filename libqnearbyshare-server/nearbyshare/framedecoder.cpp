@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "framedecoder.h"
+#include <QtEndian>
+#include <cstring>
+
+struct FrameDecoderPrivate {
+        QByteArray buffer;
+
+        // Unconsumed data lives in [readPos, writePos)
+        qsizetype readPos = 0;
+        qsizetype writePos = 0;
+        bool oversizedFrame = false;
+
+        qsizetype used() const {
+            return writePos - readPos;
+        }
+
+        qsizetype pendingFrameLength() const {
+            // Total length (including the length prefix) of the frame at readPos, or 0 if not yet known
+            if (used() < 4) return 0;
+            return static_cast<qsizetype>(qFromBigEndian<quint32>(buffer.constData() + readPos)) + 4;
+        }
+};
+
+FrameDecoder::FrameDecoder(qsizetype initialCapacity) {
+    d = new FrameDecoderPrivate();
+    d->buffer = QByteArray(initialCapacity, Qt::Uninitialized);
+}
+
+FrameDecoder::~FrameDecoder() {
+    delete d;
+}
+
+char* FrameDecoder::prepareWrite(qsizetype length) {
+    if (d->buffer.size() - d->writePos < length) {
+        // Only make room for what is actually being written, whatever the frame's length prefix says
+        auto required = d->used() + length;
+        if (d->buffer.size() < required) {
+            // Grow the buffer, moving the leftover data to the start at the same time
+            QByteArray newBuffer(qMax(d->buffer.size() * 2, required), Qt::Uninitialized);
+            std::memcpy(newBuffer.data(), d->buffer.constData() + d->readPos, d->used());
+            d->buffer = newBuffer;
+        } else if (d->readPos != 0) {
+            // Wrap around: move the partial frame back to the start of the buffer
+            std::memmove(d->buffer.data(), d->buffer.constData() + d->readPos, d->used());
+        }
+        d->writePos = d->used();
+        d->readPos = 0;
+    }
+
+    return d->buffer.data() + d->writePos;
+}
+
+void FrameDecoder::commitWrite(qsizetype length) {
+    d->writePos += length;
+}
+
+void FrameDecoder::append(QByteArrayView data) {
+    std::memcpy(prepareWrite(data.size()), data.data(), data.size());
+    commitWrite(data.size());
+}
+
+bool FrameDecoder::nextFrame(QByteArrayView* frame) {
+    if (d->oversizedFrame) return false;
+
+    auto frameLength = d->pendingFrameLength();
+    if (frameLength - 4 > MaxFrameLength) {
+        d->oversizedFrame = true;
+        return false;
+    }
+    if (frameLength == 0 || d->used() < frameLength) {
+        if (d->used() == 0) {
+            // Nothing left over so the next write can start from the beginning again
+            d->readPos = 0;
+            d->writePos = 0;
+        }
+        return false;
+    }
+
+    *frame = QByteArrayView(d->buffer.constData() + d->readPos + 4, frameLength - 4);
+    d->readPos += frameLength;
+    return true;
+}
+
+bool FrameDecoder::hasOversizedFrame() {
+    return d->oversizedFrame;
+}
+
+qsizetype FrameDecoder::bufferedBytes() {
+    return d->used();
+}
+
+qsizetype FrameDecoder::capacity() {
+    return d->buffer.size();
+}
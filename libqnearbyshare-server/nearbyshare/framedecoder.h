@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_FRAMEDECODER_H
+#define QNEARBYSHARE_FRAMEDECODER_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+
+struct FrameDecoderPrivate;
+
+// Splits a stream of length prefixed frames (4 byte big endian length followed by the frame) without copying.
+//
+// Data is read straight into the decoder's buffer using prepareWrite() and commitWrite(), and each complete
+// frame is handed out as a view into that buffer. When the write position reaches the end of the buffer,
+// the trailing partial frame (if any) is moved back to the start of the buffer, which is usually only a
+// few bytes. Views returned by nextFrame() stay valid until the next call to prepareWrite() or append().
+//
+// The buffer only ever grows to hold bytes that have actually arrived, never to the length a frame claims to have,
+// since that comes from the peer before anything is authenticated. A frame longer than MaxFrameLength stops the
+// decoder for good, and the connection should be closed.
+class FrameDecoder {
+    public:
+        explicit FrameDecoder(qsizetype initialCapacity = 1024 * 1024);
+        ~FrameDecoder();
+
+        FrameDecoder(const FrameDecoder&) = delete;
+        FrameDecoder& operator=(const FrameDecoder&) = delete;
+
+        // Well above the largest payload chunk either end sends, plus its headers
+        static constexpr qsizetype MaxFrameLength = 8 * 1024 * 1024;
+
+        char* prepareWrite(qsizetype length);
+        void commitWrite(qsizetype length);
+        void append(QByteArrayView data);
+
+        bool nextFrame(QByteArrayView* frame);
+        bool hasOversizedFrame();
+
+        qsizetype bufferedBytes();
+        qsizetype capacity();
+
+    private:
+        FrameDecoderPrivate* d;
+};
+
+#endif // QNEARBYSHARE_FRAMEDECODER_H
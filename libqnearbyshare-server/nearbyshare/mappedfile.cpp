@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "mappedfile.h"
+#include <QFileDevice>
+#include <QQueue>
+#include <atomic>
+#include <cstring>
+
+#ifdef Q_OS_UNIX
+    #include <csetjmp>
+    #include <csignal>
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
+namespace {
+#ifdef Q_OS_UNIX
+    // Set while this thread copies out of a mapping, so the handler can jump back out of a copy that faulted
+    thread_local sigjmp_buf* copyRecovery = nullptr;
+    struct sigaction previousBusAction;
+
+    void handleBusError(int signalNumber, siginfo_t* info, void* context) {
+        if (copyRecovery) siglongjmp(*copyRecovery, 1);
+
+        // Not a copy out of a mapping, so this is for whoever handled SIGBUS before
+        if (previousBusAction.sa_flags & SA_SIGINFO) {
+            previousBusAction.sa_sigaction(signalNumber, info, context);
+        } else if (previousBusAction.sa_handler != SIG_DFL && previousBusAction.sa_handler != SIG_IGN) {
+            previousBusAction.sa_handler(signalNumber);
+        } else {
+            // Returning runs the faulting instruction again, which then gets the default action
+            struct sigaction defaultAction = {};
+            defaultAction.sa_handler = SIG_DFL;
+            sigaction(SIGBUS, &defaultAction, nullptr);
+        }
+    }
+
+    // Installs the handler the first time it is called
+    bool handlingBusErrors() {
+        static const auto installed = [] {
+            struct sigaction action = {};
+            action.sa_sigaction = handleBusError;
+            action.sa_flags = SA_SIGINFO;
+            sigemptyset(&action.sa_mask);
+            return sigaction(SIGBUS, &action, &previousBusAction) == 0;
+        }();
+        return installed;
+    }
+#endif
+} // namespace
+
+struct MappedFilePrivate {
+        QFileDevice* file;
+        quint64 size;
+
+        // Where in the file the mapping starts
+        qint64 base = 0;
+
+        struct Window {
+                quint64 start;
+                quint64 length;
+                uchar* data;
+        };
+
+        // Mapped windows in file order. Chunks are taken from the last one.
+        QQueue<Window> windows;
+        quint64 mappedEnd = 0;
+        quint64 position = 0;
+};
+
+MappedFile::MappedFile(QFileDevice* file, quint64 size) {
+    d = new MappedFilePrivate();
+    d->file = file;
+    d->size = size;
+    d->base = file->pos();
+}
+
+MappedFile::~MappedFile() {
+    for (const auto& window : d->windows) {
+        d->file->unmap(window.data);
+    }
+    delete d;
+}
+
+MappedFile* MappedFile::map(QIODevice* device, quint64 size) {
+    auto file = qobject_cast<QFileDevice*>(device);
+    if (!file || file->isSequential() || size == 0) return nullptr;
+    if (static_cast<quint64>(file->size() - file->pos()) < size) return nullptr;
+
+#ifdef Q_OS_UNIX
+    // Without the handler a file truncated under the mapping would take the whole process down
+    if (!handlingBusErrors()) return nullptr;
+#endif
+
+    auto mappedFile = new MappedFile(file, size);
+    if (!mappedFile->mapNextWindow()) {
+        delete mappedFile;
+        return nullptr;
+    }
+    return mappedFile;
+}
+
+QByteArray MappedFile::take(qint64 length) {
+    if (d->position == d->size) return {};
+    if (d->position == d->mappedEnd && !mapNextWindow()) return {};
+
+    const auto& window = d->windows.last();
+    length = static_cast<qint64>(qMin<quint64>(length, window.start + window.length - d->position));
+    auto chunk = QByteArray::fromRawData(reinterpret_cast<const char*>(window.data + (d->position - window.start)), length);
+    d->position += length;
+    return chunk;
+}
+
+void MappedFile::release(quint64 offset) {
+    while (!d->windows.isEmpty() && d->windows.head().start + d->windows.head().length <= offset) {
+        d->file->unmap(d->windows.dequeue().data);
+    }
+}
+
+bool MappedFile::atEnd() {
+    return d->position == d->size;
+}
+
+bool MappedFile::copy(char* destination, QByteArrayView chunk) {
+    if (chunk.isEmpty()) return true;
+
+#ifdef Q_OS_UNIX
+    if (!handlingBusErrors()) return false;
+
+    // Nothing in here takes a lock or allocates, so jumping out of the middle of it leaves nothing behind
+    sigjmp_buf recovery;
+    if (sigsetjmp(recovery, 1) != 0) {
+        copyRecovery = nullptr;
+        return false;
+    }
+    copyRecovery = &recovery;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    std::memcpy(destination, chunk.data(), chunk.size());
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    copyRecovery = nullptr;
+#else
+    std::memcpy(destination, chunk.data(), chunk.size());
+#endif
+    return true;
+}
+
+bool MappedFile::mapNextWindow() {
+    auto start = d->mappedEnd;
+    auto length = qMin<quint64>(WindowSize, d->size - start);
+    auto data = d->file->map(d->base + start, length);
+    if (!data) return false;
+
+#ifdef Q_OS_UNIX
+    // The window is read front to back once, so the kernel can read further ahead and drop pages sooner. madvise()
+    // wants a page aligned address, which map() only returns when the offset is page aligned.
+    auto pageSize = static_cast<quintptr>(sysconf(_SC_PAGESIZE));
+    auto alignedStart = reinterpret_cast<quintptr>(data) & ~(pageSize - 1);
+    madvise(reinterpret_cast<void*>(alignedStart), length + (reinterpret_cast<quintptr>(data) - alignedStart), MADV_SEQUENTIAL);
+#endif
+
+    d->windows.enqueue({start, length, data});
+    d->mappedEnd = start + length;
+    return true;
+}
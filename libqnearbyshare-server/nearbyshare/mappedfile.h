@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_MAPPEDFILE_H
+#define QNEARBYSHARE_MAPPEDFILE_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+
+class QIODevice;
+class QFileDevice;
+struct MappedFilePrivate;
+
+// Hands out an outgoing file as chunks that point straight into a memory mapping of it, so sending a regular file
+// takes no read() calls and no copies before it is encrypted.
+//
+// The file is mapped WindowSize bytes at a time, so very large files don't need as much address space. Chunks never
+// cross a window boundary. Because the chunks don't own their data, a window is only unmapped once release() has
+// been called with an offset past its end; the socket is done with a chunk once its bytes have been written, since
+// frames are only written after they have been encrypted.
+//
+// Another process can truncate the file at any point, and touching a page of the mapping past the new end raises
+// SIGBUS. Chunks are only ever read through copy(), which turns that into a failed copy, so the transfer fails rather
+// than the process. (Windows doesn't let a mapped file be truncated at all.)
+class MappedFile {
+    public:
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        static constexpr qint64 WindowSize = 64 * 1024 * 1024;
+
+        // Returns nullptr if the device can't be mapped, such as a pipe or a socket, in which case it should be read as
+        // usual. The file is mapped from the device's current position.
+        static MappedFile* map(QIODevice* device, quint64 size);
+
+        // The next chunk, at most length bytes long. Returns an empty chunk if the next window could not be mapped.
+        QByteArray take(qint64 length);
+
+        // Chunks before offset are no longer in use
+        void release(quint64 offset);
+
+        // Copies a chunk out, returning false instead of crashing if the file under it was truncated after it was
+        // mapped. Chunks that don't come from a mapping are copied as usual. Safe to call from any thread.
+        static bool copy(char* destination, QByteArrayView chunk);
+
+        bool atEnd();
+
+    private:
+        MappedFile(QFileDevice* file, quint64 size);
+        MappedFilePrivate* d;
+
+        bool mapNextWindow();
+};
+
+#endif // QNEARBYSHARE_MAPPEDFILE_H
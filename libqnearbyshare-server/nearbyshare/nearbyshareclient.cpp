@@ -22,35 +22,98 @@
 
 #include "nearbyshareclient.h"
 
+#include "chunksizer.h"
 #include "cryptography.h"
+#include "filereadahead.h"
+#include "mappedfile.h"
 #include "nearbysocket.h"
 #include "wire_format.pb.h"
 
 #include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
 #include <QMimeDatabase>
 #include <QRandomGenerator64>
 #include <QStandardPaths>
 #include <QTcpSocket>
 #include <QTextStream>
 #include <QTimer>
+#include <algorithm>
 #include <utility>
 
+#ifdef Q_OS_LINUX
+    #include <cerrno>
+    #include <fcntl.h>
+#endif
+
+namespace {
+    // Returns false only if the file won't fit
+    bool reserveSpace(QFile* file, quint64 size) {
+#ifdef Q_OS_LINUX
+        // Allocating the whole file up front keeps its extents together and saves growing it on every write. The size
+        // is left alone so a transfer that fails part way doesn't leave a file that looks complete.
+        if (size > 0) {
+            int result;
+            do {
+                result = fallocate(file->handle(), FALLOC_FL_KEEP_SIZE, 0, static_cast<off_t>(size));
+            } while (result != 0 && errno == EINTR);
+
+            // Anything else, such as a filesystem that can't preallocate, just means the file fills up as the data
+            // arrives like it used to
+            if (result != 0 && (errno == ENOSPC || errno == EDQUOT || errno == EFBIG)) return false;
+        }
+
+        // The data arrives in order, once
+        posix_fadvise(file->handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        return true;
+    }
+
+    // Files are only read while less than SendWindow bytes (or two chunks, if that is more) are waiting to go out,
+    // so memory use stays the same however many files are sent
+    constexpr qint64 SendWindow = 8 * 1024 * 1024;
+
+    // How many files round robin reads ahead and takes turns between at once
+    constexpr int MaxFilesReading = 4;
+} // namespace
+
 struct NearbyShareClientPrivate {
         NearbySocket* socket = nullptr;
         QList<NearbyShareClient::TransferredFile> files;
 
         QMap<qint64, AbstractNearbyPayloadPtr> filePayloads;
+
+        // Files being received, by payload ID. Space is set aside for the whole of each one when the transfer is
+        // accepted, so it has to be given back if the transfer stops early.
+        QMap<qint64, QFile*> outputFiles;
         NearbyShareClient::State state = NearbyShareClient::State::NotReady;
         NearbyShareClient::FailedReason failedReason = NearbyShareClient::FailedReason::Unknown;
 
         struct LocalFileStats {
+                // Bytes the kernel has taken, and bytes read from the file and handed to the socket
                 quint64 progress = 0;
                 qint64 payloadId = 0;
+                quint64 read = 0;
+
+                // Regular files are mapped until every byte has been written, anything else is only read ahead
+                // while it is being read
+                MappedFile* mapping = nullptr;
+                FileReadAhead* readAhead = nullptr;
         };
 
         bool isServer = false;
         QList<NearbyShareClient::LocalFile> filesToSend;
         QList<LocalFileStats> filesToSendStats;
+
+        // Indices into filesToSend in the order they are sent, and the position in sendOrder to carry on from
+        NearbyShareClient::TransferOrder transferOrder = NearbyShareClient::TransferOrder::RoundRobin;
+        QList<int> sendOrder;
+        int nextFileToSend = 0;
+
+        // How much to read at a time, from how long it takes to go out. The sizer sees every chunk of file data as
+        // it is read and every byte of it as it is written.
+        ChunkSizer chunkSizer;
+        QElapsedTimer sendTimer;
 };
 
 NearbyShareClient::NearbyShareClient(QObject* parent) :
@@ -59,6 +122,13 @@ NearbyShareClient::NearbyShareClient(QObject* parent) :
 }
 
 NearbyShareClient::~NearbyShareClient() {
+    // Stop the socket first, since chunks waiting to be encrypted may point into the mappings
+    delete d->socket;
+    releaseReservedSpace();
+    for (const auto& stat : d->filesToSendStats) {
+        delete stat.mapping;
+        delete stat.readAhead;
+    }
     delete d;
 }
 
@@ -133,6 +203,15 @@ void NearbyShareClient::messageReceived(const AbstractNearbyPayloadPtr& payload)
                             // Start sending files!
                             setState(State::Transferring);
 
+                            d->chunkSizer = ChunkSizer(d->socket->isQNearbySharePeer() ? ChunkSizer::MaximumChunkSize : ChunkSizer::AndroidMaximumChunkSize);
+                            d->sendTimer.start();
+
+                            // Empty files have nothing to read, so their payloads are finished straight away
+                            for (auto i = 0; i < d->filesToSend.length(); i++) {
+                                if (d->filesToSend.at(i).size != 0) continue;
+                                d->socket->sendPayloadPacket({}, d->filesToSendStats.at(i).payloadId, NearbySocket::File, 0, true, 0);
+                            }
+
                             connect(d->socket, &NearbySocket::readyForNextPacket, this, &NearbyShareClient::writeNextSendPackets);
                             this->writeNextSendPackets();
                         } else {
@@ -234,13 +313,31 @@ QString NearbyShareClient::pinCodeFromAuthString(const QByteArray& authString) {
 }
 
 void NearbyShareClient::acceptTransfer() {
-    // Create all the files to transfer
+    // Create all the files to transfer, setting their space aside first so that running out is caught before any
+    // data moves
+    QList<QFile*> outputFiles;
     for (const auto& tf : d->files) {
         auto outputFile = new QFile(tf.destination);
         outputFile->open(QFile::WriteOnly);
+        outputFiles.append(outputFile);
+        if (outputFile->isOpen() && !reserveSpace(outputFile, tf.size)) {
+            QTextStream(stderr) << "Not enough space to receive " << tf.fileName << "\n";
+            for (auto file : outputFiles) {
+                if (file->isOpen()) file->remove();
+                delete file;
+            }
 
+            sendConnectionResponse(sharing::nearby::ConnectionResponseFrame_Status_NOT_ENOUGH_SPACE);
+            d->failedReason = FailedReason::OutOfSpace;
+            setState(State::Failed);
+            return;
+        }
+    }
+
+    for (auto i = 0; i < d->files.length(); i++) {
+        const auto& tf = d->files.at(i);
         auto payload = AbstractNearbyPayloadPtr(new AbstractNearbyPayload(tf.id, false));
-        payload->setOutput(outputFile);
+        payload->setOutput(outputFiles.at(i));
         connect(payload.data(), &AbstractNearbyPayload::transferredChanged, this, &NearbyShareClient::filesToTransferChanged);
         connect(payload.data(), &AbstractNearbyPayload::complete, this, [this] {
             emit filesToTransferChanged();
@@ -248,29 +345,26 @@ void NearbyShareClient::acceptTransfer() {
         });
 
         d->filePayloads.insert(tf.id, payload);
+        d->outputFiles.insert(tf.id, outputFiles.at(i));
         d->socket->insertPendingPayload(tf.id, payload);
     }
 
-    auto rsp = new sharing::nearby::ConnectionResponseFrame();
-    rsp->set_status(sharing::nearby::ConnectionResponseFrame_Status_ACCEPT);
-
-    auto v1 = new sharing::nearby::V1Frame();
-    v1->set_type(sharing::nearby::V1Frame_FrameType_RESPONSE);
-    v1->set_allocated_connection_response(rsp);
-
-    sharing::nearby::Frame nearbyFrame;
-    nearbyFrame.set_version(sharing::nearby::Frame_Version_V1);
-    nearbyFrame.set_allocated_v1(v1);
-
     QTextStream(stdout) << "Accepting transfer from remote device\n";
-    d->socket->sendPayloadPacket(nearbyFrame);
+    sendConnectionResponse(sharing::nearby::ConnectionResponseFrame_Status_ACCEPT);
 
     setState(State::Transferring);
 }
 
 void NearbyShareClient::rejectTransfer() {
+    QTextStream(stdout) << "Rejecting transfer from remote device\n";
+    sendConnectionResponse(sharing::nearby::ConnectionResponseFrame_Status_REJECT);
+
+    setState(State::Failed);
+}
+
+void NearbyShareClient::sendConnectionResponse(int status) {
     auto rsp = new sharing::nearby::ConnectionResponseFrame();
-    rsp->set_status(sharing::nearby::ConnectionResponseFrame_Status_REJECT);
+    rsp->set_status(static_cast<sharing::nearby::ConnectionResponseFrame_Status>(status));
 
     auto v1 = new sharing::nearby::V1Frame();
     v1->set_type(sharing::nearby::V1Frame_FrameType_RESPONSE);
@@ -280,10 +374,7 @@ void NearbyShareClient::rejectTransfer() {
     nearbyFrame.set_version(sharing::nearby::Frame_Version_V1);
     nearbyFrame.set_allocated_v1(v1);
 
-    QTextStream(stdout) << "Rejecting transfer from remote device\n";
     d->socket->sendPayloadPacket(nearbyFrame);
-
-    setState(State::Failed);
 }
 
 QList<NearbyShareClient::TransferredFile> NearbyShareClient::filesToTransfer() {
@@ -328,6 +419,7 @@ NearbyShareClient::State NearbyShareClient::state() {
 void NearbyShareClient::setState(NearbyShareClient::State state, bool dontDisconnect) {
     // TODO: Disconnect on failure
     d->state = state;
+    if (state == State::Failed) releaseReservedSpace();
     emit stateChanged(state);
 
     if ((state == State::Complete || state == State::Failed) && !dontDisconnect) {
@@ -335,13 +427,31 @@ void NearbyShareClient::setState(NearbyShareClient::State state, bool dontDiscon
     }
 }
 
+void NearbyShareClient::releaseReservedSpace() {
+    // Cut files that won't be finished back to what has actually arrived, which frees the blocks reserved past it
+    for (auto id : d->outputFiles.keys()) {
+        auto file = d->outputFiles.value(id);
+        auto payload = d->filePayloads.value(id);
+        if (payload->completed() || !file->isOpen()) continue;
+        file->resize(static_cast<qint64>(payload->bytesTransferred()));
+    }
+    d->outputFiles.clear();
+}
+
 void NearbyShareClient::checkIfComplete() {
     if (d->state != State::Transferring) return;
     for (const auto& file : this->filesToTransfer()) {
         if (!file.complete) return;
     }
 
-    setState(State::Complete);
+    if (d->isServer) {
+        setState(State::Complete);
+    } else {
+        emit filesToTransferChanged();
+
+        // Don't send the disconnect frame now because this causes Android to think that the file was not sent correctly for some reason
+        setState(State::Complete, true);
+    }
 }
 
 NearbyShareClient* NearbyShareClient::clientForReceive(QIODevice* device) {
@@ -361,7 +471,7 @@ NearbyShareClient* NearbyShareClient::clientForReceive(QIODevice* device) {
     return client;
 }
 
-NearbyShareClient* NearbyShareClient::clientForSend(QIODevice* device, QString peerName, QList<LocalFile> files) {
+NearbyShareClient* NearbyShareClient::clientForSend(QIODevice* device, QString peerName, QList<LocalFile> files, TransferOrder transferOrder) {
     auto client = new NearbyShareClient();
     client->d->isServer = false;
 
@@ -371,11 +481,29 @@ NearbyShareClient* NearbyShareClient::clientForSend(QIODevice* device, QString p
     }
     client->d->filesToSend = std::move(files);
 
+    client->d->transferOrder = transferOrder;
+    for (auto i = 0; i < client->d->filesToSend.length(); i++) {
+        client->d->sendOrder.append(i);
+    }
+
+    // Stable sorts, so files that tie keep the order they were given in
+    const auto& filesToSend = client->d->filesToSend;
+    if (transferOrder == TransferOrder::SmallestFirst) {
+        std::stable_sort(client->d->sendOrder.begin(), client->d->sendOrder.end(), [&filesToSend](int first, int second) {
+            return filesToSend.at(first).size < filesToSend.at(second).size;
+        });
+    } else if (transferOrder == TransferOrder::Priority) {
+        std::stable_sort(client->d->sendOrder.begin(), client->d->sendOrder.end(), [&filesToSend](int first, int second) {
+            return filesToSend.at(first).priority > filesToSend.at(second).priority;
+        });
+    }
+
     client->d->socket = new NearbySocket(device, false, client);
     client->d->socket->setPeerName(std::move(peerName));
 
     connect(client->d->socket, &NearbySocket::readyForEncryptedMessages, client, &NearbyShareClient::readyForEncryptedMessages);
     connect(client->d->socket, &NearbySocket::messageReceived, client, &NearbyShareClient::messageReceived);
+    connect(client->d->socket, &NearbySocket::payloadBytesWritten, client, &NearbyShareClient::payloadBytesWritten);
     connect(client->d->socket, &NearbySocket::disconnected, client, [client] {
         if (client->d->state != State::Complete && client->d->state != State::Failed) {
             client->setState(State::Failed);
@@ -414,25 +542,112 @@ bool NearbyShareClient::isSending() {
 
 void NearbyShareClient::writeNextSendPackets() {
     if (d->state != State::Transferring || d->isServer) return;
-    bool complete = true;
-    for (auto i = 0; i < d->filesToSend.length(); i++) {
+
+    while (d->socket->payloadBytesInFlight() < qMax(SendWindow, 2 * d->chunkSizer.chunkSize())) {
+        auto i = nextFileToSend();
+        if (i == -1) break;
+
         auto file = d->filesToSend.at(i);
         auto stat = d->filesToSendStats.at(i);
-        if (stat.progress == file.size) continue;
+        QByteArray buf;
+        if (stat.mapping) {
+            buf = stat.mapping->take(d->chunkSizer.chunkSize());
+        } else {
+            stat.readAhead->take(&buf);
+        }
+        if (buf.isEmpty()) {
+            QTextStream(stderr) << "Could not read " << file.fileName << "\n";
+            setState(State::Failed);
+            return;
+        }
 
-        // auto buf = file.device->read(1048576);
-        auto buf = file.device->read(512 * 1024);
-        d->socket->sendPayloadPacket(buf, stat.payloadId, NearbySocket::File, stat.progress, stat.progress + buf.length() == file.size, file.size);
-        stat.progress += buf.length();
+        d->socket->sendPayloadPacket(buf, stat.payloadId, NearbySocket::File, stat.read, stat.read + buf.length() == file.size, file.size);
+        stat.read += buf.length();
+        if (stat.readAhead && stat.readAhead->atEnd()) {
+            delete stat.readAhead;
+            stat.readAhead = nullptr;
+        }
 
         d->filesToSendStats.replace(i, stat);
-        complete = false;
+        d->chunkSizer.recordQueued(buf.length(), d->sendTimer.elapsed());
     }
 
     emit filesToTransferChanged();
 
-    if (complete) {
-        // Don't send the disconnect frame now because this causes Android to think that the file was not sent correctly for some reason
-        setState(State::Complete, true);
+    // Nothing is ever written when every file is empty, so this is the only chance to notice that the transfer is done
+    checkIfComplete();
+}
+
+int NearbyShareClient::nextFileToSend() {
+    readAheadFiles();
+
+    for (auto offset = 0; offset < d->sendOrder.length(); offset++) {
+        auto position = (d->nextFileToSend + offset) % d->sendOrder.length();
+        auto i = d->sendOrder.at(position);
+        const auto& stat = d->filesToSendStats.at(i);
+        if (stat.read == d->filesToSend.at(i).size) continue;
+
+        auto ready = stat.mapping || (stat.readAhead && stat.readAhead->isReady());
+        if (d->transferOrder == TransferOrder::RoundRobin) {
+            // A file still waiting on the disk loses its turn
+            if (!ready) continue;
+            d->nextFileToSend = (position + 1) % d->sendOrder.length();
+            return i;
+        }
+
+        // Otherwise this file carries on until it has been read. Files earlier in the order have all been read by
+        // then, so the search never has to wrap around.
+        d->nextFileToSend = position;
+        return ready ? i : -1;
+    }
+    return -1;
+}
+
+void NearbyShareClient::readAheadFiles() {
+    // Files are read ahead in send order. Round robin reads the first MaxFilesReading files that haven't been read
+    // yet, and other orders start on the next file while the current one finishes so that there is no gap between.
+    auto filesReading = 0;
+    auto maxFilesReading = d->transferOrder == TransferOrder::RoundRobin ? MaxFilesReading : 2;
+    for (auto position = 0; position < d->sendOrder.length() && filesReading < maxFilesReading; position++) {
+        auto i = d->sendOrder.at(position);
+        auto stat = d->filesToSendStats.at(i);
+        const auto& file = d->filesToSend.at(i);
+        if (stat.read == file.size) continue;
+
+        if (stat.readAhead) {
+            stat.readAhead->setChunkSize(d->chunkSizer.chunkSize());
+        } else if (!stat.mapping) {
+            // Files that can be mapped are always ready, so only the rest need reading ahead
+            stat.mapping = MappedFile::map(file.device, file.size - stat.read);
+            if (!stat.mapping) {
+                stat.readAhead = new FileReadAhead(file.device, file.size - stat.read, d->chunkSizer.chunkSize(), [this] {
+                    QMetaObject::invokeMethod(this, &NearbyShareClient::writeNextSendPackets, Qt::QueuedConnection);
+                });
+            }
+            d->filesToSendStats.replace(i, stat);
+        }
+        filesReading++;
+    }
+}
+
+void NearbyShareClient::payloadBytesWritten(qint64 id, qint64 bytes) {
+    for (auto i = 0; i < d->filesToSendStats.length(); i++) {
+        auto stat = d->filesToSendStats.at(i);
+        if (stat.payloadId == id) {
+            stat.progress += bytes;
+            if (stat.mapping) {
+                // Everything written has been encrypted, so the socket is done with that part of the mapping
+                stat.mapping->release(stat.progress);
+                if (stat.progress == d->filesToSend.at(i).size) {
+                    delete stat.mapping;
+                    stat.mapping = nullptr;
+                }
+            }
+            d->filesToSendStats.replace(i, stat);
+
+            d->chunkSizer.recordWritten(bytes, d->sendTimer.elapsed());
+        }
     }
+
+    checkIfComplete();
 }
@@ -38,10 +38,22 @@ class NearbyShareClient : public QObject {
                 QIODevice* device;
                 QString fileName;
                 quint64 size;
+
+                // Only used with TransferOrder::Priority; higher goes first
+                int priority = 0;
+        };
+
+        // The order in which file data is sent. Every mode except RoundRobin sends one file at a time, which gets the
+        // first file across sooner and keeps reads from the disk sequential.
+        enum class TransferOrder {
+            Sequential,
+            SmallestFirst,
+            RoundRobin,
+            Priority
         };
 
         static NearbyShareClient* clientForReceive(QIODevice* device);
-        static NearbyShareClient* clientForSend(QIODevice* device, QString peerName, QList<LocalFile> files);
+        static NearbyShareClient* clientForSend(QIODevice* device, QString peerName, QList<LocalFile> files, TransferOrder transferOrder = TransferOrder::RoundRobin);
         static QIODevice* resolveConnectionString(const QString& connectionString);
 
         enum class State {
@@ -57,7 +69,8 @@ class NearbyShareClient : public QObject {
             RemoteDeclined,
             RemoteOutOfSpace,
             RemoteUnsupported,
-            RemoteTimedOut
+            RemoteTimedOut,
+            OutOfSpace
         };
 
         struct TransferredFile {
@@ -97,9 +110,14 @@ class NearbyShareClient : public QObject {
         void setState(State state, bool dontDisconnect = false);
 
         void sendPairedKeyEncryptionResponse();
+        void sendConnectionResponse(int status);
+        void releaseReservedSpace();
         void checkIfComplete();
 
         void writeNextSendPackets();
+        int nextFileToSend();
+        void readAheadFiles();
+        void payloadBytesWritten(qint64 id, qint64 bytes);
 };
 
 #endif // QNEARBYSHARE_NEARBYSHARECLIENT_H
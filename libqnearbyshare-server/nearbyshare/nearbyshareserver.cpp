@@ -32,6 +32,7 @@
 #include <QTcpSocket>
 #include <QTextStream>
 
+#include "eckeypool.h"
 #include "endpointinfo.h"
 
 // Protocol documentation: https://github.com/grishka/NearDrop/blob/master/PROTOCOL.md
@@ -73,6 +74,9 @@ NearbyShareServer::~NearbyShareServer() {
 bool NearbyShareServer::start() {
     if (d->running) return true;
 
+    // Have handshake keys ready before the first peer connects
+    EcKeyPool::instance()->prefill();
+
     d->tcp = new QTcpServer(this);
 #if QT_VERSION > QT_VERSION_CHECK(6, 4, 0)
     connect(d->tcp, &QTcpServer::pendingConnectionAvailable, this, &NearbyShareServer::acceptPendingConnection);
@@ -26,32 +26,69 @@
 #include "offline_wire_formats.pb.h"
 #include "securemessage.pb.h"
 #include "ukey.pb.h"
-#include <QBuffer>
 #include <QCryptographicHash>
 #include <QIODevice>
 #include <QMap>
 #include <QRandomGenerator64>
+#include <QScopeGuard>
 #include <QTcpSocket>
 #include <QTextStream>
 #include <QTimer>
 #include <QtEndian>
+#include <google/protobuf/arena.h>
 #include <utility>
 
 #include <QQueue>
 
+#ifdef Q_OS_UNIX
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+
+    #ifndef MSG_NOSIGNAL
+        // Qt ignores SIGPIPE itself on platforms without MSG_NOSIGNAL
+        #define MSG_NOSIGNAL 0
+    #endif
+#endif
+
 #include "abstractnearbypayload.h"
+#include "bufferpool.h"
 #include "cryptography.h"
+#include "cryptosession.h"
+#include "eckeypool.h"
 #include "endpointinfo.h"
+#include "framedecoder.h"
 #include "nearbypayload.h"
+#include "payloadframeencoder.h"
+#include "receivepipeline.h"
 #include "securegcm.pb.h"
+#include "sendpipeline.h"
+#include "wireformat.h"
+
+namespace {
+    // Every Nearby Share peer speaks CBC. GCM is only offered in next_protocols, which Android ignores, so it is only
+    // ever picked when both ends are QNearbyShare.
+    const std::string CbcNextProtocol = "AES_256_CBC-HMAC_SHA256";
+    const std::string GcmNextProtocol = "AES_256_GCM";
+
+    // Caps how much a QTcpSocket reads ahead of us, so that a full receive pipeline pushes back on the peer
+    constexpr qint64 SocketReadBufferSize = 4 * 1024 * 1024;
+
+    // Queued frames (and length prefixes) handed to the kernel in a single call
+    constexpr int MaxSegmentsPerWrite = 64;
+
+    // Payload frames gathered from queued packets before they are encrypted as one job; as many messages as the
+    // AES-NI CBC encoder interleaves
+    constexpr int MaxBatchFrames = 8;
+} // namespace
 
 struct NearbySocketPrivate {
         QIODevice* io = nullptr;
 
-        QBuffer buffer;
+        FrameDecoder decoder;
 
-        quint32 packetLength = 0;
-        QByteArray packetData;
+        // Protobuf messages parsed out of secure frames live here and are released after every frame
+        QByteArray arenaBlock;
+        google::protobuf::Arena* arena = nullptr;
 
         enum State {
             ConnectingToPeer,
@@ -67,17 +104,22 @@ struct NearbySocketPrivate {
         State state = WaitingForConnectionRequest;
 
         QString peerName;
+        securegcm::Ukey2HandshakeCipher handshakeCipher = securegcm::P256_SHA512;
         EcKey* clientKey = nullptr;
         QByteArray clientInitMessage;
         QByteArray serverInitMessage;
         QByteArray clientHash;
         QByteArray clientFinishMessage;
 
+        // When initiating, a Curve25519 key is offered alongside the P-256 one and the server picks
+        EcKey* curve25519Key = nullptr;
+        QByteArray curve25519ClientFinishMessage;
+
         bool isServer;
-        QByteArray decryptKey;
-        QByteArray receiveHmacKey;
-        QByteArray encryptKey;
-        QByteArray sendHmacKey;
+        CryptoSession::Cipher nextProtocol = CryptoSession::Aes256CbcHmacSha256;
+        CryptoSession* cryptoSession = nullptr;
+        SendPipeline* sendPipeline = nullptr;
+        ReceivePipeline* receivePipeline = nullptr;
         QByteArray authString;
 
         qint32 peerSeq = 0;
@@ -87,8 +129,42 @@ struct NearbySocketPrivate {
         QMap<qint64, AbstractNearbyPayloadPtr> pendingPayloads;
 
         QQueue<QByteArray> pendingPackets;
-        quint64 pendingWrite = 0;
+        qint64 pendingWrite = 0;
+
+        // What each queued segment carries, in the same order as the segments (whether they are still in the send
+        // pipeline or already in pendingPackets)
+        struct OutgoingSegment {
+                bool isPayload = false;
+                qint64 payloadId = 0;
+                qint64 payloadBytes = 0;
+        };
+        QQueue<OutgoingSegment> outgoingSegments;
+
+        // Payload chunks that have been written to the device, with the position in the stream where their frame
+        // ends. A chunk only counts as sent once the kernel has taken everything up to there.
+        struct UnsentChunk {
+                qint64 payloadId;
+                qint64 payloadBytes;
+                qint64 end;
+        };
+        QQueue<UnsentChunk> unsentChunks;
+
+        // Payload chunks from consecutive packets that are still to be handed to the send pipeline, already numbered
+        // from batchFirstSequenceNumber. Queueing them together lets the cipher encrypt them side by side.
+        QList<PayloadFrameEncoder::Chunk> batchChunks;
+        QList<QByteArray> batchData;
+        qint32 batchFirstSequenceNumber = 0;
+        bool batchFlushQueued = false;
+        qint64 bytesQueued = 0;
+        qint64 bytesSent = 0;
+        qint64 payloadBytesInFlight = 0;
+        qint64 lowWatermark = NearbySocket::DefaultLowWatermark;
+        qint64 highWatermark = NearbySocket::DefaultHighWatermark;
         bool blockWrite = false;
+
+        bool receiveBlocked() {
+            return state == Ready && receivePipeline->isFull();
+        }
 };
 
 NearbySocket::NearbySocket(QIODevice* ioDevice, bool isServer, QObject* parent) :
@@ -97,12 +173,19 @@ NearbySocket::NearbySocket(QIODevice* ioDevice, bool isServer, QObject* parent)
     d->io = ioDevice;
     d->isServer = isServer;
 
+    d->arenaBlock = QByteArray(64 * 1024, Qt::Uninitialized);
+    google::protobuf::ArenaOptions arenaOptions;
+    arenaOptions.initial_block = d->arenaBlock.data();
+    arenaOptions.initial_block_size = d->arenaBlock.size();
+    d->arena = new google::protobuf::Arena(arenaOptions);
+
     d->keepaliveTimer = new QTimer(this);
     d->keepaliveTimer->setInterval(10000);
     connect(d->keepaliveTimer, &QTimer::timeout, this, [this] {
         this->sendKeepalive(false);
     });
 
+    if (auto socket = qobject_cast<QAbstractSocket*>(d->io)) socket->setReadBufferSize(SocketReadBufferSize);
     connect(d->io, &QIODevice::readyRead, this, &NearbySocket::readBuffer);
     connect(d->io, &QIODevice::aboutToClose, this, [this] {
         d->keepaliveTimer->stop();
@@ -112,7 +195,8 @@ NearbySocket::NearbySocket(QIODevice* ioDevice, bool isServer, QObject* parent)
     });
     connect(d->io, &QIODevice::bytesWritten, this, [this](qint64 bytes) {
         d->pendingWrite -= bytes;
-        if (d->pendingWrite == 0) {
+        this->countSentBytes(bytes);
+        if (d->pendingWrite <= d->lowWatermark) {
             this->writeNextPacket();
         }
     });
@@ -140,64 +224,59 @@ NearbySocket::~NearbySocket() {
     if (d->clientKey != nullptr) {
         Cryptography::deleteEcdsaKeyPair(d->clientKey);
     }
+    if (d->curve25519Key != nullptr) {
+        Cryptography::deleteEcdsaKeyPair(d->curve25519Key);
+    }
+    delete d->sendPipeline;
+    delete d->receivePipeline;
+    delete d->cryptoSession;
+    delete d->arena;
     delete d;
 }
 
 void NearbySocket::readBuffer() {
-    d->buffer.open(QBuffer::ReadWrite);
-    d->buffer.write(d->io->readAll());
-    d->buffer.seek(0);
-
-    while (!d->buffer.atEnd()) {
-        if (d->packetLength == 0) {
-            // Read in 4 bytes for the packet length
-            auto packetLength = d->buffer.read(4);
-            if (packetLength.length() != 4) {
-                // If we don't have 4 bytes that means we've stopped reading in the middle of the packet length
-                // Save it for next time and wait for more data
-                d->buffer.close();
-                d->buffer.setData(packetLength);
-                return;
-            }
-
-            d->packetLength = qFromBigEndian(*reinterpret_cast<quint32*>(packetLength.data()));
-        }
-
-        while (d->packetLength > 0 && !d->buffer.atEnd()) {
-            auto buf = d->buffer.read(d->packetLength);
-            d->packetData.append(buf);
-            d->packetLength -= buf.length();
-        }
-
-        if (d->packetLength == 0) {
-            // We have the entire packet now
-
+    forever {
+        // Frames that are already buffered go first. While the receive pipeline is full they stay in the decoder and
+        // new data stays in the socket, until processReceivedMessages() makes room and calls back in here.
+        QByteArrayView frame;
+        while (!d->receiveBlocked() && d->decoder.nextFrame(&frame)) {
             switch (d->state) {
                 case NearbySocketPrivate::WaitingForConnectionRequest:
                 case NearbySocketPrivate::WaitingForConnectionResponse:
-                    processOfflineFrame(d->packetData);
+                    processOfflineFrame(frame);
                     break;
                 case NearbySocketPrivate::WaitingForUkey2ClientInit:
                 case NearbySocketPrivate::WaitingForUkey2ServerInit:
                 case NearbySocketPrivate::WaitingForUkey2ClientFinish:
-                    processUkey2Frame(d->packetData);
+                    processUkey2Frame(frame);
                     break;
                 case NearbySocketPrivate::Ready:
-                    processSecureFrame(d->packetData);
+                    // The frame is copied, so the view only needs to last until here
+                    d->receivePipeline->submit(frame);
                     break;
             }
-
-            d->packetData.clear();
         }
-    }
+        if (d->decoder.hasOversizedFrame()) {
+            // Don't buffer anything more from a peer that claims to be sending something this big
+            QTextStream(stderr) << "Received frame longer than " << FrameDecoder::MaxFrameLength << " bytes\n";
+            d->io->close();
+            return;
+        }
+        if (d->receiveBlocked()) return;
+
+        auto available = d->io->bytesAvailable();
+        if (available <= 0) return;
 
-    d->buffer.close();
-    d->buffer.setData(QByteArray());
+        // Read straight into the decoder so that frames never need to be copied out
+        auto read = d->io->read(d->decoder.prepareWrite(available), available);
+        if (read <= 0) return;
+        d->decoder.commitWrite(read);
+    }
 }
 
-void NearbySocket::processOfflineFrame(const QByteArray& frame) {
+void NearbySocket::processOfflineFrame(QByteArrayView frame) {
     location::nearby::connections::OfflineFrame offlineFrame;
-    auto success = offlineFrame.ParseFromString(frame.toStdString());
+    auto success = offlineFrame.ParseFromArray(frame.data(), frame.size());
     if (success) {
         switch (offlineFrame.version()) {
             case location::nearby::connections::OfflineFrame_Version_V1:
@@ -254,11 +333,11 @@ void NearbySocket::processOfflineFrame(const QByteArray& frame) {
     // End the connection here
 }
 
-void NearbySocket::processUkey2Frame(const QByteArray& frame) {
+void NearbySocket::processUkey2Frame(QByteArrayView frame) {
     securegcm::Ukey2Alert::AlertType alertType = securegcm::Ukey2Alert_AlertType_BAD_MESSAGE;
 
     securegcm::Ukey2Message ukey2Message;
-    auto success = ukey2Message.ParseFromString(frame.toStdString());
+    auto success = ukey2Message.ParseFromArray(frame.data(), frame.size());
     if (success) {
         switch (ukey2Message.message_type()) {
             case securegcm::Ukey2Message_Type_UNKNOWN_DO_NOT_USE:
@@ -266,7 +345,7 @@ void NearbySocket::processUkey2Frame(const QByteArray& frame) {
             case securegcm::Ukey2Message_Type_ALERT:
                 {
                     securegcm::Ukey2Alert alert;
-                    alert.ParseFromString(frame.toStdString());
+                    alert.ParseFromArray(frame.data(), frame.size());
                     break;
                 }
             case securegcm::Ukey2Message_Type_CLIENT_INIT:
@@ -275,7 +354,7 @@ void NearbySocket::processUkey2Frame(const QByteArray& frame) {
                         securegcm::Ukey2ClientInit clientInit;
                         auto success = clientInit.ParseFromString(ukey2Message.message_data());
                         if (success) {
-                            d->clientInitMessage = frame;
+                            d->clientInitMessage = frame.toByteArray();
 
                             if (clientInit.version() != 1) {
                                 alertType = securegcm::Ukey2Alert_AlertType_BAD_VERSION;
@@ -293,7 +372,19 @@ void NearbySocket::processUkey2Frame(const QByteArray& frame) {
                                 break;
                             }
 
-                            if (QString::fromStdString(clientInit.next_protocol()) != "AES_256_CBC-HMAC_SHA256") {
+                            // Clients that list their next protocols get the first one we support, everyone else gets CBC
+                            std::string nextProtocol;
+                            for (const auto& protocol : clientInit.next_protocols()) {
+                                if (protocol == GcmNextProtocol || protocol == CbcNextProtocol) {
+                                    nextProtocol = protocol;
+                                    break;
+                                }
+                            }
+                            if (nextProtocol.empty() && clientInit.next_protocol() == CbcNextProtocol) {
+                                nextProtocol = CbcNextProtocol;
+                            }
+
+                            if (nextProtocol.empty()) {
                                 alertType = securegcm::Ukey2Alert_AlertType_BAD_NEXT_PROTOCOL;
                                 d->state = NearbySocketPrivate::Error;
                                 emit errorOccurred();
@@ -301,10 +392,17 @@ void NearbySocket::processUkey2Frame(const QByteArray& frame) {
                                 break;
                             }
 
+                            // Prefer Curve25519 when the client offers it since it is much cheaper than P-256
                             QByteArray commitmentHash;
                             for (const auto& commitment : clientInit.cipher_commitments()) {
-                                if (commitment.handshake_cipher() == securegcm::P256_SHA512) { // TODO: Support Curve25519
+                                if (commitment.handshake_cipher() == securegcm::CURVE25519_SHA512) {
                                     commitmentHash = QByteArray::fromStdString(commitment.commitment());
+                                    d->handshakeCipher = securegcm::CURVE25519_SHA512;
+                                    break;
+                                }
+                                if (commitment.handshake_cipher() == securegcm::P256_SHA512) {
+                                    commitmentHash = QByteArray::fromStdString(commitment.commitment());
+                                    d->handshakeCipher = securegcm::P256_SHA512;
                                 }
                             }
                             if (commitmentHash.isEmpty()) {
@@ -316,21 +414,31 @@ void NearbySocket::processUkey2Frame(const QByteArray& frame) {
                             }
                             d->clientHash = commitmentHash;
 
-                            auto ecP256PublicKey = new securemessage::EcP256PublicKey();
-                            d->clientKey = Cryptography::generateEcdsaKeyPair();
-
-                            ecP256PublicKey->set_x(Cryptography::ecdsaX(d->clientKey).toStdString());
-                            ecP256PublicKey->set_y(Cryptography::ecdsaY(d->clientKey).toStdString());
-
-                            securemessage::GenericPublicKey publickey;
-                            publickey.set_type(securemessage::EC_P256);
-                            publickey.set_allocated_ec_p256_public_key(ecP256PublicKey);
-
                             securegcm::Ukey2ServerInit serverInit;
                             serverInit.set_version(1);
                             serverInit.set_random(QByteArray(Cryptography::randomBytes(32)).toStdString());
-                            serverInit.set_handshake_cipher(securegcm::P256_SHA512);
-                            serverInit.set_public_key(publickey.SerializeAsString());
+                            serverInit.set_handshake_cipher(d->handshakeCipher);
+                            if (clientInit.next_protocols_size() > 0) {
+                                serverInit.set_selected_next_protocol(nextProtocol);
+                            }
+                            d->nextProtocol = nextProtocol == GcmNextProtocol ? CryptoSession::Aes256Gcm : CryptoSession::Aes256CbcHmacSha256;
+
+                            if (d->handshakeCipher == securegcm::CURVE25519_SHA512) {
+                                // Curve25519 keys are cheap enough to generate inline
+                                d->clientKey = Cryptography::generateX25519KeyPair();
+                                serverInit.set_public_key(Cryptography::x25519PublicKey(d->clientKey).toStdString());
+                            } else {
+                                auto ecP256PublicKey = new securemessage::EcP256PublicKey();
+                                d->clientKey = EcKeyPool::instance()->takeKey();
+
+                                ecP256PublicKey->set_x(Cryptography::ecdsaX(d->clientKey).toStdString());
+                                ecP256PublicKey->set_y(Cryptography::ecdsaY(d->clientKey).toStdString());
+
+                                securemessage::GenericPublicKey publickey;
+                                publickey.set_type(securemessage::EC_P256);
+                                publickey.set_allocated_ec_p256_public_key(ecP256PublicKey);
+                                serverInit.set_public_key(publickey.SerializeAsString());
+                            }
 
                             securegcm::Ukey2Message replyMessage;
                             replyMessage.set_message_type(securegcm::Ukey2Message_Type_SERVER_INIT);
@@ -350,7 +458,7 @@ void NearbySocket::processUkey2Frame(const QByteArray& frame) {
                         securegcm::Ukey2ServerInit serverInit;
                         auto success = serverInit.ParseFromString(ukey2Message.message_data());
                         if (success) {
-                            d->serverInitMessage = frame;
+                            d->serverInitMessage = frame.toByteArray();
 
                             if (serverInit.version() != 1) {
                                 alertType = securegcm::Ukey2Alert_AlertType_BAD_VERSION;
@@ -368,26 +476,41 @@ void NearbySocket::processUkey2Frame(const QByteArray& frame) {
                                 break;
                             }
 
-                            if (serverInit.handshake_cipher() != securegcm::P256_SHA512) {
+                            if (serverInit.handshake_cipher() == securegcm::CURVE25519_SHA512) {
+                                // The key we didn't commit to is no longer needed
+                                std::swap(d->clientKey, d->curve25519Key);
+                                d->clientFinishMessage = d->curve25519ClientFinishMessage;
+                                d->handshakeCipher = securegcm::CURVE25519_SHA512;
+                            } else if (serverInit.handshake_cipher() != securegcm::P256_SHA512) {
                                 alertType = securegcm::Ukey2Alert_AlertType_BAD_HANDSHAKE_CIPHER;
                                 d->state = NearbySocketPrivate::Error;
                                 emit errorOccurred();
                                 QTextStream(stderr) << "Handshake failed due to bad handshake cipher\n";
                                 break;
                             }
+                            Cryptography::deleteEcdsaKeyPair(d->curve25519Key);
+                            d->curve25519Key = nullptr;
 
-                            securemessage::GenericPublicKey serverPublicKey;
-                            serverPublicKey.ParseFromString(serverInit.public_key());
+                            // Peers that don't know about next_protocols leave the selection empty and speak CBC
+                            if (serverInit.selected_next_protocol() == GcmNextProtocol) {
+                                d->nextProtocol = CryptoSession::Aes256Gcm;
+                            } else if (serverInit.has_selected_next_protocol() && serverInit.selected_next_protocol() != CbcNextProtocol) {
+                                alertType = securegcm::Ukey2Alert_AlertType_BAD_NEXT_PROTOCOL;
+                                d->state = NearbySocketPrivate::Error;
+                                emit errorOccurred();
+                                QTextStream(stderr) << "Handshake failed due to bad next protocol\n";
+                                break;
+                            }
 
-                            if (serverPublicKey.type() != securemessage::EC_P256) {
+                            auto sharedSecret = this->peerSharedSecret(QByteArray::fromStdString(serverInit.public_key()));
+                            if (sharedSecret.isEmpty()) {
                                 // TODO: close connection
                                 return;
                             }
 
                             sendPacket(d->clientFinishMessage);
 
-                            auto ecp256 = serverPublicKey.ec_p256_public_key();
-                            this->setupDiffieHellman(QByteArray::fromStdString(ecp256.x()), QByteArray::fromStdString(ecp256.y()));
+                            this->setupDiffieHellman(sharedSecret);
                             this->sendConnectionResponse();
 
                             d->state = NearbySocketPrivate::WaitingForConnectionResponse;
@@ -403,18 +526,15 @@ void NearbySocket::processUkey2Frame(const QByteArray& frame) {
                         auto success = clientFinish.ParseFromString(ukey2Message.message_data());
                         if (success) {
                             // https://github.com/google/ukey2#deriving-the-authentication-string-and-the-next-protocol-secret
-                            securemessage::GenericPublicKey publicKey;
-                            publicKey.ParseFromString(clientFinish.public_key());
-
-                            if (publicKey.type() != securemessage::EC_P256) {
+                            auto sharedSecret = this->peerSharedSecret(QByteArray::fromStdString(clientFinish.public_key()));
+                            if (sharedSecret.isEmpty()) {
                                 // TODO: close connection
                                 return;
                             }
 
                             // TODO: Verify the commitment hash
 
-                            auto ecp256 = publicKey.ec_p256_public_key();
-                            this->setupDiffieHellman(QByteArray::fromStdString(ecp256.x()), QByteArray::fromStdString(ecp256.y()));
+                            this->setupDiffieHellman(sharedSecret);
 
                             d->state = NearbySocketPrivate::WaitingForConnectionResponse;
                             return;
@@ -443,27 +563,39 @@ void NearbySocket::sendPacket(const QByteArray& packet) {
         d->mySeq++;
 
         auto d2dmBytes = QByteArray::fromStdString(d2dm.SerializeAsString());
-        auto iv = Cryptography::randomBytes(16);
-        auto encrypted = Cryptography::aes256cbcEncrypt(d2dmBytes, d->encryptKey, iv);
+        auto iv = Cryptography::randomBytes(d->cryptoSession->ivLength());
+        auto isGcm = d->cryptoSession->cipher() == CryptoSession::Aes256Gcm;
 
         securegcm::GcmMetadata metadata;
         metadata.set_type(securegcm::DEVICE_TO_DEVICE_MESSAGE);
         metadata.set_version(1);
 
-        auto header = new securemessage::Header();
-        header->set_encryption_scheme(securemessage::AES_256_CBC);
-        header->set_signature_scheme(securemessage::HMAC_SHA256);
-        header->set_public_metadata(metadata.SerializeAsString());
-        header->set_iv(iv.toStdString());
+        securemessage::Header header;
+        header.set_encryption_scheme(isGcm ? securemessage::AES_256_GCM : securemessage::AES_256_CBC);
+        header.set_signature_scheme(isGcm ? securemessage::AEAD_TAG : securemessage::HMAC_SHA256);
+        header.set_public_metadata(metadata.SerializeAsString());
+        header.set_iv(iv.toStdString());
+        auto headerBytes = QByteArray::fromStdString(header.SerializeAsString());
+
+        QByteArray encrypted(d2dmBytes.length() + 16, Qt::Uninitialized);
+        QByteArray tag;
+        if (isGcm) {
+            // The tag covers the header as well, so it doubles as the signature
+            tag = QByteArray(Cryptography::Aes256GcmTagLength, Qt::Uninitialized);
+            encrypted.truncate(d->cryptoSession->encrypt(d2dmBytes.constData(), d2dmBytes.length(), encrypted.data(), iv, headerBytes, tag.data()));
+        } else {
+            encrypted.truncate(d->cryptoSession->encrypt(d2dmBytes.constData(), d2dmBytes.length(), encrypted.data(), iv));
+        }
 
-        securemessage::HeaderAndBody headerAndBody;
-        headerAndBody.set_allocated_header(header);
+        // Same wire format as HeaderAndBody, but keeps the header as the exact bytes that were authenticated
+        securemessage::HeaderAndBodyInternal headerAndBody;
+        headerAndBody.set_header(headerBytes.toStdString());
         headerAndBody.set_body(encrypted.toStdString());
 
         auto headerAndBodyBytes = QByteArray::fromStdString(headerAndBody.SerializeAsString());
 
         securemessage::SecureMessage message;
-        message.set_signature(Cryptography::hmacSha256Signature(headerAndBodyBytes, d->sendHmacKey).toStdString());
+        message.set_signature(isGcm ? tag.toStdString() : d->cryptoSession->sign(headerAndBodyBytes).toStdString());
         message.set_header_and_body(headerAndBodyBytes.toStdString());
 
         plainPacket = QByteArray::fromStdString(message.SerializeAsString());
@@ -472,9 +604,11 @@ void NearbySocket::sendPacket(const QByteArray& packet) {
     quint32 packetLength = plainPacket.length();
     auto bePacketLength = qToBigEndian(packetLength);
 
-    plainPacket.prepend(reinterpret_cast<char*>(&bePacketLength), 4);
+    // The length prefix is queued as a segment of its own, which is written together with the frame, rather than
+    // prepended, which would copy the whole frame
+    this->enqueuePacket(QByteArray(reinterpret_cast<char*>(&bePacketLength), 4));
     if (!plainPacket.isEmpty()) {
-        d->pendingPackets.enqueue(plainPacket);
+        this->enqueuePacket(plainPacket);
     }
     this->writeNextPacket();
 }
@@ -483,94 +617,77 @@ void NearbySocket::sendPacket(const google::protobuf::MessageLite& message) {
     sendPacket(QByteArray::fromStdString(message.SerializeAsString()));
 }
 
-void NearbySocket::processSecureFrame(const QByteArray& frame) {
-    securemessage::SecureMessage message;
-    auto success = message.ParseFromString(frame.toStdString());
-    if (!success) return;
-
-    auto signature = QByteArray::fromStdString(message.signature());
-    auto calculatedSignature = Cryptography::hmacSha256Signature(QByteArray::fromStdString(message.header_and_body()), d->receiveHmacKey);
-    if (signature != calculatedSignature) {
-        QTextStream(stderr) << "Received secure packet with wrong signature\n";
-        this->disconnect();
-        return;
-    }
-
-    securemessage::HeaderAndBody headerAndBody;
-    success = headerAndBody.ParseFromString(message.header_and_body());
-    if (!success) return;
-
-    if (headerAndBody.header().encryption_scheme() != securemessage::AES_256_CBC) {
-        QTextStream(stderr) << "Received secure packet with wrong encryption scheme\n";
-        this->disconnect();
-        return;
+void NearbySocket::processReceivedMessages() {
+    QQueue<ReceivePipeline::Message> messages;
+    d->receivePipeline->takeMessages(&messages);
+    while (!messages.isEmpty()) {
+        auto message = messages.dequeue();
+        switch (message.error) {
+            case ReceivePipeline::NoError:
+                d->peerSeq = message.sequenceNumber;
+                processSecureMessage(message.message);
+                BufferPool::instance()->recycle(std::move(message.decrypted));
+                break;
+            case ReceivePipeline::Malformed:
+                QTextStream(stderr) << "Could not parse secure packet\n";
+                break;
+            case ReceivePipeline::Undecryptable:
+                QTextStream(stderr) << "Received undecryptable secure packet\n";
+                break;
+            case ReceivePipeline::BadSignature:
+                QTextStream(stderr) << "Received secure packet with wrong signature\n";
+                this->disconnect();
+                return;
+            case ReceivePipeline::BadEncryptionScheme:
+                QTextStream(stderr) << "Received secure packet with wrong encryption scheme\n";
+                this->disconnect();
+                return;
+            case ReceivePipeline::BadSignatureScheme:
+                QTextStream(stderr) << "Received secure packet with wrong signature scheme\n";
+                this->disconnect();
+                return;
+            case ReceivePipeline::BadSequenceNumber:
+                QTextStream(stderr) << "Received secure packet out of sequence\n";
+                this->disconnect();
+                return;
+        }
     }
 
-    if (headerAndBody.header().signature_scheme() != securemessage::HMAC_SHA256) {
-        QTextStream(stderr) << "Received secure packet with wrong signature scheme\n";
-        this->disconnect();
-        return;
-    }
+    // The pipeline has room again, so pick up any frames that were held back
+    this->readBuffer();
+}
 
-    auto iv = QByteArray::fromStdString(headerAndBody.header().iv());
-    auto decrypted = Cryptography::aes256cbcDecrypt(QByteArray::fromStdString(headerAndBody.body()), d->decryptKey, iv);
-    if (decrypted.isEmpty()) {
-        QTextStream(stderr) << "Received undecryptable secure packet\n";
-        return;
-    }
+void NearbySocket::processSecureMessage(QByteArrayView message) {
+    // The payload chunk is read as a view into the decrypted message. Only the small messages are parsed by
+    // protobuf, into the per socket arena.
+    auto resetArena = qScopeGuard([this] {
+        d->arena->Reset();
+    });
 
-    securegcm::DeviceToDeviceMessage d2dm;
-    success = d2dm.ParseFromString(decrypted.toStdString());
-    if (!success) {
-        QTextStream(stderr) << "Could not parse secure packet\n";
+    // Payload transfers are by far the most common frame, so pick them out without parsing the whole offline frame
+    QByteArrayView payloadTransfer;
+    if (this->findPayloadTransfer(message, &payloadTransfer)) {
+        this->processPayloadTransfer(payloadTransfer);
         return;
     }
 
-    // TODO: sequence number
-    auto seq = d2dm.sequence_number();
-
-    location::nearby::connections::OfflineFrame offlineFrame;
-    success = offlineFrame.ParseFromString(d2dm.message());
-    if (!success) {
+    auto offlineFrame = google::protobuf::Arena::CreateMessage<location::nearby::connections::OfflineFrame>(d->arena);
+    if (!offlineFrame->ParseFromArray(message.data(), static_cast<int>(message.size()))) {
         QTextStream(stderr) << "Could not parse decrypted packet as offline frame";
         return;
     }
 
-    if (offlineFrame.version() != location::nearby::connections::OfflineFrame_Version_V1) {
+    if (offlineFrame->version() != location::nearby::connections::OfflineFrame_Version_V1) {
         QTextStream(stderr) << "Received offline frame with version != 1";
         return;
     }
 
-    auto v1 = offlineFrame.v1();
+    const auto& v1 = offlineFrame->v1();
 
     switch (v1.type()) {
-        case location::nearby::connections::V1Frame_FrameType_PAYLOAD_TRANSFER:
-            {
-                const auto& payloadTransfer = v1.payload_transfer();
-                const auto& payloadHeader = payloadTransfer.payload_header();
-                const auto& payloadChunk = payloadTransfer.payload_chunk();
-                auto id = payloadHeader.id();
-
-                AbstractNearbyPayloadPtr payload;
-                if (d->pendingPayloads.contains(id)) {
-                    payload = d->pendingPayloads.value(id);
-                } else {
-                    payload = AbstractNearbyPayloadPtr(new NearbyPayload(id, payloadHeader.type() == location::nearby::connections::PayloadTransferFrame_PayloadHeader_PayloadType_BYTES));
-                    d->pendingPayloads.insert(id, payload);
-                }
-
-                payload->loadChunk(payloadChunk.offset(), QByteArray::fromStdString(payloadChunk.body()));
-                if (payloadChunk.flags() & location::nearby::connections::PayloadTransferFrame_PayloadChunk_Flags_LAST_CHUNK) {
-                    payload->setCompleted();
-                    d->pendingPayloads.remove(id);
-
-                    emit messageReceived(payload);
-                }
-                break;
-            }
         case location::nearby::connections::V1Frame_FrameType_KEEP_ALIVE:
             {
-                auto ka = v1.keep_alive();
+                const auto& ka = v1.keep_alive();
                 if (ka.ack()) {
                     QTextStream(stderr) << "Sent keepalive was ack'd\n";
                 } else {
@@ -591,6 +708,89 @@ void NearbySocket::processSecureFrame(const QByteArray& frame) {
     }
 }
 
+bool NearbySocket::findPayloadTransfer(QByteArrayView offlineFrame, QByteArrayView* payloadTransfer) {
+    QByteArrayView v1;
+    quint64 version = location::nearby::connections::OfflineFrame_Version_UNKNOWN_VERSION;
+
+    WireFormat::Reader frameReader(offlineFrame);
+    while (frameReader.next()) {
+        if (frameReader.fieldNumber() == location::nearby::connections::OfflineFrame::kVersionFieldNumber) {
+            version = frameReader.varint();
+        } else if (frameReader.fieldNumber() == location::nearby::connections::OfflineFrame::kV1FieldNumber) {
+            v1 = frameReader.bytes();
+        }
+    }
+    if (frameReader.error() || version != location::nearby::connections::OfflineFrame_Version_V1) return false;
+
+    quint64 type = location::nearby::connections::V1Frame_FrameType_UNKNOWN_FRAME_TYPE;
+    WireFormat::Reader v1Reader(v1);
+    while (v1Reader.next()) {
+        if (v1Reader.fieldNumber() == location::nearby::connections::V1Frame::kTypeFieldNumber) {
+            type = v1Reader.varint();
+        }
+    }
+    if (v1Reader.error() || type != location::nearby::connections::V1Frame_FrameType_PAYLOAD_TRANSFER) return false;
+
+    return WireFormat::findBytes(v1, location::nearby::connections::V1Frame::kPayloadTransferFieldNumber, payloadTransfer);
+}
+
+void NearbySocket::processPayloadTransfer(QByteArrayView payloadTransfer) {
+    QByteArrayView payloadHeaderBytes;
+    QByteArrayView payloadChunkBytes;
+    if (!WireFormat::findBytes(payloadTransfer, location::nearby::connections::PayloadTransferFrame::kPayloadHeaderFieldNumber, &payloadHeaderBytes) ||
+        !WireFormat::findBytes(payloadTransfer, location::nearby::connections::PayloadTransferFrame::kPayloadChunkFieldNumber, &payloadChunkBytes)) {
+        QTextStream(stderr) << "Could not parse payload transfer frame\n";
+        return;
+    }
+
+    auto payloadHeader = google::protobuf::Arena::CreateMessage<location::nearby::connections::PayloadTransferFrame_PayloadHeader>(d->arena);
+    if (!payloadHeader->ParseFromArray(payloadHeaderBytes.data(), static_cast<int>(payloadHeaderBytes.size()))) {
+        QTextStream(stderr) << "Could not parse payload header\n";
+        return;
+    }
+
+    quint64 flags = 0;
+    quint64 offset = 0;
+    QByteArrayView body;
+
+    WireFormat::Reader chunkReader(payloadChunkBytes);
+    while (chunkReader.next()) {
+        switch (chunkReader.fieldNumber()) {
+            case location::nearby::connections::PayloadTransferFrame_PayloadChunk::kFlagsFieldNumber:
+                flags = chunkReader.varint();
+                break;
+            case location::nearby::connections::PayloadTransferFrame_PayloadChunk::kOffsetFieldNumber:
+                offset = chunkReader.varint();
+                break;
+            case location::nearby::connections::PayloadTransferFrame_PayloadChunk::kBodyFieldNumber:
+                body = chunkReader.bytes();
+                break;
+        }
+    }
+    if (chunkReader.error()) {
+        QTextStream(stderr) << "Could not parse payload chunk\n";
+        return;
+    }
+
+    auto id = payloadHeader->id();
+
+    AbstractNearbyPayloadPtr payload;
+    if (d->pendingPayloads.contains(id)) {
+        payload = d->pendingPayloads.value(id);
+    } else {
+        payload = AbstractNearbyPayloadPtr(new NearbyPayload(id, payloadHeader->type() == location::nearby::connections::PayloadTransferFrame_PayloadHeader_PayloadType_BYTES));
+        d->pendingPayloads.insert(id, payload);
+    }
+
+    payload->loadChunk(offset, body);
+    if (flags & location::nearby::connections::PayloadTransferFrame_PayloadChunk_Flags_LAST_CHUNK) {
+        payload->setCompleted();
+        d->pendingPayloads.remove(id);
+
+        emit messageReceived(payload);
+    }
+}
+
 void NearbySocket::sendPayloadPacket(const QByteArray& packet) {
     auto id = QRandomGenerator64::global()->generate();
 
@@ -614,57 +814,72 @@ void NearbySocket::sendPayloadPacket(const QByteArray& packet, qint64 id, Payloa
             break;
     }
 
-    auto payloadHeader1 = new location::nearby::connections::PayloadTransferFrame_PayloadHeader();
-    payloadHeader1->set_id(id);
-    payloadHeader1->set_type(pbPayloadType);
-    payloadHeader1->set_total_size(totalPayloadSize);
-    payloadHeader1->set_is_sensitive(false);
+    // The whole packet goes out as one frame, so the caller decides how much framing and signing each byte costs
+    QList<PayloadFrameEncoder::Chunk> chunks;
+    PayloadFrameEncoder::Chunk chunk;
+    chunk.id = id;
+    chunk.payloadType = pbPayloadType;
+    chunk.totalSize = totalPayloadSize;
+    chunk.offset = offset;
+    chunk.flags = 0;
+    chunk.body = packet;
+    chunks.append(chunk);
 
-    auto payloadChunk1 = new location::nearby::connections::PayloadTransferFrame_PayloadChunk();
-    payloadChunk1->set_offset(offset);
-    payloadChunk1->set_flags(0);
-    payloadChunk1->set_body(packet.toStdString());
-
-    auto payloadTransfer1 = new location::nearby::connections::PayloadTransferFrame();
-    payloadTransfer1->set_packet_type(location::nearby::connections::PayloadTransferFrame_PacketType_DATA);
-    payloadTransfer1->set_allocated_payload_header(payloadHeader1);
-    payloadTransfer1->set_allocated_payload_chunk(payloadChunk1);
+    if (lastChunk) {
+        chunk.offset = packet.length() + offset;
+        chunk.flags = location::nearby::connections::PayloadTransferFrame_PayloadChunk_Flags_LAST_CHUNK;
+        chunk.body = {};
+        chunks.append(chunk);
+    }
 
-    auto v1_1 = new location::nearby::connections::V1Frame();
-    v1_1->set_type(location::nearby::connections::V1Frame_FrameType_PAYLOAD_TRANSFER);
-    v1_1->set_allocated_payload_transfer(payloadTransfer1);
+    sendPayloadChunks(chunks, packet);
+}
 
-    location::nearby::connections::OfflineFrame offlineFrame1;
-    offlineFrame1.set_version(location::nearby::connections::OfflineFrame_Version_V1);
-    offlineFrame1.set_allocated_v1(v1_1);
-    sendPacket(offlineFrame1);
+void NearbySocket::sendPayloadChunks(const QList<PayloadFrameEncoder::Chunk>& chunks, const QByteArray& data) {
+    if (d->state != NearbySocketPrivate::Ready) {
+        QTextStream(stderr) << "Tried to send a payload before the connection was encrypted\n";
+        return;
+    }
 
-    if (lastChunk) {
-        auto payloadHeader2 = new location::nearby::connections::PayloadTransferFrame_PayloadHeader();
-        payloadHeader2->set_id(id);
-        payloadHeader2->set_type(pbPayloadType);
-        payloadHeader2->set_total_size(totalPayloadSize);
-        payloadHeader2->set_is_sensitive(false);
+    // The frames are numbered now, so they keep their place in the sequence while they wait for the rest of the
+    // batch and while the workers encrypt them
+    if (d->batchChunks.isEmpty()) d->batchFirstSequenceNumber = d->mySeq;
+    d->batchChunks.append(chunks);
+    d->batchData.append(data);
+    d->mySeq += chunks.size();
+    for (const auto& chunk : chunks) {
+        d->outgoingSegments.enqueue({true, chunk.id, chunk.body.size()});
+        d->payloadBytesInFlight += chunk.body.size();
+    }
 
-        auto payloadChunk2 = new location::nearby::connections::PayloadTransferFrame_PayloadChunk();
-        payloadChunk2->set_offset(packet.length() + offset);
-        payloadChunk2->set_flags(location::nearby::connections::PayloadTransferFrame_PayloadChunk_Flags_LAST_CHUNK);
-        payloadChunk2->set_body(QByteArray().toStdString());
+    if (d->batchChunks.size() >= MaxBatchFrames) {
+        flushPayloadBatch();
+    }
 
-        auto payloadTransfer2 = new location::nearby::connections::PayloadTransferFrame();
-        payloadTransfer2->set_packet_type(location::nearby::connections::PayloadTransferFrame_PacketType_DATA);
-        payloadTransfer2->set_allocated_payload_header(payloadHeader2);
-        payloadTransfer2->set_allocated_payload_chunk(payloadChunk2);
+    // Whatever has been gathered by the time control returns to the event loop goes out then, so the packets the
+    // caller queues in one go share a batch
+    if (!d->batchFlushQueued) {
+        d->batchFlushQueued = true;
+        QMetaObject::invokeMethod(this, [this] {
+            d->batchFlushQueued = false;
+            this->flushPayloadBatch();
+            this->writeNextPacket();
+        }, Qt::QueuedConnection);
+    }
+}
 
-        auto v1_2 = new location::nearby::connections::V1Frame();
-        v1_2->set_type(location::nearby::connections::V1Frame_FrameType_PAYLOAD_TRANSFER);
-        v1_2->set_allocated_payload_transfer(payloadTransfer2);
+void NearbySocket::flushPayloadBatch() {
+    if (d->batchChunks.isEmpty()) return;
 
-        location::nearby::connections::OfflineFrame offlineFrame2;
-        offlineFrame2.set_version(location::nearby::connections::OfflineFrame_Version_V1);
-        offlineFrame2.set_allocated_v1(v1_2);
-        sendPacket(offlineFrame2);
+    QList<QByteArray> ivs;
+    ivs.reserve(d->batchChunks.size());
+    for (auto i = 0; i < d->batchChunks.size(); i++) {
+        ivs.append(Cryptography::randomBytes(d->cryptoSession->ivLength()));
     }
+
+    d->sendPipeline->encode(d->batchChunks, d->batchFirstSequenceNumber, ivs, d->batchData);
+    d->batchChunks.clear();
+    d->batchData.clear();
 }
 
 void NearbySocket::sendPayloadPacket(const google::protobuf::MessageLite& message, qint64 id) {
@@ -703,9 +918,9 @@ bool NearbySocket::active() {
 }
 
 void NearbySocket::sendClientInit() {
-    // Prepare the UKey2 Client Finish
+    // Prepare a UKey2 Client Finish for each handshake cipher we offer
     const auto ecP256PublicKey = new securemessage::EcP256PublicKey();
-    d->clientKey = Cryptography::generateEcdsaKeyPair();
+    d->clientKey = EcKeyPool::instance()->takeKey();
 
     ecP256PublicKey->set_x(Cryptography::ecdsaX(d->clientKey).toStdString());
     ecP256PublicKey->set_y(Cryptography::ecdsaY(d->clientKey).toStdString());
@@ -722,14 +937,26 @@ void NearbySocket::sendClientInit() {
     replyMessage.set_message_data(clientFinished.SerializeAsString());
     d->clientFinishMessage = QByteArray::fromStdString(replyMessage.SerializeAsString());
 
+    d->curve25519Key = Cryptography::generateX25519KeyPair();
+    securegcm::Ukey2ClientFinished curve25519ClientFinished;
+    curve25519ClientFinished.set_public_key(Cryptography::x25519PublicKey(d->curve25519Key).toStdString());
+    replyMessage.set_message_data(curve25519ClientFinished.SerializeAsString());
+    d->curve25519ClientFinishMessage = QByteArray::fromStdString(replyMessage.SerializeAsString());
+
     // Now send the UKey2 Client Init
     securegcm::Ukey2ClientInit clientInit;
     clientInit.set_version(1);
     clientInit.set_random(Cryptography::randomBytes(32).toStdString());
-    clientInit.set_next_protocol("AES_256_CBC-HMAC_SHA256");
+    clientInit.set_next_protocol(CbcNextProtocol);
+    clientInit.add_next_protocols(GcmNextProtocol);
+    clientInit.add_next_protocols(CbcNextProtocol);
+
+    const auto curve25519Commitment = clientInit.add_cipher_commitments();
+    curve25519Commitment->set_handshake_cipher(securegcm::CURVE25519_SHA512);
+    curve25519Commitment->set_commitment(QCryptographicHash::hash(d->curve25519ClientFinishMessage, QCryptographicHash::Sha512).toStdString());
 
     const auto commitment = clientInit.add_cipher_commitments();
-    commitment->set_handshake_cipher(securegcm::P256_SHA512); // TODO: Support Curve25519
+    commitment->set_handshake_cipher(securegcm::P256_SHA512);
     commitment->set_commitment(QCryptographicHash::hash(d->clientFinishMessage, QCryptographicHash::Sha512).toStdString());
 
     securegcm::Ukey2Message initMessage;
@@ -759,8 +986,23 @@ void NearbySocket::sendConnectionRequest() {
     sendPacket(offlineFrame);
 }
 
-void NearbySocket::setupDiffieHellman(const QByteArray& x, const QByteArray& y) {
-    auto dhs = QCryptographicHash::hash(Cryptography::diffieHellman(d->clientKey, x, y), QCryptographicHash::Sha256);
+QByteArray NearbySocket::peerSharedSecret(const QByteArray& peerPublicKey) {
+    if (d->handshakeCipher == securegcm::CURVE25519_SHA512) {
+        // Curve25519 public keys are sent as the raw 32 byte key rather than as a GenericPublicKey
+        return Cryptography::x25519DiffieHellman(d->clientKey, peerPublicKey);
+    }
+
+    securemessage::GenericPublicKey publicKey;
+    if (!publicKey.ParseFromString(peerPublicKey.toStdString()) || publicKey.type() != securemessage::EC_P256) {
+        return {};
+    }
+
+    auto ecp256 = publicKey.ec_p256_public_key();
+    return Cryptography::diffieHellman(d->clientKey, QByteArray::fromStdString(ecp256.x()), QByteArray::fromStdString(ecp256.y()));
+}
+
+void NearbySocket::setupDiffieHellman(const QByteArray& sharedSecret) {
+    auto dhs = QCryptographicHash::hash(sharedSecret, QCryptographicHash::Sha256);
     auto m1 = d->clientInitMessage;
     auto m2 = d->serverInitMessage;
     const auto lAuth = 32;
@@ -773,26 +1015,35 @@ void NearbySocket::setupDiffieHellman(const QByteArray& x, const QByteArray& y)
     d->authString = Cryptography::hkdfExtractExpand("UKEY2 v1 auth", dhs, m1m2, lAuth);
     auto nextSecret = Cryptography::hkdfExtractExpand("UKEY2 v1 next", dhs, m1m2, lNext);
 
-    auto d2dClient = Cryptography::hkdfExtractExpand(QByteArray::fromHex("82AA55A0D397F88346CA1CEE8D3909B95F13FA7DEB1D4AB38376B8256DA85510"), nextSecret, "client", 32);
-    auto d2dServer = Cryptography::hkdfExtractExpand(QByteArray::fromHex("82AA55A0D397F88346CA1CEE8D3909B95F13FA7DEB1D4AB38376B8256DA85510"), nextSecret, "server", 32);
+    // Keys that share a salt and IKM are expanded from a single PRK
+    auto d2dKeys = Cryptography::hkdfExtractExpand(QByteArray::fromHex("82AA55A0D397F88346CA1CEE8D3909B95F13FA7DEB1D4AB38376B8256DA85510"), nextSecret, {"client", "server"}, 32);
+    const auto& d2dClient = d2dKeys.at(0);
+    const auto& d2dServer = d2dKeys.at(1);
 
     auto keySalt = QByteArray::fromHex("BF9D2A53C63616D75DB0A7165B91C1EF73E537F2427405FA23610A4BE657642E");
-    auto clientKey = Cryptography::hkdfExtractExpand(keySalt, d2dClient, "ENC:2", 32);
-    auto clientHmacKey = Cryptography::hkdfExtractExpand(keySalt, d2dClient, "SIG:1", 32);
-    auto serverKey = Cryptography::hkdfExtractExpand(keySalt, d2dServer, "ENC:2", 32);
-    auto serverHmacKey = Cryptography::hkdfExtractExpand(keySalt, d2dServer, "SIG:1", 32);
-
+    auto clientKeys = Cryptography::hkdfExtractExpand(keySalt, d2dClient, {"ENC:2", "SIG:1"}, 32);
+    auto serverKeys = Cryptography::hkdfExtractExpand(keySalt, d2dServer, {"ENC:2", "SIG:1"}, 32);
+    const auto& clientKey = clientKeys.at(0);
+    const auto& clientHmacKey = clientKeys.at(1);
+    const auto& serverKey = serverKeys.at(0);
+    const auto& serverHmacKey = serverKeys.at(1);
+
+    delete d->sendPipeline;
+    delete d->receivePipeline;
+    delete d->cryptoSession;
     if (d->isServer) {
-        d->decryptKey = clientKey;
-        d->receiveHmacKey = clientHmacKey;
-        d->encryptKey = serverKey;
-        d->sendHmacKey = serverHmacKey;
+        d->cryptoSession = new CryptoSession(serverKey, clientKey, serverHmacKey, clientHmacKey, d->nextProtocol);
     } else {
-        d->decryptKey = serverKey;
-        d->receiveHmacKey = serverHmacKey;
-        d->encryptKey = clientKey;
-        d->sendHmacKey = clientHmacKey;
+        d->cryptoSession = new CryptoSession(clientKey, serverKey, clientHmacKey, serverHmacKey, d->nextProtocol);
     }
+
+    // Called on a worker thread
+    d->sendPipeline = new SendPipeline(d->cryptoSession, [this] {
+        QMetaObject::invokeMethod(this, &NearbySocket::writeNextPacket, Qt::QueuedConnection);
+    });
+    d->receivePipeline = new ReceivePipeline(d->cryptoSession, [this] {
+        QMetaObject::invokeMethod(this, &NearbySocket::processReceivedMessages, Qt::QueuedConnection);
+    });
 }
 
 void NearbySocket::sendConnectionResponse() {
@@ -818,21 +1069,133 @@ void NearbySocket::setPeerName(QString peerName) {
     d->peerName = std::move(peerName);
 }
 
+qint64 NearbySocket::payloadBytesInFlight() {
+    return d->payloadBytesInFlight;
+}
+
+bool NearbySocket::isQNearbySharePeer() {
+    // Only QNearbyShare offers GCM, so a session that uses it must be between two instances
+    return d->cryptoSession && d->cryptoSession->cipher() == CryptoSession::Aes256Gcm;
+}
+
+void NearbySocket::enqueuePacket(const QByteArray& packet) {
+    // Anything queued after the batch has to be written after it too
+    if (d->sendPipeline) flushPayloadBatch();
+    d->outgoingSegments.enqueue({});
+
+    // Once the send pipeline exists everything goes through it so that frames are written in sequence number order
+    if (d->sendPipeline) {
+        d->sendPipeline->append(packet);
+    } else {
+        d->pendingPackets.enqueue(packet);
+    }
+}
+
+void NearbySocket::setWriteWatermarks(qint64 lowWatermark, qint64 highWatermark) {
+    d->lowWatermark = lowWatermark;
+    d->highWatermark = qMax(lowWatermark, highWatermark);
+}
+
 void NearbySocket::writeNextPacket() {
-    if (d->pendingWrite != 0) return;
-    if (d->pendingPackets.isEmpty()) {
+    // Keep several frames queued on the socket so the kernel always has the next one to hand when a write drains,
+    // rather than waiting a round trip through the event loop for each one. There is always at least one frame in
+    // flight, so watermarks of zero write one frame at a time.
+    while (d->pendingWrite == 0 || d->pendingWrite < d->highWatermark) {
+        if (d->pendingPackets.isEmpty() && d->sendPipeline && !d->sendPipeline->takeFrames(&d->pendingPackets)) {
+            // The frames that are missing leave a hole in the payload that the peer can't recover from
+            QTextStream(stderr) << "Failed to encrypt payload chunk\n";
+            d->io->close();
+            d->blockWrite = true;
+            return;
+        }
+        if (d->pendingPackets.isEmpty()) break;
+
+        // Gather whatever fits under the high watermark into a single write
+        QList<QByteArray> segments;
+        qint64 size = 0;
+        auto disconnecting = false;
+        while (!d->pendingPackets.isEmpty() && segments.size() < MaxSegmentsPerWrite && (segments.isEmpty() || d->pendingWrite + size < d->highWatermark)) {
+            auto packet = d->pendingPackets.dequeue();
+            auto segment = d->outgoingSegments.dequeue();
+            if (packet.isEmpty()) {
+                // This is a disconnect instruction
+                disconnecting = true;
+                break;
+            }
+            size += packet.length();
+            segments.append(packet);
+
+            d->bytesQueued += packet.length();
+            if (segment.isPayload) d->unsentChunks.enqueue({segment.payloadId, segment.payloadBytes, d->bytesQueued});
+        }
+        this->writeSegments(segments);
+
+        // Everything has been handed to the kernel or copied into the device's buffer by now
+        for (auto& segment : segments) {
+            BufferPool::instance()->recycle(std::move(segment));
+        }
+
+        if (disconnecting) {
+            d->io->close();
+            d->blockWrite = true;
+            return;
+        }
+    }
+
+    // Only ask for more once the queue has drained to the low watermark, and with the send pipeline only once a
+    // lane has room for it
+    if (d->pendingWrite <= d->lowWatermark && (!d->sendPipeline || !d->sendPipeline->isFull())) {
         emit readyForNextPacket();
+    }
+}
+
+void NearbySocket::writeSegments(const QList<QByteArray>& segments) {
+    if (d->blockWrite) {
+        for (const auto& segment : segments) d->pendingWrite += segment.length();
         return;
-    };
+    }
 
-    auto packet = d->pendingPackets.dequeue();
-    if (packet.isEmpty()) {
-        // This is a disconnect instruction
-        d->io->close();
-        d->blockWrite = true;
-    } else {
-        d->pendingWrite += packet.length();
-        if (!d->blockWrite) d->io->write(packet);
+    qint64 written = 0;
+#ifdef Q_OS_UNIX
+    // Hand the segments straight to the kernel in one call, skipping the copy into QTcpSocket's write buffer. That is
+    // only safe while its buffer is empty, or the segments would overtake data still queued there, and never for TLS.
+    auto socket = qobject_cast<QTcpSocket*>(d->io);
+    if (socket && !socket->inherits("QSslSocket") && socket->state() == QAbstractSocket::ConnectedState && socket->bytesToWrite() == 0) {
+        iovec vectors[MaxSegmentsPerWrite];
+        for (auto i = 0; i < segments.size(); i++) {
+            vectors[i].iov_base = const_cast<char*>(segments.at(i).constData());
+            vectors[i].iov_len = segments.at(i).size();
+        }
+
+        msghdr message = {};
+        message.msg_iov = vectors;
+        message.msg_iovlen = segments.size();
+        written = ::sendmsg(socket->socketDescriptor(), &message, MSG_NOSIGNAL);
+
+        // A full send buffer just means everything goes through QTcpSocket. Any other error is left for it to find
+        // and report when it writes the same data.
+        if (written < 0) written = 0;
+        this->countSentBytes(written);
+    }
+#endif
+
+    // Whatever the kernel didn't take is buffered by the device, which reports it with bytesWritten
+    for (const auto& segment : segments) {
+        auto skip = qMin<qint64>(written, segment.size());
+        written -= skip;
+        if (skip == segment.size()) continue;
+
+        d->pendingWrite += segment.size() - skip;
+        d->io->write(segment.constData() + skip, segment.size() - skip);
+    }
+}
+
+void NearbySocket::countSentBytes(qint64 bytes) {
+    d->bytesSent += bytes;
+    while (!d->unsentChunks.isEmpty() && d->unsentChunks.head().end <= d->bytesSent) {
+        auto chunk = d->unsentChunks.dequeue();
+        d->payloadBytesInFlight -= chunk.payloadBytes;
+        emit payloadBytesWritten(chunk.payloadId, chunk.payloadBytes);
     }
 }
 
@@ -850,6 +1213,6 @@ void NearbySocket::disconnect() {
     offlineResponse.set_allocated_v1(v1Response);
     sendPacket(offlineResponse);
 
-    d->pendingPackets.enqueue({});
+    this->enqueuePacket({});
     writeNextPacket();
 }
@@ -26,6 +26,7 @@
 #define QNEARBYSHARE_NEARBYSOCKET_H
 
 #include "nearbypayload.h"
+#include "payloadframeencoder.h"
 #include <QObject>
 #include <google/protobuf/message_lite.h>
 
@@ -44,6 +45,13 @@ class NearbySocket : public QObject {
         void sendPacket(const QByteArray& packet);
         void sendPacket(const google::protobuf::MessageLite& message);
 
+        // Frames are written until this many bytes are waiting to go out, and readyForNextPacket() is emitted once
+        // the socket has drained back down to the low watermark. The defaults sit in the middle of the socket-bench
+        // sweep and have not been checked against its results yet; the README says how to pick them.
+        static constexpr qint64 DefaultLowWatermark = 256 * 1024;
+        static constexpr qint64 DefaultHighWatermark = 1024 * 1024;
+        void setWriteWatermarks(qint64 lowWatermark, qint64 highWatermark);
+
         enum PayloadType {
             Bytes,
             File
@@ -56,6 +64,12 @@ class NearbySocket : public QObject {
 
         void insertPendingPayload(qint64 id, const AbstractNearbyPayloadPtr& payload);
 
+        // Payload body bytes passed to sendPayloadPacket() that the kernel hasn't taken yet
+        qint64 payloadBytesInFlight();
+
+        // Whether the peer is known to be QNearbyShare rather than Android or another implementation
+        bool isQNearbySharePeer();
+
         QByteArray authString();
 
         void setPeerName(QString peerName);
@@ -69,20 +83,30 @@ class NearbySocket : public QObject {
         void errorOccurred();
         void disconnected();
         void readyForNextPacket();
+        void payloadBytesWritten(qint64 id, qint64 bytes);
 
     private:
         NearbySocketPrivate* d;
 
         void readBuffer();
-        void processOfflineFrame(const QByteArray& frame);
-        void processUkey2Frame(const QByteArray& frame);
-        void processSecureFrame(const QByteArray& frame);
+        void processOfflineFrame(QByteArrayView frame);
+        void processUkey2Frame(QByteArrayView frame);
+        void processReceivedMessages();
+        void processSecureMessage(QByteArrayView message);
+        bool findPayloadTransfer(QByteArrayView offlineFrame, QByteArrayView* payloadTransfer);
+        void processPayloadTransfer(QByteArrayView payloadTransfer);
+        void sendPayloadChunks(const QList<PayloadFrameEncoder::Chunk>& chunks, const QByteArray& data);
+        void flushPayloadBatch();
         void sendKeepalive(bool isAck);
 
         void sendConnectionRequest();
-        void setupDiffieHellman(const QByteArray& x, const QByteArray& y);
+        QByteArray peerSharedSecret(const QByteArray& peerPublicKey);
+        void setupDiffieHellman(const QByteArray& sharedSecret);
         void sendConnectionResponse();
+        void enqueuePacket(const QByteArray& packet);
         void writeNextPacket();
+        void writeSegments(const QList<QByteArray>& segments);
+        void countSentBytes(qint64 bytes);
 };
 
 #endif // QNEARBYSHARE_NEARBYSOCKET_H
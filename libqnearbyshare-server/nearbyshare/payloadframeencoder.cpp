@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "payloadframeencoder.h"
+#include "device_to_device_messages.pb.h"
+#include "securegcm.pb.h"
+#include "securemessage.pb.h"
+#include <QtEndian>
+#include <cstring>
+
+#include "bufferpool.h"
+#include "cryptosession.h"
+#include "mappedfile.h"
+#include "wireformat.h"
+
+namespace connections = location::nearby::connections;
+
+namespace {
+    constexpr qsizetype HmacSignatureLength = 32;
+
+    constexpr quint64 wireValue(qint64 value) {
+        // int32 and int64 fields are sign extended to 64 bits on the wire
+        return static_cast<quint64>(value);
+    }
+
+    // A frame with the plaintext written into the space reserved for the ciphertext, waiting to be encrypted.
+    // Positions are kept as offsets so that the frame can be moved around freely.
+    struct PendingFrame {
+            QByteArray frame;
+            CryptoSession::Cipher cipher;
+            qsizetype headerAndBodyOffset;
+            qsizetype headerOffset;
+            qsizetype headerSize;
+            qsizetype bodyOffset;
+            qsizetype plaintextSize;
+            qsizetype bodySize;
+            qsizetype signatureSize;
+
+            // False if the chunk body came from a file that was truncated under its mapping
+            bool bodyCopied;
+
+            char* body() {
+                return frame.data() + bodyOffset;
+            }
+
+            QByteArrayView header() const {
+                return QByteArrayView(frame.constData() + headerOffset, headerSize);
+            }
+
+            // Where the GCM tag goes, after the signature field's tag and length
+            char* tag() {
+                return frame.data() + frame.size() - signatureSize;
+            }
+    };
+
+    PendingFrame prepare(const PayloadFrameEncoder::Chunk& chunk, qint32 sequenceNumber, QByteArrayView iv, CryptoSession::Cipher cipher) {
+        using namespace WireFormat;
+        using PayloadHeader = connections::PayloadTransferFrame_PayloadHeader;
+        using PayloadChunk = connections::PayloadTransferFrame_PayloadChunk;
+
+        // Work out the size of every nested message from the inside out
+        auto payloadHeaderSize = varintFieldSize<PayloadHeader::kIdFieldNumber>(wireValue(chunk.id)) +
+                                 varintFieldSize<PayloadHeader::kTypeFieldNumber>(chunk.payloadType) +
+                                 varintFieldSize<PayloadHeader::kTotalSizeFieldNumber>(wireValue(chunk.totalSize)) +
+                                 varintFieldSize<PayloadHeader::kIsSensitiveFieldNumber>(false);
+        auto payloadChunkSize = varintFieldSize<PayloadChunk::kFlagsFieldNumber>(wireValue(chunk.flags)) +
+                                varintFieldSize<PayloadChunk::kOffsetFieldNumber>(wireValue(chunk.offset)) +
+                                lengthDelimitedFieldSize<PayloadChunk::kBodyFieldNumber>(chunk.body.size());
+        auto payloadTransferSize = varintFieldSize<connections::PayloadTransferFrame::kPacketTypeFieldNumber>(connections::PayloadTransferFrame_PacketType_DATA) +
+                                   lengthDelimitedFieldSize<connections::PayloadTransferFrame::kPayloadHeaderFieldNumber>(payloadHeaderSize) +
+                                   lengthDelimitedFieldSize<connections::PayloadTransferFrame::kPayloadChunkFieldNumber>(payloadChunkSize);
+        auto v1Size = varintFieldSize<connections::V1Frame::kTypeFieldNumber>(connections::V1Frame_FrameType_PAYLOAD_TRANSFER) +
+                      lengthDelimitedFieldSize<connections::V1Frame::kPayloadTransferFieldNumber>(payloadTransferSize);
+        auto offlineFrameSize = varintFieldSize<connections::OfflineFrame::kVersionFieldNumber>(connections::OfflineFrame_Version_V1) +
+                                lengthDelimitedFieldSize<connections::OfflineFrame::kV1FieldNumber>(v1Size);
+        auto d2dmSize = lengthDelimitedFieldSize<securegcm::DeviceToDeviceMessage::kMessageFieldNumber>(offlineFrameSize) +
+                        varintFieldSize<securegcm::DeviceToDeviceMessage::kSequenceNumberFieldNumber>(wireValue(sequenceNumber));
+
+        // PKCS#7 padding always adds between 1 and 16 bytes, GCM doesn't pad and signs with its tag instead
+        auto isGcm = cipher == CryptoSession::Aes256Gcm;
+        auto bodySize = isGcm ? d2dmSize : (d2dmSize / 16 + 1) * 16;
+        auto signatureSize = isGcm ? Cryptography::Aes256GcmTagLength : HmacSignatureLength;
+        auto signatureScheme = isGcm ? securemessage::AEAD_TAG : securemessage::HMAC_SHA256;
+        auto encryptionScheme = isGcm ? securemessage::AES_256_GCM : securemessage::AES_256_CBC;
+
+        auto metadataSize = varintFieldSize<securegcm::GcmMetadata::kTypeFieldNumber>(securegcm::DEVICE_TO_DEVICE_MESSAGE) +
+                            varintFieldSize<securegcm::GcmMetadata::kVersionFieldNumber>(1);
+        auto headerSize = varintFieldSize<securemessage::Header::kSignatureSchemeFieldNumber>(signatureScheme) +
+                          varintFieldSize<securemessage::Header::kEncryptionSchemeFieldNumber>(encryptionScheme) +
+                          lengthDelimitedFieldSize<securemessage::Header::kIvFieldNumber>(iv.size()) +
+                          lengthDelimitedFieldSize<securemessage::Header::kPublicMetadataFieldNumber>(metadataSize);
+        auto headerAndBodySize = lengthDelimitedFieldSize<securemessage::HeaderAndBody::kHeaderFieldNumber>(headerSize) +
+                                 lengthDelimitedFieldSize<securemessage::HeaderAndBody::kBodyFieldNumber>(bodySize);
+        auto secureMessageSize = lengthDelimitedFieldSize<securemessage::SecureMessage::kHeaderAndBodyFieldNumber>(headerAndBodySize) +
+                                 lengthDelimitedFieldSize<securemessage::SecureMessage::kSignatureFieldNumber>(signatureSize);
+
+        auto frame = BufferPool::instance()->take(4 + secureMessageSize);
+        auto out = frame.data();
+
+        qToBigEndian<quint32>(secureMessageSize, out);
+        out += 4;
+        out = writeLengthDelimitedHeader<securemessage::SecureMessage::kHeaderAndBodyFieldNumber>(out, headerAndBodySize);
+
+        // Everything from here up to the signature is covered by the HMAC; GCM covers the header as associated data
+        auto headerAndBody = out;
+        out = writeLengthDelimitedHeader<securemessage::HeaderAndBody::kHeaderFieldNumber>(out, headerSize);
+        auto header = out;
+        out = writeVarintField<securemessage::Header::kSignatureSchemeFieldNumber>(out, signatureScheme);
+        out = writeVarintField<securemessage::Header::kEncryptionSchemeFieldNumber>(out, encryptionScheme);
+        out = writeBytesField<securemessage::Header::kIvFieldNumber>(out, iv);
+        out = writeLengthDelimitedHeader<securemessage::Header::kPublicMetadataFieldNumber>(out, metadataSize);
+        out = writeVarintField<securegcm::GcmMetadata::kTypeFieldNumber>(out, securegcm::DEVICE_TO_DEVICE_MESSAGE);
+        out = writeVarintField<securegcm::GcmMetadata::kVersionFieldNumber>(out, 1);
+        out = writeLengthDelimitedHeader<securemessage::HeaderAndBody::kBodyFieldNumber>(out, bodySize);
+
+        // Write the plaintext into the space reserved for the ciphertext
+        auto body = out;
+        out = writeLengthDelimitedHeader<securegcm::DeviceToDeviceMessage::kMessageFieldNumber>(out, offlineFrameSize);
+        out = writeVarintField<connections::OfflineFrame::kVersionFieldNumber>(out, connections::OfflineFrame_Version_V1);
+        out = writeLengthDelimitedHeader<connections::OfflineFrame::kV1FieldNumber>(out, v1Size);
+        out = writeVarintField<connections::V1Frame::kTypeFieldNumber>(out, connections::V1Frame_FrameType_PAYLOAD_TRANSFER);
+        out = writeLengthDelimitedHeader<connections::V1Frame::kPayloadTransferFieldNumber>(out, payloadTransferSize);
+        out = writeVarintField<connections::PayloadTransferFrame::kPacketTypeFieldNumber>(out, connections::PayloadTransferFrame_PacketType_DATA);
+        out = writeLengthDelimitedHeader<connections::PayloadTransferFrame::kPayloadHeaderFieldNumber>(out, payloadHeaderSize);
+        out = writeVarintField<PayloadHeader::kIdFieldNumber>(out, wireValue(chunk.id));
+        out = writeVarintField<PayloadHeader::kTypeFieldNumber>(out, chunk.payloadType);
+        out = writeVarintField<PayloadHeader::kTotalSizeFieldNumber>(out, wireValue(chunk.totalSize));
+        out = writeVarintField<PayloadHeader::kIsSensitiveFieldNumber>(out, false);
+        out = writeLengthDelimitedHeader<connections::PayloadTransferFrame::kPayloadChunkFieldNumber>(out, payloadChunkSize);
+        out = writeVarintField<PayloadChunk::kFlagsFieldNumber>(out, wireValue(chunk.flags));
+        out = writeVarintField<PayloadChunk::kOffsetFieldNumber>(out, wireValue(chunk.offset));
+        // The body may point into a mapping of a file that has been truncated since it was read
+        out = writeLengthDelimitedHeader<PayloadChunk::kBodyFieldNumber>(out, chunk.body.size());
+        auto bodyCopied = MappedFile::copy(out, chunk.body);
+        out += chunk.body.size();
+        out = writeVarintField<securegcm::DeviceToDeviceMessage::kSequenceNumberFieldNumber>(out, wireValue(sequenceNumber));
+        Q_ASSERT(out - body == d2dmSize);
+
+        PendingFrame pending;
+        pending.bodyCopied = bodyCopied;
+        pending.cipher = cipher;
+        pending.headerAndBodyOffset = headerAndBody - frame.constData();
+        pending.headerOffset = header - frame.constData();
+        pending.headerSize = headerSize;
+        pending.bodyOffset = body - frame.constData();
+        pending.plaintextSize = d2dmSize;
+        pending.bodySize = bodySize;
+        pending.signatureSize = signatureSize;
+        pending.frame = std::move(frame);
+        return pending;
+    }
+
+    qsizetype encrypt(PendingFrame* pending, QByteArrayView iv, CryptoSession* session) {
+        // The plaintext is encrypted in place, and GCM writes its tag straight into the signature field
+        if (pending->cipher == CryptoSession::Aes256Gcm) {
+            return session->encrypt(pending->body(), pending->plaintextSize, pending->body(), iv, pending->header(), pending->tag());
+        }
+        return session->encrypt(pending->body(), pending->plaintextSize, pending->body(), iv);
+    }
+
+    // Writes the signature field's tag and length after the ciphertext. GCM frames are complete after this; CBC frames
+    // still need their HMAC written into the field.
+    bool seal(PendingFrame* pending, qsizetype encryptedSize) {
+        if (encryptedSize != pending->bodySize) {
+            return false;
+        }
+
+        auto out = pending->body() + pending->bodySize;
+        out = WireFormat::writeLengthDelimitedHeader<securemessage::SecureMessage::kSignatureFieldNumber>(out, pending->signatureSize);
+        Q_ASSERT(out == pending->tag());
+        return true;
+    }
+
+    // The header and the ciphertext sit next to each other, so the HMAC covers them in one go
+    HmacSha256Job signatureJob(PendingFrame* pending) {
+        auto end = pending->body() + pending->bodySize;
+        auto signedData = pending->frame.constData() + pending->headerAndBodyOffset;
+        return {signedData, end - signedData, pending->tag()};
+    }
+
+    bool finish(PendingFrame* pending, qsizetype encryptedSize, CryptoSession* session) {
+        if (!seal(pending, encryptedSize)) {
+            return false;
+        }
+        if (pending->cipher == CryptoSession::Aes256Gcm) {
+            return true;
+        }
+
+        auto job = signatureJob(pending);
+        auto signature = Cryptography::hmacSha256Signature(QByteArrayView(job.input, job.length), session->sendHmacKey());
+        std::memcpy(job.output, signature.constData(), signature.size());
+        return true;
+    }
+} // namespace
+
+QByteArray PayloadFrameEncoder::encode(const Chunk& chunk, qint32 sequenceNumber, const QByteArray& iv, CryptoSession* session) {
+    auto pending = prepare(chunk, sequenceNumber, iv, session->cipher());
+    if (!pending.bodyCopied || !finish(&pending, encrypt(&pending, iv, session), session)) {
+        return {};
+    }
+    return pending.frame;
+}
+
+QList<QByteArray> PayloadFrameEncoder::encode(const QList<Chunk>& chunks, qint32 firstSequenceNumber, const QList<QByteArray>& ivs, CryptoSession* session) {
+    Q_ASSERT(chunks.size() == ivs.size());
+
+    QList<PendingFrame> pending;
+    pending.reserve(chunks.size());
+    for (auto i = 0; i < chunks.size(); i++) {
+        pending.append(prepare(chunks.at(i), firstSequenceNumber + i, ivs.at(i), session->cipher()));
+        if (!pending.last().bodyCopied) return {};
+    }
+
+    QList<QByteArray> frames;
+    frames.reserve(chunks.size());
+    if (session->cipher() == CryptoSession::Aes256Gcm) {
+        // GCM has no chaining between blocks, so the engine already keeps the AES units busy within a single frame
+        for (auto i = 0; i < pending.size(); i++) {
+            if (!finish(&pending[i], encrypt(&pending[i], ivs.at(i), session), session)) {
+                return {};
+            }
+            frames.append(pending.at(i).frame);
+        }
+        return frames;
+    }
+
+    QList<Aes256CbcJob> jobs;
+    jobs.reserve(chunks.size());
+    for (auto i = 0; i < pending.size(); i++) {
+        Aes256CbcJob job;
+        job.input = pending[i].body();
+        job.length = pending.at(i).plaintextSize;
+        job.output = pending[i].body();
+        job.iv = ivs.at(i);
+        jobs.append(job);
+    }
+
+    // Every frame has its own IV, so they can all be encrypted together
+    session->encryptBatch(jobs.data(), jobs.size());
+
+    QList<HmacSha256Job> signatureJobs;
+    signatureJobs.reserve(chunks.size());
+    for (auto i = 0; i < pending.size(); i++) {
+        if (!seal(&pending[i], jobs.at(i).written)) {
+            return {};
+        }
+        signatureJobs.append(signatureJob(&pending[i]));
+    }
+
+    // And signed together, which hashes them side by side where that is faster
+    session->signBatch(signatureJobs.data(), signatureJobs.size());
+
+    for (auto i = 0; i < pending.size(); i++) frames.append(pending.at(i).frame);
+    return frames;
+}
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_PAYLOADFRAMEENCODER_H
+#define QNEARBYSHARE_PAYLOADFRAMEENCODER_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QList>
+
+#include "offline_wire_formats.pb.h"
+
+class CryptoSession;
+
+// Builds complete, encrypted PAYLOAD_TRANSFER frames in a single pass.
+//
+// The generic send path serializes the OfflineFrame, DeviceToDeviceMessage, HeaderAndBody and SecureMessage one
+// after the other, copying the chunk body at every level. Here the size of every nested message is known from the
+// chunk length alone, so the whole frame (including the length prefix) is allocated once, the plaintext is written
+// directly into the space reserved for the ciphertext and encrypted in place, and the header and ciphertext are
+// signed in one pass. The output is byte for byte what the generic path produces. For GCM sessions the header is the
+// associated data and the tag is written straight into the signature field.
+namespace PayloadFrameEncoder {
+    struct Chunk {
+            qint64 id;
+            location::nearby::connections::PayloadTransferFrame_PayloadHeader_PayloadType payloadType;
+            qint64 totalSize;
+            qint64 offset;
+            qint32 flags;
+            QByteArrayView body;
+    };
+
+    // Returns the length prefixed frame ready to be written to the socket, or an empty array if encryption failed
+    QByteArray encode(const Chunk& chunk, qint32 sequenceNumber, const QByteArray& iv, CryptoSession* session);
+
+    // Encodes consecutive chunks (numbered from firstSequenceNumber) and encrypts them all in one batch, which is much
+    // faster than encoding them one at a time. Returns an empty list if encryption failed.
+    QList<QByteArray> encode(const QList<Chunk>& chunks, qint32 firstSequenceNumber, const QList<QByteArray>& ivs, CryptoSession* session);
+} // namespace PayloadFrameEncoder
+
+#endif // QNEARBYSHARE_PAYLOADFRAMEENCODER_H
@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "receivepipeline.h"
+#include "bufferpool.h"
+#include "cryptosession.h"
+#include "device_to_device_messages.pb.h"
+#include "securemessage.pb.h"
+#include "wireformat.h"
+#include "workerlanes.h"
+#include <QList>
+#include <QMap>
+#include <cstring>
+
+using ReceiveLanes = WorkerLanes<QByteArray, ReceivePipeline::Message>;
+
+struct ReceivePipelinePrivate {
+        // One copy of the session keys per lane
+        QList<CryptoSession*> sessions;
+        ReceiveLanes* lanes;
+
+        // Only used on the socket's thread: decrypted messages waiting for a lower sequence number, and the sequence
+        // number that is due next. Nearby numbers each direction from 1.
+        QMap<qint32, ReceivePipeline::Message> waiting;
+        qint64 nextSequenceNumber = 1;
+};
+
+ReceivePipeline::ReceivePipeline(CryptoSession* session, std::function<void()> messagesReady, int lanes) {
+    d = new ReceivePipelinePrivate();
+    for (auto i = 0; i < qBound(1, lanes, MaxLanes); i++) {
+        d->sessions.append(session->clone());
+    }
+    d->lanes = new ReceiveLanes(
+        d->sessions.size(), FramesPerLane, [this](int lane, QByteArray& frame) {
+            Message message;
+            message.error = open(frame, d->sessions.at(lane), &message);
+            BufferPool::instance()->recycle(std::move(frame));
+            return message;
+        },
+        std::move(messagesReady));
+}
+
+ReceivePipeline::~ReceivePipeline() {
+    // Waits for the lanes to stop before their sessions go away
+    delete d->lanes;
+    qDeleteAll(d->sessions);
+    delete d;
+}
+
+int ReceivePipeline::defaultLanes() {
+    return ReceiveLanes::defaultLanes("QNEARBYSHARE_RECEIVE_LANES", MaxLanes);
+}
+
+bool ReceivePipeline::submit(QByteArrayView frame) {
+    if (d->lanes->isFull()) return false;
+
+    auto copy = BufferPool::instance()->take(frame.size());
+    std::memcpy(copy.data(), frame.data(), frame.size());
+    auto submitted = d->lanes->submit(std::move(copy));
+    Q_ASSERT(submitted);
+    return true;
+}
+
+void ReceivePipeline::takeMessages(QQueue<Message>* messages) {
+    Message message;
+    while (d->lanes->takeNext(&message)) {
+        if (message.error == NoError && (message.sequenceNumber < d->nextSequenceNumber || d->waiting.contains(message.sequenceNumber))) {
+            // Replayed, or numbered backwards
+            message.error = BadSequenceNumber;
+        }
+
+        if (message.error == NoError) {
+            d->waiting.insert(message.sequenceNumber, std::move(message));
+        } else {
+            messages->enqueue(std::move(message));
+        }
+    }
+
+    while (!d->waiting.isEmpty()) {
+        auto sequenceNumber = d->waiting.firstKey();
+        if (sequenceNumber != d->nextSequenceNumber) {
+            // A gap can only be filled by a frame that is still on a lane. Once there are none left the peer has
+            // skipped a number, which means frames were dropped or injected, so fail everything that was waiting.
+            if (!d->lanes->isEmpty()) break;
+            while (!d->waiting.isEmpty()) {
+                auto message = d->waiting.take(d->waiting.firstKey());
+                message.error = BadSequenceNumber;
+                messages->enqueue(std::move(message));
+            }
+            break;
+        }
+
+        d->nextSequenceNumber++;
+        messages->enqueue(d->waiting.take(sequenceNumber));
+    }
+}
+
+bool ReceivePipeline::isFull() {
+    return d->lanes->isFull();
+}
+
+bool ReceivePipeline::isEmpty() {
+    return d->lanes->isEmpty() && d->waiting.isEmpty();
+}
+
+int ReceivePipeline::lanes() {
+    return d->lanes->laneCount();
+}
+
+ReceivePipeline::Error ReceivePipeline::open(QByteArrayView frame, CryptoSession* session, Message* message) {
+    // Only the varint fields of the header are needed, so nothing here goes through protobuf
+    QByteArrayView headerAndBodyBytes;
+    QByteArrayView signature;
+    if (!WireFormat::findBytes(frame, securemessage::SecureMessage::kHeaderAndBodyFieldNumber, &headerAndBodyBytes)) return Malformed;
+    if (!WireFormat::findBytes(frame, securemessage::SecureMessage::kSignatureFieldNumber, &signature)) return Malformed;
+
+    // GCM frames are authenticated while they are decrypted
+    auto isGcm = session->cipher() == CryptoSession::Aes256Gcm;
+    if (!isGcm && !session->verify(headerAndBodyBytes, signature)) return BadSignature;
+
+    QByteArrayView headerBytes;
+    QByteArrayView body;
+    if (!WireFormat::findBytes(headerAndBodyBytes, securemessage::HeaderAndBody::kHeaderFieldNumber, &headerBytes)) return Malformed;
+    if (!WireFormat::findBytes(headerAndBodyBytes, securemessage::HeaderAndBody::kBodyFieldNumber, &body)) return Malformed;
+
+    quint64 encryptionScheme = 0;
+    quint64 signatureScheme = 0;
+    QByteArrayView iv;
+    WireFormat::Reader headerReader(headerBytes);
+    while (headerReader.next()) {
+        switch (headerReader.fieldNumber()) {
+            case securemessage::Header::kSignatureSchemeFieldNumber:
+                signatureScheme = headerReader.varint();
+                break;
+            case securemessage::Header::kEncryptionSchemeFieldNumber:
+                encryptionScheme = headerReader.varint();
+                break;
+            case securemessage::Header::kIvFieldNumber:
+                iv = headerReader.bytes();
+                break;
+        }
+    }
+    if (headerReader.error()) return Malformed;
+
+    // Only accept the scheme that was negotiated, so frames can't be downgraded to the other one
+    if (encryptionScheme != (isGcm ? securemessage::AES_256_GCM : securemessage::AES_256_CBC)) return BadEncryptionScheme;
+    if (signatureScheme != (isGcm ? securemessage::AEAD_TAG : securemessage::HMAC_SHA256)) return BadSignatureScheme;
+
+    // The ciphers read a whole IV from wherever this points, whatever length the peer sent
+    if (iv.size() != session->ivLength()) return Malformed;
+
+    message->decrypted = BufferPool::instance()->take(body.size() + 16);
+    qsizetype decryptedLength;
+    if (isGcm) {
+        decryptedLength = session->decrypt(body.data(), body.size(), message->decrypted.data(), iv, headerBytes, signature);
+        if (decryptedLength < 0) return BadSignature;
+    } else {
+        decryptedLength = session->decrypt(body.data(), body.size(), message->decrypted.data(), iv);
+    }
+    if (decryptedLength <= 0) return Undecryptable;
+    message->decrypted.truncate(decryptedLength);
+
+    quint64 sequenceNumber = 0;
+    auto hasMessage = false;
+    WireFormat::Reader d2dReader(message->decrypted);
+    while (d2dReader.next()) {
+        switch (d2dReader.fieldNumber()) {
+            case securegcm::DeviceToDeviceMessage::kMessageFieldNumber:
+                message->message = d2dReader.bytes();
+                hasMessage = true;
+                break;
+            case securegcm::DeviceToDeviceMessage::kSequenceNumberFieldNumber:
+                sequenceNumber = d2dReader.varint();
+                break;
+        }
+    }
+    if (d2dReader.error() || !hasMessage) return Malformed;
+
+    message->sequenceNumber = static_cast<qint32>(sequenceNumber);
+    return NoError;
+}
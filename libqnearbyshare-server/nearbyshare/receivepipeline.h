@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_RECEIVEPIPELINE_H
+#define QNEARBYSHARE_RECEIVEPIPELINE_H
+
+#include <QByteArray>
+#include <QByteArrayView>
+#include <QQueue>
+#include <functional>
+
+class CryptoSession;
+struct ReceivePipelinePrivate;
+
+// Verifies and decrypts incoming secure frames on worker threads, so the thread that owns the socket only has to
+// act on the decrypted messages.
+//
+// Frames run on WorkerLanes, each lane with its own copy of the session keys, and come back in the order they were
+// submitted. Decrypted messages are then held back until every lower DeviceToDeviceMessage sequence number has been
+// handed out. A number that never turns up once every lane is idle fails the messages after it with
+// BadSequenceNumber. Each lane only takes FramesPerLane frames at a time; once they are all full the socket stops
+// reading, which leaves the data in the kernel and lets TCP flow control slow the peer down.
+//
+// The number of lanes defaults to one less than the number of cores (at most MaxLanes), and can be overridden
+// with the QNEARBYSHARE_RECEIVE_LANES environment variable.
+class ReceivePipeline {
+    public:
+        enum Error {
+            NoError,
+            Malformed,
+            BadSignature,
+            BadEncryptionScheme,
+            BadSignatureScheme,
+            Undecryptable,
+            BadSequenceNumber
+        };
+
+        struct Message {
+                Error error = NoError;
+                qint32 sequenceNumber = 0;
+
+                // The decrypted DeviceToDeviceMessage, and its message field as a view into it
+                QByteArray decrypted;
+                QByteArrayView message;
+        };
+
+        // messagesReady is called from a worker thread when decrypted messages are waiting. It isn't called again
+        // until takeMessages() has been called, so it can simply post an event to the socket's thread.
+        ReceivePipeline(CryptoSession* session, std::function<void()> messagesReady, int lanes = defaultLanes());
+        ~ReceivePipeline();
+
+        ReceivePipeline(const ReceivePipeline&) = delete;
+        ReceivePipeline& operator=(const ReceivePipeline&) = delete;
+
+        static constexpr int MaxLanes = 8;
+        static constexpr int FramesPerLane = 4;
+        static int defaultLanes();
+
+        // Copies the frame to the next lane with room. Returns false, without taking the frame, if every lane is full.
+        bool submit(QByteArrayView frame);
+
+        // Moves every message that is next in sequence number order to the end of messages. Frames that failed are
+        // moved as soon as they are taken, since they have no sequence number to wait for. A gap in the numbers is
+        // reported as BadSequenceNumber rather than skipped.
+        void takeMessages(QQueue<Message>* messages);
+
+        bool isFull();
+        bool isEmpty();
+        int lanes();
+
+        // What each lane does to a frame
+        static Error open(QByteArrayView frame, CryptoSession* session, Message* message);
+
+    private:
+        ReceivePipelinePrivate* d;
+};
+
+#endif // QNEARBYSHARE_RECEIVEPIPELINE_H
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "sendpipeline.h"
+#include "cryptosession.h"
+#include "workerlanes.h"
+
+namespace {
+    // Entries in SendPipelinePrivate::order
+    enum class Entry {
+        LaneJob,
+        ReadyFrame,
+        FailedJob
+    };
+
+    struct Job {
+            QList<PayloadFrameEncoder::Chunk> chunks;
+            qint32 firstSequenceNumber;
+            QList<QByteArray> ivs;
+            QList<QByteArray> data;
+    };
+
+    using SendLanes = WorkerLanes<Job, QList<QByteArray>>;
+} // namespace
+
+struct SendPipelinePrivate {
+        // One copy of the session keys per lane
+        QList<CryptoSession*> sessions;
+        SendLanes* lanes;
+
+        // Only used on the socket's thread: where each submitted job or frame went, in submission order. LaneJob for
+        // a job whose frames come from the lanes, ReadyFrame for a frame waiting in readyFrames or FailedJob for a job
+        // encoded inline that failed.
+        QQueue<Entry> order;
+        QQueue<QByteArray> readyFrames;
+
+        // The session of the pipeline's owner, used when every lane is busy
+        CryptoSession* session;
+};
+
+SendPipeline::SendPipeline(CryptoSession* session, std::function<void()> framesReady, int lanes) {
+    d = new SendPipelinePrivate();
+    d->session = session;
+    for (auto i = 0; i < qBound(1, lanes, MaxLanes); i++) {
+        d->sessions.append(session->clone());
+    }
+    d->lanes = new SendLanes(
+        d->sessions.size(), JobsPerLane, [this](int lane, Job& job) {
+            return PayloadFrameEncoder::encode(job.chunks, job.firstSequenceNumber, job.ivs, d->sessions.at(lane));
+        },
+        std::move(framesReady));
+}
+
+SendPipeline::~SendPipeline() {
+    // Waits for the lanes to stop before their sessions go away
+    delete d->lanes;
+    qDeleteAll(d->sessions);
+    delete d;
+}
+
+int SendPipeline::defaultLanes() {
+    return SendLanes::defaultLanes("QNEARBYSHARE_SEND_LANES", MaxLanes);
+}
+
+void SendPipeline::encode(const QList<PayloadFrameEncoder::Chunk>& chunks, qint32 firstSequenceNumber, const QList<QByteArray>& ivs, const QList<QByteArray>& data) {
+    Job job{chunks, firstSequenceNumber, ivs, data};
+    if (d->lanes->submit(std::move(job))) {
+        d->order.enqueue(Entry::LaneJob);
+        return;
+    }
+
+    // Every lane is busy, so there is no point queueing behind them
+    auto frames = PayloadFrameEncoder::encode(chunks, firstSequenceNumber, ivs, d->session);
+    if (frames.isEmpty()) {
+        // Report the failure in order, the same way a lane does
+        d->order.enqueue(Entry::FailedJob);
+        return;
+    }
+    for (const auto& frame : frames) append(frame);
+}
+
+void SendPipeline::append(const QByteArray& frame) {
+    d->order.enqueue(Entry::ReadyFrame);
+    d->readyFrames.enqueue(frame);
+}
+
+bool SendPipeline::takeFrames(QQueue<QByteArray>* frames) {
+    auto success = true;
+    while (!d->order.isEmpty()) {
+        auto entry = d->order.head();
+        if (entry == Entry::ReadyFrame) {
+            frames->enqueue(d->readyFrames.dequeue());
+        } else if (entry == Entry::FailedJob) {
+            success = false;
+        } else {
+            QList<QByteArray> result;
+            if (!d->lanes->takeNext(&result)) break;
+
+            if (result.isEmpty()) success = false;
+            for (const auto& frame : result) frames->enqueue(frame);
+        }
+        d->order.dequeue();
+    }
+    return success;
+}
+
+bool SendPipeline::isFull() {
+    return d->lanes->isFull();
+}
+
+bool SendPipeline::isEmpty() {
+    return d->order.isEmpty();
+}
+
+int SendPipeline::lanes() {
+    return d->lanes->laneCount();
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_SENDPIPELINE_H
+#define QNEARBYSHARE_SENDPIPELINE_H
+
+#include <QByteArray>
+#include <QList>
+#include <QQueue>
+#include <functional>
+
+#include "payloadframeencoder.h"
+
+class CryptoSession;
+struct SendPipelinePrivate;
+
+// Encodes, encrypts and signs outgoing payload frames on worker threads, so the thread that owns the socket only
+// has to write finished frames.
+//
+// Jobs run on WorkerLanes, each lane with its own copy of the session keys, so frames always come out of
+// takeFrames() in the order they were submitted (and so in sequence number order), no matter which lane finishes
+// first. Frames that are already finished, such as control frames encrypted on the socket's thread, are slotted into
+// the same order with append().
+//
+// The number of lanes defaults to one less than the number of cores (at most MaxLanes), and can be overridden
+// with the QNEARBYSHARE_SEND_LANES environment variable.
+class SendPipeline {
+    public:
+        // framesReady is called from a worker thread when finished frames are waiting. It isn't called again until
+        // takeFrames() has been called, so it can simply post an event to the socket's thread.
+        SendPipeline(CryptoSession* session, std::function<void()> framesReady, int lanes = defaultLanes());
+        ~SendPipeline();
+
+        SendPipeline(const SendPipeline&) = delete;
+        SendPipeline& operator=(const SendPipeline&) = delete;
+
+        static constexpr int MaxLanes = 8;
+        static constexpr int JobsPerLane = 2;
+        static int defaultLanes();
+
+        // The chunk bodies must point into the buffers in data, which the pipeline holds on to until the job is done.
+        // If every lane is already full the chunks are encoded on the calling thread instead.
+        void encode(const QList<PayloadFrameEncoder::Chunk>& chunks, qint32 firstSequenceNumber, const QList<QByteArray>& ivs, const QList<QByteArray>& data);
+        void append(const QByteArray& frame);
+
+        // Moves every frame that is ready, in order, to the end of frames. Returns false if a job failed to encrypt.
+        bool takeFrames(QQueue<QByteArray>* frames);
+
+        // Whether every lane has as much work queued as it takes; further jobs would be encoded inline
+        bool isFull();
+        bool isEmpty();
+        int lanes();
+
+    private:
+        SendPipelinePrivate* d;
+};
+
+#endif // QNEARBYSHARE_SENDPIPELINE_H
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_SPSCQUEUE_H
+#define QNEARBYSHARE_SPSCQUEUE_H
+
+#include <QtGlobal>
+#include <atomic>
+#include <memory>
+
+// A bounded, lock free queue between exactly one producer thread and exactly one consumer thread.
+//
+// Only the producer writes the tail index and only the consumer writes the head index, so neither side ever waits
+// for the other. Each side also keeps its own copy of the other side's index and only reloads it when the queue
+// looks full (or empty), which keeps the two cache lines from bouncing between cores on every operation.
+template<typename T> class SpscQueue {
+    public:
+        explicit SpscQueue(qsizetype capacity) :
+            capacity(capacity) {
+            // Round up to a power of two so the index into the buffer is a mask rather than a division
+            qsizetype bufferSize = 1;
+            while (bufferSize < capacity) bufferSize *= 2;
+            buffer = std::make_unique<T[]>(bufferSize);
+            mask = bufferSize - 1;
+        }
+
+        SpscQueue(const SpscQueue&) = delete;
+        SpscQueue& operator=(const SpscQueue&) = delete;
+
+        // Producer only. Returns false, leaving value untouched, if the queue is full.
+        bool push(T&& value) {
+            auto tailIndex = tail.load(std::memory_order_relaxed);
+            if (tailIndex - cachedHead == capacity) {
+                cachedHead = head.load(std::memory_order_acquire);
+                if (tailIndex - cachedHead == capacity) return false;
+            }
+
+            buffer[tailIndex & mask] = std::move(value);
+            tail.store(tailIndex + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Consumer only. Returns false if the queue is empty.
+        bool pop(T* value) {
+            auto headIndex = head.load(std::memory_order_relaxed);
+            if (headIndex == cachedTail) {
+                cachedTail = tail.load(std::memory_order_acquire);
+                if (headIndex == cachedTail) return false;
+            }
+
+            *value = std::move(buffer[headIndex & mask]);
+            head.store(headIndex + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool isEmpty() const {
+            return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+        }
+
+    private:
+        static constexpr qsizetype CacheLineSize = 64;
+
+        std::unique_ptr<T[]> buffer;
+        qsizetype capacity;
+        qsizetype mask;
+
+        // Both indices count up forever; the position in the buffer is the index masked to the size of the buffer
+        alignas(CacheLineSize) std::atomic<qsizetype> head = 0;
+        qsizetype cachedTail = 0;
+
+        alignas(CacheLineSize) std::atomic<qsizetype> tail = 0;
+        qsizetype cachedHead = 0;
+};
+
+#endif // QNEARBYSHARE_SPSCQUEUE_H
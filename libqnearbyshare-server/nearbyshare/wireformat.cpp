@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "wireformat.h"
+
+WireFormat::Reader::Reader(QByteArrayView message) :
+    message(message) {
+}
+
+bool WireFormat::Reader::next() {
+    if (hasError || pos >= message.size()) return false;
+
+    quint64 tag;
+    if (!readVarint(&tag) || (tag >> 3) == 0 || (tag >> 3) > 536870911) {
+        hasError = true;
+        return false;
+    }
+
+    currentFieldNumber = static_cast<int>(tag >> 3);
+    currentWireType = static_cast<WireType>(tag & 0x7);
+    currentVarint = 0;
+    currentBytes = {};
+
+    switch (currentWireType) {
+        case Varint:
+            if (!readVarint(&currentVarint)) {
+                hasError = true;
+                return false;
+            }
+            return true;
+        case Fixed64:
+        case Fixed32:
+            {
+                qsizetype length = currentWireType == Fixed64 ? 8 : 4;
+                if (message.size() - pos < length) {
+                    hasError = true;
+                    return false;
+                }
+                pos += length;
+                return true;
+            }
+        case LengthDelimited:
+            {
+                quint64 length;
+                if (!readVarint(&length) || length > static_cast<quint64>(message.size() - pos)) {
+                    hasError = true;
+                    return false;
+                }
+                currentBytes = message.sliced(pos, static_cast<qsizetype>(length));
+                pos += static_cast<qsizetype>(length);
+                return true;
+            }
+    }
+
+    // Groups are not used by any of the messages we read
+    hasError = true;
+    return false;
+}
+
+bool WireFormat::Reader::error() {
+    return hasError;
+}
+
+int WireFormat::Reader::fieldNumber() {
+    return currentFieldNumber;
+}
+
+WireFormat::WireType WireFormat::Reader::wireType() {
+    return currentWireType;
+}
+
+quint64 WireFormat::Reader::varint() {
+    return currentVarint;
+}
+
+QByteArrayView WireFormat::Reader::bytes() {
+    return currentBytes;
+}
+
+bool WireFormat::Reader::readVarint(quint64* value) {
+    quint64 result = 0;
+    for (auto shift = 0; shift < 64; shift += 7) {
+        if (pos >= message.size()) return false;
+
+        auto byte = static_cast<quint8>(message.at(pos));
+        pos++;
+
+        result |= static_cast<quint64>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool WireFormat::findBytes(QByteArrayView message, int fieldNumber, QByteArrayView* value) {
+    bool found = false;
+
+    Reader reader(message);
+    while (reader.next()) {
+        if (reader.fieldNumber() == fieldNumber && reader.wireType() == LengthDelimited) {
+            *value = reader.bytes();
+            found = true;
+        }
+    }
+
+    return found && !reader.error();
+}
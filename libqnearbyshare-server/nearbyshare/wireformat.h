@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_WIREFORMAT_H
+#define QNEARBYSHARE_WIREFORMAT_H
+
+#include <QByteArrayView>
+#include <cstring>
+
+// Minimal protobuf wire format support for the hot paths where the generated classes would copy large bytes fields.
+// Everything else should go through the generated protobuf classes.
+namespace WireFormat {
+    enum WireType {
+        Varint = 0,
+        Fixed64 = 1,
+        LengthDelimited = 2,
+        Fixed32 = 5
+    };
+
+    // Iterates over the fields of a serialized message without copying anything.
+    // Length delimited fields are returned as views into the message.
+    class Reader {
+        public:
+            explicit Reader(QByteArrayView message);
+
+            bool next();
+            bool error();
+
+            int fieldNumber();
+            WireType wireType();
+
+            quint64 varint();
+            QByteArrayView bytes();
+
+        private:
+            QByteArrayView message;
+            qsizetype pos = 0;
+            bool hasError = false;
+
+            int currentFieldNumber = 0;
+            WireType currentWireType = Varint;
+            quint64 currentVarint = 0;
+            QByteArrayView currentBytes;
+
+            bool readVarint(quint64* value);
+    };
+
+    // Finds the last occurrence of a length delimited field, returning false if the message is malformed or the field is missing
+    bool findBytes(QByteArrayView message, int fieldNumber, QByteArrayView* value);
+
+    constexpr qsizetype varintSize(quint64 value) {
+        qsizetype size = 1;
+        while (value >= 0x80) {
+            value >>= 7;
+            size++;
+        }
+        return size;
+    }
+
+    // Writes a varint to out and returns a pointer just past it
+    inline char* writeVarint(char* out, quint64 value) {
+        while (value >= 0x80) {
+            *out++ = static_cast<char>(value | 0x80);
+            value >>= 7;
+        }
+        *out++ = static_cast<char>(value);
+        return out;
+    }
+
+    // Field tags are fixed for any given message, so work them out at compile time
+    template<int FieldNumber, WireType Type> struct Tag {
+            static constexpr quint64 value = (static_cast<quint64>(FieldNumber) << 3) | Type;
+            static constexpr qsizetype size = varintSize(value);
+
+            static char* write(char* out) {
+                return writeVarint(out, value);
+            }
+    };
+
+    // Signed integer fields (int32 and int64) are sign extended to 64 bits on the wire
+    template<int FieldNumber> constexpr qsizetype varintFieldSize(quint64 value) {
+        return Tag<FieldNumber, Varint>::size + varintSize(value);
+    }
+
+    template<int FieldNumber> constexpr qsizetype lengthDelimitedFieldSize(qsizetype length) {
+        return Tag<FieldNumber, LengthDelimited>::size + varintSize(length) + length;
+    }
+
+    template<int FieldNumber> char* writeVarintField(char* out, quint64 value) {
+        return writeVarint(Tag<FieldNumber, Varint>::write(out), value);
+    }
+
+    // Writes the tag and length of a length delimited field; the caller writes the contents
+    template<int FieldNumber> char* writeLengthDelimitedHeader(char* out, qsizetype length) {
+        return writeVarint(Tag<FieldNumber, LengthDelimited>::write(out), length);
+    }
+
+    template<int FieldNumber> char* writeBytesField(char* out, QByteArrayView value) {
+        out = writeLengthDelimitedHeader<FieldNumber>(out, value.size());
+        if (!value.isEmpty()) std::memcpy(out, value.data(), value.size());
+        return out + value.size();
+    }
+} // namespace WireFormat
+
+#endif // QNEARBYSHARE_WIREFORMAT_H
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef QNEARBYSHARE_WORKERLANES_H
+#define QNEARBYSHARE_WORKERLANES_H
+
+#include "spscqueue.h"
+#include <QList>
+#include <QQueue>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+#include <atomic>
+#include <functional>
+
+// Runs jobs on QThreadPool::globalInstance() across a fixed number of lanes, and hands their results back in the
+// order the jobs were submitted.
+//
+// Each lane is fed through a pair of lock free single producer, single consumer queues: jobs go in from the owner's
+// thread and results come back out. Jobs are handed to the lanes in turn and the owner's thread remembers which lane
+// got each one, so takeNext() always returns the oldest job's result no matter which lane finishes first. A lane
+// only takes jobsPerLane jobs at a time, so neither queue can overflow.
+//
+// Everything except work and resultsReady runs on the owner's thread.
+template<typename Job, typename Result> class WorkerLanes {
+    public:
+        // work is called on a worker thread with the index of the lane running it. resultsReady is called from a
+        // worker thread when a result is waiting. It isn't called again until takeNext() has been called, so it can
+        // simply post an event to the owner's thread.
+        WorkerLanes(int lanes, int jobsPerLane, std::function<Result(int lane, Job& job)> work, std::function<void()> resultsReady) :
+            jobsPerLane(jobsPerLane), work(std::move(work)), resultsReady(std::move(resultsReady)) {
+            for (auto i = 0; i < lanes; i++) {
+                auto lane = new Lane(jobsPerLane);
+                lane->task = QRunnable::create([this, i] {
+                    run(i);
+                });
+                lane->task->setAutoDelete(false);
+                this->lanes.append(lane);
+            }
+        }
+
+        // Tasks still waiting for a thread are taken back off the pool, and tasks that are running skip their
+        // remaining jobs. Only the running ones are waited for.
+        ~WorkerLanes() {
+            stopping = true;
+            auto taken = 0;
+            for (auto lane : lanes) {
+                if (QThreadPool::globalInstance()->tryTake(lane->task)) taken++;
+            }
+            finished.acquire(started - taken);
+
+            for (auto lane : lanes) {
+                delete lane->task;
+                delete lane;
+            }
+        }
+
+        WorkerLanes(const WorkerLanes&) = delete;
+        WorkerLanes& operator=(const WorkerLanes&) = delete;
+
+        // Gives the job to the next lane with room. Returns false, leaving job untouched, if every lane is full.
+        bool submit(Job&& job) {
+            for (auto i = 0; i < lanes.size(); i++) {
+                auto laneIndex = (nextLane + i) % lanes.size();
+                auto lane = lanes.at(laneIndex);
+                if (lane->queued == jobsPerLane) continue;
+
+                auto pushed = lane->jobs.push(std::move(job));
+                Q_ASSERT(pushed);
+                lane->queued++;
+                order.enqueue(laneIndex);
+                nextLane = (laneIndex + 1) % lanes.size();
+                start(lane);
+                return true;
+            }
+            return false;
+        }
+
+        // Moves the oldest job's result to result. Returns false if there are no jobs, or the oldest isn't done yet.
+        bool takeNext(Result* result) {
+            // Anything finished from here on needs a new notification
+            notified = false;
+
+            if (order.isEmpty()) return false;
+            auto lane = lanes.at(order.head());
+            if (!lane->results.pop(result)) return false;
+            lane->queued--;
+            order.dequeue();
+            return true;
+        }
+
+        bool isFull() const {
+            for (auto lane : lanes) {
+                if (lane->queued < jobsPerLane) return false;
+            }
+            return true;
+        }
+
+        bool isEmpty() const {
+            return order.isEmpty();
+        }
+
+        int laneCount() const {
+            return lanes.size();
+        }
+
+        // The number of lanes to use: the value of environmentVariable if it is set, otherwise one less than the
+        // number of cores to leave one for the owner's thread. Always between 1 and maxLanes.
+        static int defaultLanes(const char* environmentVariable, int maxLanes) {
+            bool ok;
+            auto lanes = qEnvironmentVariableIntValue(environmentVariable, &ok);
+            if (ok && lanes > 0) return qMin(lanes, maxLanes);
+            return qBound(1, QThread::idealThreadCount() - 1, maxLanes);
+        }
+
+    private:
+        struct Lane {
+                explicit Lane(int jobsPerLane) :
+                    jobs(jobsPerLane), results(jobsPerLane) {
+                }
+
+                SpscQueue<Job> jobs;
+                SpscQueue<Result> results;
+                std::atomic<bool> running = false;
+                QRunnable* task = nullptr;
+
+                // Jobs given to this lane whose results haven't been taken yet. Only used on the owner's thread.
+                int queued = 0;
+        };
+
+        QList<Lane*> lanes;
+        int jobsPerLane;
+        std::function<Result(int lane, Job& job)> work;
+        std::function<void()> resultsReady;
+        std::atomic<bool> notified = false;
+        std::atomic<bool> stopping = false;
+
+        // Released once by every task that runs to the end. Only the owner's thread starts tasks, so the destructor
+        // knows exactly how many releases to wait for.
+        QSemaphore finished;
+        int started = 0;
+
+        // Only used on the owner's thread: the lane of each job whose result hasn't been taken, in submission order
+        QQueue<int> order;
+        int nextLane = 0;
+
+        void start(Lane* lane) {
+            if (lane->running.exchange(true)) return;
+            started++;
+            QThreadPool::globalInstance()->start(lane->task);
+        }
+
+        void run(int laneIndex) {
+            auto lane = lanes.at(laneIndex);
+            do {
+                Job job;
+                while (lane->jobs.pop(&job)) {
+                    Result result{};
+                    if (!stopping) result = work(laneIndex, job);
+                    job = {};
+
+                    auto pushed = lane->results.push(std::move(result));
+                    Q_ASSERT(pushed);
+                    if (!notified.exchange(true) && !stopping) resultsReady();
+                }
+                lane->running = false;
+
+                // A job pushed after the last pop but before running was cleared didn't start the lane again, so pick
+                // it up here unless the owner's thread has already started the lane back up
+            } while (!lane->jobs.isEmpty() && !lane->running.exchange(true));
+
+            // Nothing may touch the lanes after this
+            finished.release();
+        }
+};
+
+#endif // QNEARBYSHARE_WORKERLANES_H
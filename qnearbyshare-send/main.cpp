@@ -41,6 +41,8 @@ int main(int argc, char* argv[]) {
     QCommandLineParser parser;
     parser.setApplicationDescription("Nearby Share");
     parser.addOption({"connection-string", "Connection String to use", "connection-string"});
+    parser.addOption({"order", "Order to send files in: sequential, smallest-first, round-robin (default) or priority", "order"});
+    parser.addOption({"priorities", "Comma separated priority for each file with --order priority, higher goes first", "priorities"});
     parser.addHelpOption();
     parser.addVersionOption();
 
@@ -66,6 +68,43 @@ int main(int argc, char* argv[]) {
         files.append(f);
     }
 
+    QVariantMap options;
+    if (parser.isSet("order")) {
+        const QMap<QString, QString> transferOrders = {
+            {"sequential",     "Sequential"   },
+            {"smallest-first", "SmallestFirst"},
+            {"round-robin",    "RoundRobin"   },
+            {"priority",       "Priority"     }
+        };
+
+        auto order = parser.value("order");
+        if (!transferOrders.contains(order)) {
+            console.outputInvocationError(QStringLiteral("invalid order '%1'").arg(order));
+            qDeleteAll(files);
+            return 1;
+        }
+        options.insert("TransferOrder", transferOrders.value(order));
+
+        if (order == "priority") {
+            QList<int> priorities;
+            for (const auto& priority : parser.value("priorities").split(',', Qt::SkipEmptyParts)) {
+                bool ok;
+                priorities.append(priority.toInt(&ok));
+                if (!ok) {
+                    console.outputInvocationError(QStringLiteral("invalid priority '%1'").arg(priority));
+                    qDeleteAll(files);
+                    return 1;
+                }
+            }
+            if (priorities.length() != files.length()) {
+                console.outputInvocationError("option priorities requires one priority for each file");
+                qDeleteAll(files);
+                return 1;
+            }
+            options.insert("Priorities", QVariant::fromValue(priorities));
+        }
+    }
+
     QString connectionString;
     QString peerName = "Remote Device";
     if (parser.isSet("connection-string")) {
@@ -85,7 +124,7 @@ int main(int argc, char* argv[]) {
     console.outputErrorLine(QStringLiteral("Sending to %1").arg(connectionString));
 
     SendJob job;
-    if (!job.send(connectionString, peerName, files)) {
+    if (!job.send(connectionString, peerName, files, options)) {
         return 1;
     }
 
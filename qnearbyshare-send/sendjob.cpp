@@ -51,7 +51,7 @@ SendJob::~SendJob() {
     delete d;
 }
 
-bool SendJob::send(const QString& connectionString, const QString& peerName, const QList<QFile*>& files) {
+bool SendJob::send(const QString& connectionString, const QString& peerName, const QList<QFile*>& files, const QVariantMap& options) {
     QList<QNearbyShare::DBus::SendingFile> sendingFiles;
     for (auto file : files) {
         QFileInfo fileInfo(file->fileName());
@@ -59,10 +59,13 @@ bool SendJob::send(const QString& connectionString, const QString& peerName, con
             fileInfo.fileName()});
     }
 
-    auto reply = d->manager->call("SendToTarget", connectionString, peerName, QVariant::fromValue(sendingFiles));
+    // Only pass options when there are some, so that older daemons still understand the call
+    auto reply = options.isEmpty() ? d->manager->call("SendToTarget", connectionString, peerName, QVariant::fromValue(sendingFiles)) : d->manager->call("SendToTarget", connectionString, peerName, QVariant::fromValue(sendingFiles), options);
     if (reply.type() != QDBusMessage::ReplyMessage) {
         if (reply.errorName() == QNearbyShare::DBus::Error::INVALID_CONNECTION_STRING) {
             QTextStream(stderr) << "<!> " << tr("Invalid connection string.") << "\n";
+        } else if (reply.errorName() == QNearbyShare::DBus::Error::INVALID_TRANSFER_ORDER) {
+            QTextStream(stderr) << "<!> " << tr("Invalid transfer order.") << "\n";
         }
         return false;
     }
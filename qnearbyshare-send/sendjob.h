@@ -38,7 +38,7 @@ class SendJob : public QObject {
         explicit SendJob(QObject* parent = nullptr);
         ~SendJob();
 
-        bool send(const QString& connectionString, const QString& peerName, const QList<QFile*>& files);
+        bool send(const QString& connectionString, const QString& peerName, const QList<QFile*>& files, const QVariantMap& options = {});
 
     private slots:
         void sessionPropertiesChanged(QString interface, QVariantMap properties, QStringList changedProperties);
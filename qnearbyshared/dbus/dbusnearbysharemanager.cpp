@@ -24,6 +24,7 @@
 
 #include "dbusnearbysharemanager.h"
 #include <QCoreApplication>
+#include <QDBusArgument>
 #include <QDBusConnection>
 #include <QDBusMetaType>
 #include <QFile>
@@ -129,6 +130,33 @@ QDBusObjectPath DBusNearbyShareManager::DiscoverTargets(const QDBusMessage& mess
 }
 
 QDBusObjectPath DBusNearbyShareManager::SendToTarget(const QString& connectionString, QString peerName, const QList<QNearbyShare::DBus::SendingFile>& files, const QDBusMessage& message) {
+    return SendToTarget(connectionString, std::move(peerName), files, {}, message);
+}
+
+QDBusObjectPath DBusNearbyShareManager::SendToTarget(const QString& connectionString, QString peerName, const QList<QNearbyShare::DBus::SendingFile>& files, const QVariantMap& options, const QDBusMessage& message) {
+    auto transferOrder = NearbyShareClient::TransferOrder::RoundRobin;
+    if (options.contains("TransferOrder")) {
+        auto transferOrderName = options.value("TransferOrder").toString();
+        if (transferOrderName == QStringLiteral("Sequential")) {
+            transferOrder = NearbyShareClient::TransferOrder::Sequential;
+        } else if (transferOrderName == QStringLiteral("SmallestFirst")) {
+            transferOrder = NearbyShareClient::TransferOrder::SmallestFirst;
+        } else if (transferOrderName == QStringLiteral("RoundRobin")) {
+            transferOrder = NearbyShareClient::TransferOrder::RoundRobin;
+        } else if (transferOrderName == QStringLiteral("Priority")) {
+            transferOrder = NearbyShareClient::TransferOrder::Priority;
+        } else {
+            QDBusConnection::sessionBus().send(message.createErrorReply(QNearbyShare::DBus::Error::INVALID_TRANSFER_ORDER, "The transfer order is invalid"));
+            return {};
+        }
+    }
+
+    auto priorities = qdbus_cast<QList<int>>(options.value("Priorities"));
+    if (transferOrder == NearbyShareClient::TransferOrder::Priority && priorities.length() != files.length()) {
+        QDBusConnection::sessionBus().send(message.createErrorReply(QNearbyShare::DBus::Error::INVALID_TRANSFER_ORDER, "Priority order needs one priority for each file"));
+        return {};
+    }
+
     QIODevice* device = NearbyShareClient::resolveConnectionString(connectionString);
 
     if (!device) {
@@ -138,16 +166,18 @@ QDBusObjectPath DBusNearbyShareManager::SendToTarget(const QString& connectionSt
     }
 
     QList<NearbyShareClient::LocalFile> filesToTransfer;
-    for (const auto& file : files) {
+    for (auto i = 0; i < files.length(); i++) {
+        const auto& file = files.at(i);
         auto qf = new QFile();
         qf->open(dup(file.fd.fileDescriptor()), QFile::ReadOnly, QFile::AutoCloseHandle);
 
         filesToTransfer.append({qf,
             file.filename,
-            static_cast<quint64>(qf->size())});
+            static_cast<quint64>(qf->size()),
+            priorities.value(i)});
     }
 
-    auto client = NearbyShareClient::clientForSend(device, std::move(peerName), filesToTransfer);
+    auto client = NearbyShareClient::clientForSend(device, std::move(peerName), filesToTransfer, transferOrder);
     return registerNewShare(client);
 }
 
@@ -55,6 +55,10 @@ class DBusNearbyShareManager : public QObject {
         Q_SCRIPTABLE QDBusObjectPath StartListening(const QDBusMessage& message);
         Q_SCRIPTABLE QDBusObjectPath DiscoverTargets(const QDBusMessage& message);
         Q_SCRIPTABLE QDBusObjectPath SendToTarget(const QString& connectionString, QString peerName, const QList<QNearbyShare::DBus::SendingFile>& files, const QDBusMessage& message);
+
+        // options may hold "TransferOrder" (Sequential, SmallestFirst, RoundRobin or Priority) and, for Priority,
+        // "Priorities" (one int per file, higher goes first)
+        Q_SCRIPTABLE QDBusObjectPath SendToTarget(const QString& connectionString, QString peerName, const QList<QNearbyShare::DBus::SendingFile>& files, const QVariantMap& options, const QDBusMessage& message);
         Q_SCRIPTABLE void Quit();
 
     signals:
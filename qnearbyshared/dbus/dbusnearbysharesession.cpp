@@ -65,6 +65,8 @@ QString DBusNearbyShareSessionPrivate::NearbyShareClientFailedReasonToString(Nea
             return QStringLiteral("RemoteUnsupported");
         case NearbyShareClient::FailedReason::RemoteTimedOut:
             return QStringLiteral("RemoteTimedOut");
+        case NearbyShareClient::FailedReason::OutOfSpace:
+            return QStringLiteral("OutOfSpace");
     }
     return QStringLiteral("Unknown");
 }
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/bufferpool.h"
+#include "gtest/gtest.h"
+
+TEST(bufferpool, reusesBuffers) {
+    auto pool = BufferPool::instance();
+
+    auto buffer = pool->take(100000);
+    EXPECT_EQ(buffer.size(), 100000);
+    auto data = buffer.constData();
+    pool->recycle(std::move(buffer));
+    EXPECT_TRUE(buffer.isEmpty());
+
+    // A slightly smaller buffer comes from the same size class
+    auto hits = pool->hits();
+    auto reused = pool->take(99000);
+    EXPECT_EQ(pool->hits(), hits + 1);
+    EXPECT_EQ(reused.size(), 99000);
+    EXPECT_EQ(reused.constData(), data);
+    pool->recycle(std::move(reused));
+}
+
+TEST(bufferpool, oversizedBuffersAreNotPooled) {
+    auto pool = BufferPool::instance();
+
+    auto misses = pool->misses();
+    auto buffer = pool->take(BufferPool::MaximumClassSize + 1);
+    EXPECT_EQ(buffer.size(), BufferPool::MaximumClassSize + 1);
+    EXPECT_EQ(pool->misses(), misses + 1);
+
+    auto pooledBytes = pool->pooledBytes();
+    pool->recycle(std::move(buffer));
+    EXPECT_EQ(pool->pooledBytes(), pooledBytes);
+}
+
+TEST(bufferpool, maximumBytes) {
+    auto pool = BufferPool::instance();
+    auto maximumBytes = pool->maximumBytes();
+
+    pool->recycle(pool->take(64 * 1024));
+    pool->setMaximumBytes(0);
+    EXPECT_EQ(pool->pooledBytes(), 0);
+
+    pool->recycle(pool->take(64 * 1024));
+    EXPECT_EQ(pool->pooledBytes(), 0);
+
+    pool->setMaximumBytes(maximumBytes);
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/chacha20drbg.h"
+#include "nearbyshare/cryptography.h"
+#include "gtest/gtest.h"
+#include <QtEndian>
+
+TEST(chacha20drbg, blockFunction) {
+    // RFC 8439 section 2.3.2
+    auto keyBytes = QByteArray::fromHex("000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f");
+    auto nonceBytes = QByteArray::fromHex("000000090000004a00000000");
+
+    quint32 key[8];
+    for (auto i = 0; i < 8; i++) key[i] = qFromLittleEndian<quint32>(keyBytes.constData() + i * 4);
+    quint32 nonce[3];
+    for (auto i = 0; i < 3; i++) nonce[i] = qFromLittleEndian<quint32>(nonceBytes.constData() + i * 4);
+
+    QByteArray output(64, Qt::Uninitialized);
+    ChaCha20Drbg::block(key, 1, nonce, output.data());
+    EXPECT_EQ(output, QByteArray::fromHex("10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+                                          "d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e"));
+}
+
+TEST(chacha20drbg, generate) {
+    ChaCha20Drbg drbg;
+
+    // Requests that straddle batches and reseeds must still be filled completely and never repeat
+    QByteArray previous;
+    for (auto length : {16, 1, 1000, 5000, static_cast<int>(ChaCha20Drbg::ReseedInterval) + 3}) {
+        QByteArray output(length, '\0');
+        drbg.generate(output.data(), length);
+
+        if (length >= 16) {
+            EXPECT_NE(output, QByteArray(length, '\0'));
+            EXPECT_NE(output.left(16), previous);
+            previous = output.left(16);
+        }
+    }
+
+    EXPECT_EQ(Cryptography::randomBytes(16).length(), 16);
+    EXPECT_NE(Cryptography::randomBytes(16), Cryptography::randomBytes(16));
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/chunksizer.h"
+#include "gtest/gtest.h"
+
+namespace {
+    // Feeds the sizer a steady rate for the given time, in writes of 64 KiB, and returns the time it ended at
+    qint64 writeAt(ChunkSizer* sizer, qint64 bytesPerSecond, qint64 start, qint64 duration) {
+        constexpr qint64 write = 64 * 1024;
+        auto interval = qMax<qint64>(1, write * 1000 / bytesPerSecond);
+        auto now = start;
+        while (now < start + duration) {
+            now += interval;
+            sizer->recordWritten(write, now);
+        }
+        return now;
+    }
+} // namespace
+
+TEST(chunksizer, growsOnFastLinks) {
+    ChunkSizer sizer(ChunkSizer::MaximumChunkSize);
+    EXPECT_EQ(sizer.chunkSize(), ChunkSizer::InitialChunkSize);
+
+    // At least 64 KiB every millisecond
+    writeAt(&sizer, 120 * 1024 * 1024, 0, 2000);
+    EXPECT_EQ(sizer.chunkSize(), ChunkSizer::MaximumChunkSize);
+    EXPECT_GT(sizer.throughput(), 50 * 1024 * 1024);
+}
+
+TEST(chunksizer, androidCap) {
+    ChunkSizer sizer;
+    writeAt(&sizer, 120 * 1024 * 1024, 0, 2000);
+    EXPECT_EQ(sizer.chunkSize(), ChunkSizer::AndroidMaximumChunkSize);
+}
+
+TEST(chunksizer, shrinksOnSlowLinks) {
+    ChunkSizer sizer(ChunkSizer::MaximumChunkSize);
+    auto now = writeAt(&sizer, 120 * 1024 * 1024, 0, 2000);
+
+    // Down to about 2 MB/s, where a chunk should be about 200 KiB
+    writeAt(&sizer, 2 * 1024 * 1024, now, 5000);
+    EXPECT_LE(sizer.chunkSize(), 256 * 1024);
+    EXPECT_GE(sizer.chunkSize(), ChunkSizer::MinimumChunkSize);
+}
+
+TEST(chunksizer, drainTime) {
+    ChunkSizer sizer;
+    sizer.recordDrainTime(ChunkSizer::MaxDrainTime / 2);
+    EXPECT_EQ(sizer.chunkSize(), ChunkSizer::InitialChunkSize);
+
+    for (auto i = 0; i < 10; i++) sizer.recordDrainTime(ChunkSizer::MaxDrainTime * 2);
+    EXPECT_EQ(sizer.chunkSize(), ChunkSizer::MinimumChunkSize);
+}
+
+TEST(chunksizer, fullWindowOnSlowLink) {
+    ChunkSizer sizer;
+
+    // The sender keeps 8 MiB queued ahead of a 2 MB/s link, so each chunk waits seconds behind the others before it
+    // starts to go out. That wait mustn't count against the chunk, or the size would be stuck at the minimum.
+    constexpr qint64 Window = 8 * 1024 * 1024;
+    constexpr qint64 Write = 64 * 1024;
+    constexpr qint64 BytesPerSecond = 2 * 1024 * 1024;
+    qint64 queued = 0;
+    qint64 written = 0;
+    for (qint64 now = 0; now < 20000; now += Write * 1000 / BytesPerSecond) {
+        while (queued - written < Window) {
+            auto chunk = sizer.chunkSize();
+            sizer.recordQueued(chunk, now);
+            queued += chunk;
+        }
+        sizer.recordWritten(Write, now);
+        written += Write;
+    }
+
+    // About 200 KiB goes out in TargetChunkTime
+    EXPECT_GT(sizer.chunkSize(), ChunkSizer::MinimumChunkSize);
+    EXPECT_LE(sizer.chunkSize(), 256 * 1024);
+}
+
+TEST(chunksizer, slowChunksShrink) {
+    ChunkSizer sizer;
+
+    // A single chunk that takes longer than MaxDrainTime once it is at the head of the queue
+    sizer.recordQueued(ChunkSizer::InitialChunkSize, 0);
+    sizer.recordWritten(ChunkSizer::InitialChunkSize, ChunkSizer::MaxDrainTime * 2);
+    EXPECT_EQ(sizer.chunkSize(), ChunkSizer::InitialChunkSize / 2);
+}
@@ -23,6 +23,9 @@
  */
 
 #include "nearbyshare/cryptography.h"
+#include "nearbyshare/cryptography/aesnicbc.h"
+#include "nearbyshare/cryptography/avx2hmacsha256.h"
+#include "nearbyshare/cryptography/cryptoengine.h"
 #include "gtest/gtest.h"
 
 TEST(crypto, aes256decrypt) {
@@ -62,6 +65,314 @@ TEST(crypto, aes256encrypt) {
 //     EXPECT_EQ(dhs, expected);
 // }
 
+TEST(crypto, aes256cachedKey) {
+    QByteArray key("SECRETKEY1234567SECRETKEY1234567");
+    auto encryptKey = Cryptography::createAes256CbcKey(key, true);
+    auto decryptKey = Cryptography::createAes256CbcKey(key, false);
+    ASSERT_NE(encryptKey, nullptr);
+    ASSERT_NE(decryptKey, nullptr);
+
+    // The same key object must give the same results as the one shot functions for every message
+    for (auto i = 0; i < 3; i++) {
+        auto iv = Cryptography::randomBytes(16);
+        auto plaintext = Cryptography::randomBytes(100 * i + 11);
+
+        QByteArray ciphertext(plaintext.length() + 16, Qt::Uninitialized);
+        ciphertext.truncate(Cryptography::aes256cbc(encryptKey, plaintext.constData(), plaintext.length(), ciphertext.data(), iv));
+        EXPECT_EQ(ciphertext, Cryptography::aes256cbcEncrypt(plaintext, key, iv));
+
+        QByteArray decrypted(ciphertext.length() + 16, Qt::Uninitialized);
+        decrypted.truncate(Cryptography::aes256cbc(decryptKey, ciphertext.constData(), ciphertext.length(), decrypted.data(), iv));
+        EXPECT_EQ(decrypted, plaintext);
+    }
+
+    Cryptography::deleteAesKey(encryptKey);
+    Cryptography::deleteAesKey(decryptKey);
+}
+
+TEST(crypto, aesNiDecrypt) {
+    if (!AesNiCbc::isSupported()) GTEST_SKIP() << "AES-NI is not available";
+
+    auto key = Cryptography::randomBytes(32);
+    auto iv = Cryptography::randomBytes(16);
+    AesNiCbc aesNi(key);
+
+    for (auto kernel : {AesNiCbc::AesNiKernel, AesNiCbc::VaesKernel}) {
+        if (!AesNiCbc::isSupported(kernel)) continue;
+        aesNi.setDecryptKernel(kernel);
+
+        // Lengths on either side of the 8 and 16 block steps
+        for (auto length : {0, 1, 15, 16, 127, 128, 255, 256, 1000, 65536}) {
+            QByteArray plaintext(length, Qt::Uninitialized);
+            for (auto i = 0; i < length; i++) plaintext[i] = static_cast<char>(i * 7);
+            auto ciphertext = Cryptography::aes256cbcEncrypt(plaintext, key, iv);
+
+            QByteArray output(ciphertext.length(), Qt::Uninitialized);
+            ASSERT_EQ(aesNi.decrypt(ciphertext.constData(), ciphertext.length(), output.data(), iv), length) << "kernel " << kernel << " length " << length;
+            EXPECT_EQ(output.left(length), plaintext);
+
+            // In place
+            ASSERT_EQ(aesNi.decrypt(ciphertext.constData(), ciphertext.length(), ciphertext.data(), iv), length);
+            EXPECT_EQ(ciphertext.left(length), plaintext);
+        }
+
+        // Without its padding block this decrypts to a zero padding byte
+        auto unpadded = Cryptography::aes256cbcEncrypt(QByteArray(16, '\0'), key, iv).left(16);
+        QByteArray output(16, Qt::Uninitialized);
+        EXPECT_EQ(aesNi.decrypt(unpadded.constData(), unpadded.length(), output.data(), iv), -1);
+        EXPECT_EQ(aesNi.decrypt(unpadded.constData(), 15, output.data(), iv), -1);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+TEST(crypto, vaesDecryptMatchesOpenSsl) {
+    if (!__builtin_cpu_supports("vaes") || !AesNiCbc::isSupported(AesNiCbc::VaesKernel)) GTEST_SKIP() << "VAES is not available";
+    auto openssl = Cryptography::engine("openssl");
+    if (!openssl) GTEST_SKIP() << "The OpenSSL engine was not built";
+
+    auto key = Cryptography::randomBytes(32);
+    auto iv = Cryptography::randomBytes(16);
+    AesNiCbc aesNi(key);
+    aesNi.setDecryptKernel(AesNiCbc::VaesKernel);
+
+    // Lengths on either side of the 16 block steps, each decrypted from an aligned and a misaligned buffer
+    for (auto length : {0, 1, 15, 16, 240, 255, 256, 257, 511, 512, 4095, 4096, 65543}) {
+        auto plaintext = Cryptography::randomBytes(length);
+        QByteArray ciphertext(length + 16, Qt::Uninitialized);
+        ciphertext.truncate(openssl->aes256cbc(plaintext.constData(), length, ciphertext.data(), key, iv, true));
+        ASSERT_EQ(ciphertext.length() % 16, 0);
+
+        QByteArray expected(ciphertext.length() + 16, Qt::Uninitialized);
+        auto expectedLength = openssl->aes256cbc(ciphertext.constData(), ciphertext.length(), expected.data(), key, iv, false);
+        ASSERT_EQ(expectedLength, length);
+        expected.truncate(expectedLength);
+
+        for (auto offset : {0, 1}) {
+            QByteArray input(offset, '\0');
+            input.append(ciphertext);
+            QByteArray output(input.length(), Qt::Uninitialized);
+            ASSERT_EQ(aesNi.decrypt(input.constData() + offset, ciphertext.length(), output.data() + offset, iv), expectedLength) << "length " << length << " offset " << offset;
+            EXPECT_EQ(output.mid(offset, expectedLength), expected) << "length " << length << " offset " << offset;
+
+            // In place
+            ASSERT_EQ(aesNi.decrypt(input.constData() + offset, ciphertext.length(), input.data() + offset, iv), expectedLength);
+            EXPECT_EQ(input.mid(offset, expectedLength), expected) << "length " << length << " offset " << offset;
+        }
+    }
+
+    // Ciphertext that was never encrypted mostly has invalid padding; both sides have to agree on which
+    for (auto i = 0; i < 64; i++) {
+        auto ciphertext = Cryptography::randomBytes(16 * (1 + i % 20));
+        QByteArray expected(ciphertext.length() + 16, Qt::Uninitialized);
+        auto expectedLength = openssl->aes256cbc(ciphertext.constData(), ciphertext.length(), expected.data(), key, iv, false);
+
+        QByteArray output(ciphertext.length(), Qt::Uninitialized);
+        auto length = aesNi.decrypt(ciphertext.constData(), ciphertext.length(), output.data(), iv);
+        ASSERT_EQ(length, expectedLength) << "blocks " << ciphertext.length() / 16;
+        if (length >= 0) EXPECT_EQ(output.left(length), expected.left(expectedLength));
+    }
+}
+#endif
+
+TEST(crypto, aes256gcm) {
+    // Test case 16 from the GCM specification
+    auto key = QByteArray::fromHex("feffe9928665731c6d6a8f9467308308feffe9928665731c6d6a8f9467308308");
+    auto iv = QByteArray::fromHex("cafebabefacedbaddecaf888");
+    auto plaintext = QByteArray::fromHex("d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a721c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39");
+    auto associatedData = QByteArray::fromHex("feedfacedeadbeeffeedfacedeadbeefabaddad2");
+    auto ciphertext = QByteArray::fromHex("522dc1f099567d07f47f37a32a84427d643a8cdcbfe5c0c97598a2bd2555d1aa8cb08e48590dbb3da7b08b1056828838c5f61e6393ba7a0abcc9f662");
+    auto tag = QByteArray::fromHex("76fc6ece0f4e1768cddf8853bb2d551b");
+
+    auto encryptKey = Cryptography::createAes256GcmKey(key, true);
+    auto decryptKey = Cryptography::createAes256GcmKey(key, false);
+    ASSERT_NE(encryptKey, nullptr);
+    ASSERT_NE(decryptKey, nullptr);
+
+    // Twice, to make sure the cached key is reset between messages
+    for (auto i = 0; i < 2; i++) {
+        QByteArray output(plaintext.length(), Qt::Uninitialized);
+        QByteArray outputTag(Cryptography::Aes256GcmTagLength, Qt::Uninitialized);
+        EXPECT_EQ(Cryptography::aes256gcmEncrypt(encryptKey, plaintext.constData(), plaintext.length(), output.data(), iv, associatedData, outputTag.data()), plaintext.length());
+        EXPECT_EQ(output, ciphertext);
+        EXPECT_EQ(outputTag, tag);
+
+        EXPECT_EQ(Cryptography::aes256gcmDecrypt(decryptKey, ciphertext.constData(), ciphertext.length(), output.data(), iv, associatedData, tag), plaintext.length());
+        EXPECT_EQ(output, plaintext);
+    }
+
+    // Any change to the ciphertext, associated data or tag must be caught
+    QByteArray output(plaintext.length(), Qt::Uninitialized);
+    auto badCiphertext = ciphertext;
+    badCiphertext[0] = static_cast<char>(badCiphertext.at(0) ^ 1);
+    auto badTag = tag;
+    badTag[15] = static_cast<char>(badTag.at(15) ^ 1);
+    EXPECT_EQ(Cryptography::aes256gcmDecrypt(decryptKey, badCiphertext.constData(), badCiphertext.length(), output.data(), iv, associatedData, tag), -1);
+    EXPECT_EQ(Cryptography::aes256gcmDecrypt(decryptKey, ciphertext.constData(), ciphertext.length(), output.data(), iv, associatedData.left(19), tag), -1);
+    EXPECT_EQ(Cryptography::aes256gcmDecrypt(decryptKey, ciphertext.constData(), ciphertext.length(), output.data(), iv, associatedData, badTag), -1);
+
+    Cryptography::deleteAesKey(encryptKey);
+    Cryptography::deleteAesKey(decryptKey);
+}
+
+TEST(crypto, hmacSha256CachedKey) {
+    // RFC 4231 test cases 2 and 6
+    auto shortKey = Cryptography::createHmacSha256Key("Jefe");
+    ASSERT_NE(shortKey, nullptr);
+    for (auto i = 0; i < 2; i++) {
+        EXPECT_EQ(Cryptography::hmacSha256Signature(QByteArrayView("what do ya want for nothing?"), shortKey), QByteArray::fromHex("5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"));
+    }
+
+    Cryptography::hmacSha256Begin(shortKey);
+    Cryptography::hmacSha256Update(shortKey, "what do ya ", 11);
+    Cryptography::hmacSha256Update(shortKey, "want for nothing?", 17);
+    EXPECT_EQ(Cryptography::hmacSha256Finish(shortKey), QByteArray::fromHex("5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843"));
+    Cryptography::deleteHmacKey(shortKey);
+
+    auto longKey = Cryptography::createHmacSha256Key(QByteArray(131, static_cast<char>(0xAA)));
+    ASSERT_NE(longKey, nullptr);
+    EXPECT_EQ(Cryptography::hmacSha256Signature(QByteArrayView("Test Using Larger Than Block-Size Key - Hash Key First"), longKey), QByteArray::fromHex("60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54"));
+    Cryptography::deleteHmacKey(longKey);
+}
+
+namespace {
+    // Lengths on either side of where the padding spills into a second block, in every lane position
+    QList<QByteArray> hmacMessages(int count) {
+        const QList<int> lengths = {0, 1, 55, 56, 63, 64, 65, 119, 120, 1000, 65536};
+        QList<QByteArray> messages;
+        for (auto i = 0; i < count; i++) {
+            QByteArray message(lengths.at(i % lengths.size()), Qt::Uninitialized);
+            for (auto j = 0; j < message.length(); j++) message[j] = static_cast<char>(i + j * 13);
+            messages.append(message);
+        }
+        return messages;
+    }
+
+    QList<HmacSha256Job> hmacJobs(const QList<QByteArray>& messages, QByteArray* signatures) {
+        *signatures = QByteArray(messages.size() * 32, '\0');
+        QList<HmacSha256Job> jobs;
+        for (auto i = 0; i < messages.size(); i++) jobs.append({messages.at(i).constData(), messages.at(i).length(), signatures->data() + i * 32});
+        return jobs;
+    }
+} // namespace
+
+TEST(crypto, avx2HmacSha256) {
+    if (!Avx2HmacSha256::isSupported()) GTEST_SKIP() << "AVX2 is not available";
+
+    for (const auto& key : {QByteArray("Jefe"), Cryptography::randomBytes(64), QByteArray(131, static_cast<char>(0xAA))}) {
+        Avx2HmacSha256 avx2(key);
+        for (auto count : {1, 3, 8, 13, 30}) {
+            auto messages = hmacMessages(count);
+            QByteArray signatures;
+            auto jobs = hmacJobs(messages, &signatures);
+            avx2.signBatch(jobs.data(), jobs.size());
+
+            for (auto i = 0; i < count; i++) {
+                EXPECT_EQ(signatures.mid(i * 32, 32), Cryptography::hmacSha256Signature(messages.at(i), key)) << "key " << key.length() << " count " << count << " message " << i;
+            }
+        }
+    }
+}
+
+TEST(crypto, hmacSha256Batch) {
+    auto key = Cryptography::randomBytes(32);
+    auto hmacKey = Cryptography::createHmacSha256Key(key);
+    ASSERT_NE(hmacKey, nullptr);
+
+    // Whichever way the engine signs a batch, it matches signing one message at a time
+    for (auto count : {1, 13}) {
+        auto messages = hmacMessages(count);
+        QByteArray signatures;
+        auto jobs = hmacJobs(messages, &signatures);
+        Cryptography::hmacSha256Batch(hmacKey, jobs.data(), jobs.size());
+
+        for (auto i = 0; i < count; i++) {
+            EXPECT_EQ(signatures.mid(i * 32, 32), Cryptography::hmacSha256Signature(messages.at(i), hmacKey)) << "count " << count << " message " << i;
+        }
+    }
+    Cryptography::deleteHmacKey(hmacKey);
+}
+
+TEST(crypto, hkdf) {
+    // RFC 5869 test case 1
+    auto ikm = QByteArray(22, static_cast<char>(0x0B));
+    auto salt = QByteArray::fromHex("000102030405060708090a0b0c");
+    auto info = QByteArray::fromHex("f0f1f2f3f4f5f6f7f8f9");
+    auto okm = QByteArray::fromHex("3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf34007208d5b887185865");
+
+    auto prk = Cryptography::hkdfExtract(salt, ikm);
+    EXPECT_EQ(prk, QByteArray::fromHex("077709362c2e32df0ddc3f0dc47bba6390b6c73bb50f9c3122ec844ad7c2b3e5"));
+    EXPECT_EQ(Cryptography::hkdfExpand(prk, info, 42), okm);
+    EXPECT_EQ(Cryptography::hkdfExtractExpand(salt, ikm, info, 42), okm);
+
+    auto keys = Cryptography::hkdfExtractExpand(salt, ikm, QList<QByteArray>{info, "SIG:1"}, 32);
+    ASSERT_EQ(keys.size(), 2);
+    EXPECT_EQ(keys.at(0), okm.left(32));
+    EXPECT_EQ(keys.at(1), Cryptography::hkdfExtractExpand(salt, ikm, "SIG:1", 32));
+}
+
+TEST(crypto, x25519) {
+    auto ourKey = Cryptography::generateX25519KeyPair();
+    auto peerKey = Cryptography::generateX25519KeyPair();
+    ASSERT_NE(ourKey, nullptr);
+    ASSERT_NE(peerKey, nullptr);
+
+    auto ourPublicKey = Cryptography::x25519PublicKey(ourKey);
+    auto peerPublicKey = Cryptography::x25519PublicKey(peerKey);
+    EXPECT_EQ(ourPublicKey.length(), 32);
+    EXPECT_NE(ourPublicKey, peerPublicKey);
+
+    auto secret = Cryptography::x25519DiffieHellman(ourKey, peerPublicKey);
+    EXPECT_EQ(secret.length(), 32);
+    EXPECT_EQ(secret, Cryptography::x25519DiffieHellman(peerKey, ourPublicKey));
+
+    // Low order points and malformed keys must be rejected
+    EXPECT_TRUE(Cryptography::x25519DiffieHellman(ourKey, QByteArray(32, '\0')).isEmpty());
+    EXPECT_TRUE(Cryptography::x25519DiffieHellman(ourKey, peerPublicKey.left(31)).isEmpty());
+
+    Cryptography::deleteEcdsaKeyPair(ourKey);
+    Cryptography::deleteEcdsaKeyPair(peerKey);
+}
+
+TEST(crypto, engines) {
+    QByteArray iv("AABBCCDDEEFFGGHH");
+    QByteArray key("SECRETKEY1234567SECRETKEY1234567");
+    QByteArray plaintext("HELLO WORLD");
+    auto ciphertext = QByteArray::fromHex("240252C8656EED9FD468E75ECBD202CA");
+
+    // Every engine that was built must agree with the others
+    ASSERT_FALSE(Cryptography::availableEngines().isEmpty());
+    for (const auto& name : Cryptography::availableEngines()) {
+        auto engine = Cryptography::engine(name);
+        ASSERT_NE(engine, nullptr);
+        EXPECT_EQ(engine->name(), name);
+
+        QByteArray output(32, Qt::Uninitialized);
+        output.truncate(engine->aes256cbc(plaintext.constData(), plaintext.length(), output.data(), key, iv, true));
+        EXPECT_EQ(output, ciphertext) << name.toStdString();
+
+        auto hmacKey = engine->createHmacSha256Key(key);
+        engine->hmacSha256Begin(hmacKey);
+        engine->hmacSha256Update(hmacKey, plaintext.constData(), plaintext.length());
+        EXPECT_EQ(engine->hmacSha256Finish(hmacKey), Cryptography::hmacSha256Signature(plaintext, key)) << name.toStdString();
+        delete hmacKey;
+
+        auto signature = Cryptography::hmacSha256Signature(plaintext, key);
+        auto tampered = signature;
+        tampered[0] = static_cast<char>(tampered.at(0) ^ 1);
+        EXPECT_TRUE(engine->constantTimeEquals(signature, QByteArray(signature))) << name.toStdString();
+        EXPECT_FALSE(engine->constantTimeEquals(signature, tampered)) << name.toStdString();
+
+        auto ourKey = engine->generateEcdsaKeyPair();
+        auto peerKey = engine->generateEcdsaKeyPair();
+        EXPECT_EQ(engine->diffieHellman(ourKey, engine->ecdsaX(peerKey), engine->ecdsaY(peerKey)), engine->diffieHellman(peerKey, engine->ecdsaX(ourKey), engine->ecdsaY(ourKey))) << name.toStdString();
+        delete ourKey;
+        delete peerKey;
+    }
+
+    EXPECT_EQ(Cryptography::engine(QStringLiteral("nonexistent")), nullptr);
+    EXPECT_FALSE(Cryptography::constantTimeEquals(QByteArray(32, 'S'), QByteArray(31, 'S')));
+}
+
 TEST(crypto, random) {
     auto bytes = Cryptography::randomBytes(6);
     EXPECT_EQ(bytes.length(), 6);
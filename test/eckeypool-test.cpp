@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/cryptography.h"
+#include "nearbyshare/eckeypool.h"
+#include "gtest/gtest.h"
+
+TEST(ecKeyPool, takeKey) {
+    auto pool = EcKeyPool::instance();
+    pool->setSize(3);
+    pool->prefill();
+
+    // Every key handed out must be distinct and usable for a key exchange
+    auto first = pool->takeKey();
+    auto second = pool->takeKey();
+    ASSERT_NE(first, nullptr);
+    ASSERT_NE(second, nullptr);
+    EXPECT_NE(Cryptography::ecdsaX(first), Cryptography::ecdsaX(second));
+    EXPECT_EQ(Cryptography::diffieHellman(first, Cryptography::ecdsaX(second), Cryptography::ecdsaY(second)),
+        Cryptography::diffieHellman(second, Cryptography::ecdsaX(first), Cryptography::ecdsaY(first)));
+
+    Cryptography::deleteEcdsaKeyPair(first);
+    Cryptography::deleteEcdsaKeyPair(second);
+
+    // An empty pool still hands out keys
+    pool->setSize(0);
+    EXPECT_EQ(pool->available(), 0);
+    auto spare = pool->takeKey();
+    EXPECT_NE(spare, nullptr);
+    Cryptography::deleteEcdsaKeyPair(spare);
+
+    pool->setSize(EcKeyPool::DefaultSize);
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/cryptography.h"
+#include "nearbyshare/filereadahead.h"
+#include "gtest/gtest.h"
+#include <QBuffer>
+#include <QThread>
+#include <atomic>
+
+namespace {
+    QByteArray takeNext(FileReadAhead* readAhead) {
+        QByteArray chunk;
+        while (!readAhead->take(&chunk)) QThread::yieldCurrentThread();
+        return chunk;
+    }
+} // namespace
+
+TEST(filereadahead, readsWholeFile) {
+    auto data = Cryptography::randomBytes(1024 * 1024 + 123);
+    QBuffer buffer;
+    buffer.setData(data);
+    buffer.open(QIODevice::ReadOnly);
+
+    std::atomic<int> notifications = 0;
+    FileReadAhead readAhead(&buffer, data.size(), 64 * 1024, [&notifications] {
+        notifications++;
+    });
+
+    QByteArray read;
+    auto largerChunks = 0;
+    while (!readAhead.atEnd()) {
+        auto chunk = takeNext(&readAhead);
+        ASSERT_FALSE(chunk.isEmpty());
+        ASSERT_LE(chunk.size(), 128 * 1024);
+        if (chunk.size() > 64 * 1024) largerChunks++;
+        read.append(chunk);
+
+        // Applies to chunks read from now on, so the ones already waiting are still the old size
+        if (read.size() == 256 * 1024) readAhead.setChunkSize(128 * 1024);
+    }
+
+    EXPECT_EQ(read, data);
+    EXPECT_GE(largerChunks, 4);
+    EXPECT_GT(notifications, 0);
+}
+
+TEST(filereadahead, shortFileFails) {
+    auto data = Cryptography::randomBytes(100 * 1024);
+    QBuffer buffer;
+    buffer.setData(data);
+    buffer.open(QIODevice::ReadOnly);
+
+    // The file claims to be bigger than it is
+    FileReadAhead readAhead(&buffer, 2 * data.size(), 64 * 1024, [] {});
+
+    EXPECT_EQ(takeNext(&readAhead).size(), 64 * 1024);
+    EXPECT_EQ(takeNext(&readAhead).size(), 36 * 1024);
+    EXPECT_TRUE(takeNext(&readAhead).isEmpty());
+    EXPECT_FALSE(readAhead.atEnd());
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/framedecoder.h"
+#include "gtest/gtest.h"
+#include <QtEndian>
+
+namespace {
+    QByteArray lengthPrefixed(const QByteArray& frame) {
+        auto beLength = qToBigEndian<quint32>(frame.length());
+        QByteArray data(reinterpret_cast<const char*>(&beLength), 4);
+        data.append(frame);
+        return data;
+    }
+} // namespace
+
+TEST(framedecoder, coalesced) {
+    QByteArray stream;
+    stream.append(lengthPrefixed("HELLO"));
+    stream.append(lengthPrefixed(""));
+    stream.append(lengthPrefixed("WORLD!"));
+
+    FrameDecoder decoder(8);
+    decoder.append(stream);
+
+    QByteArrayView frame;
+    ASSERT_TRUE(decoder.nextFrame(&frame));
+    EXPECT_EQ(frame, QByteArrayView("HELLO"));
+    ASSERT_TRUE(decoder.nextFrame(&frame));
+    EXPECT_TRUE(frame.isEmpty());
+    ASSERT_TRUE(decoder.nextFrame(&frame));
+    EXPECT_EQ(frame, QByteArrayView("WORLD!"));
+    EXPECT_FALSE(decoder.nextFrame(&frame));
+    EXPECT_EQ(decoder.bufferedBytes(), 0);
+}
+
+TEST(framedecoder, fragmented) {
+    QByteArray expected(3000, 'A');
+    for (auto i = 0; i < expected.length(); i++) expected[i] = static_cast<char>(i);
+
+    QByteArray stream;
+    stream.append(lengthPrefixed(expected));
+    stream.append(lengthPrefixed(expected));
+
+    FrameDecoder decoder(16);
+    QList<QByteArray> frames;
+    for (auto i = 0; i < stream.length(); i += 7) {
+        decoder.append(QByteArrayView(stream).sliced(i, qMin<qsizetype>(7, stream.length() - i)));
+
+        QByteArrayView frame;
+        while (decoder.nextFrame(&frame)) frames.append(frame.toByteArray());
+    }
+
+    ASSERT_EQ(frames.length(), 2);
+    EXPECT_EQ(frames.at(0), expected);
+    EXPECT_EQ(frames.at(1), expected);
+}
+
+TEST(framedecoder, splitLengthPrefix) {
+    auto stream = lengthPrefixed("FRAME");
+
+    FrameDecoder decoder;
+    QByteArrayView frame;
+
+    decoder.append(QByteArrayView(stream).first(2));
+    EXPECT_FALSE(decoder.nextFrame(&frame));
+    decoder.append(QByteArrayView(stream).sliced(2, 3));
+    EXPECT_FALSE(decoder.nextFrame(&frame));
+    decoder.append(QByteArrayView(stream).sliced(5));
+    ASSERT_TRUE(decoder.nextFrame(&frame));
+    EXPECT_EQ(frame, QByteArrayView("FRAME"));
+}
+
+TEST(framedecoder, oversizedLengthPrefix) {
+    // A prefix claiming about 4 GiB, followed by a little data
+    QByteArray stream(4, '\xFF');
+    stream.append(QByteArray(1000, 'X'));
+
+    FrameDecoder decoder(16);
+    decoder.append(stream);
+
+    QByteArrayView frame;
+    EXPECT_FALSE(decoder.nextFrame(&frame));
+    EXPECT_TRUE(decoder.hasOversizedFrame());
+
+    // Only the bytes that arrived were buffered
+    EXPECT_LT(decoder.capacity(), 4096);
+
+    // A frame at the limit is still fine
+    FrameDecoder limit(16);
+    auto beLength = qToBigEndian<quint32>(FrameDecoder::MaxFrameLength);
+    limit.append(QByteArrayView(reinterpret_cast<const char*>(&beLength), 4));
+    limit.append(QByteArray(FrameDecoder::MaxFrameLength, 'Y'));
+    ASSERT_TRUE(limit.nextFrame(&frame));
+    EXPECT_EQ(frame.size(), FrameDecoder::MaxFrameLength);
+    EXPECT_FALSE(limit.hasOversizedFrame());
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/cryptography.h"
+#include "nearbyshare/cryptosession.h"
+#include "nearbyshare/filereadahead.h"
+#include "nearbyshare/mappedfile.h"
+#include "nearbyshare/payloadframeencoder.h"
+#include "gtest/gtest.h"
+#include <QFile>
+#include <QThread>
+
+#ifdef Q_OS_LINUX
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+
+namespace {
+    int memfdWith(const QByteArray& data, unsigned int flags) {
+        auto fd = memfd_create("mappedfile-test", flags);
+        EXPECT_NE(fd, -1);
+        EXPECT_EQ(write(fd, data.constData(), data.size()), data.size());
+        lseek(fd, 0, SEEK_SET);
+        return fd;
+    }
+} // namespace
+
+TEST(mappedfile, mapsRegularFiles) {
+    auto data = Cryptography::randomBytes(1024 * 1024);
+    auto fd = memfdWith(data, 0);
+
+    QFile file;
+    ASSERT_TRUE(file.open(fd, QIODevice::ReadOnly));
+    auto mapping = MappedFile::map(&file, data.size());
+    ASSERT_NE(mapping, nullptr);
+
+    QByteArray sent;
+    while (!mapping->atEnd()) {
+        auto chunk = mapping->take(64 * 1024);
+        ASSERT_FALSE(chunk.isEmpty());
+
+        QByteArray copied(chunk.size(), Qt::Uninitialized);
+        EXPECT_TRUE(MappedFile::copy(copied.data(), chunk));
+        sent.append(copied);
+    }
+    EXPECT_EQ(sent, data);
+
+    delete mapping;
+    file.close();
+    close(fd);
+}
+
+TEST(mappedfile, truncatedFileFailsInsteadOfCrashing) {
+    auto data = Cryptography::randomBytes(1024 * 1024);
+    auto fd = memfdWith(data, 0);
+
+    // Chunks are views of the mapping, like the ones MappedFile hands out
+    QFile file;
+    ASSERT_TRUE(file.open(fd, QIODevice::ReadOnly));
+    auto mapping = file.map(0, data.size());
+    ASSERT_NE(mapping, nullptr);
+    QByteArrayView first(mapping, 256 * 1024);
+    QByteArrayView second(mapping + 256 * 1024, 256 * 1024);
+
+    // Someone truncates the file after both chunks were read but before the second one is encrypted
+    ASSERT_EQ(ftruncate(fd, 256 * 1024), 0);
+
+    QByteArray copied(second.size(), Qt::Uninitialized);
+    EXPECT_TRUE(MappedFile::copy(copied.data(), first));
+    EXPECT_FALSE(MappedFile::copy(copied.data(), second));
+
+    // So encoding the chunk fails, which fails the transfer
+    auto key = Cryptography::randomBytes(32);
+    auto hmacKey = Cryptography::randomBytes(32);
+    CryptoSession session(key, key, hmacKey, hmacKey);
+    PayloadFrameEncoder::Chunk chunk;
+    chunk.id = 12;
+    chunk.payloadType = location::nearby::connections::PayloadTransferFrame_PayloadHeader_PayloadType_FILE;
+    chunk.totalSize = data.size();
+    chunk.offset = first.size();
+    chunk.flags = 0;
+    chunk.body = second;
+    EXPECT_TRUE(PayloadFrameEncoder::encode(chunk, 1, Cryptography::randomBytes(16), &session).isEmpty());
+    EXPECT_TRUE(PayloadFrameEncoder::encode({chunk}, 1, {Cryptography::randomBytes(16)}, &session).isEmpty());
+
+    file.unmap(mapping);
+    file.close();
+    close(fd);
+}
+
+TEST(mappedfile, truncatedFileIsReadShort) {
+    auto data = Cryptography::randomBytes(1024 * 1024);
+    auto fd = memfdWith(data, 0);
+
+    // Devices that aren't mapped are read ahead instead
+    QFile file;
+    ASSERT_TRUE(file.open(fd, QIODevice::ReadOnly));
+    auto readAhead = new FileReadAhead(&file, data.size(), 64 * 1024, [] {});
+    QByteArray chunk;
+    while (!readAhead->take(&chunk)) QThread::yieldCurrentThread();
+    ASSERT_FALSE(chunk.isEmpty());
+
+    // Truncated partway through the send: the transfer fails rather than reading past the end of the file
+    ASSERT_EQ(ftruncate(fd, 256 * 1024), 0);
+    qint64 sent = chunk.size();
+    while (!readAhead->atEnd()) {
+        while (!readAhead->take(&chunk)) QThread::yieldCurrentThread();
+        if (chunk.isEmpty()) break;
+        sent += chunk.size();
+    }
+    EXPECT_TRUE(chunk.isEmpty());
+    EXPECT_LE(sent, 256 * 1024);
+
+    delete readAhead;
+    file.close();
+    close(fd);
+}
+#endif
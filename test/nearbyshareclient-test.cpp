@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/cryptography.h"
+#include "nearbyshare/nearbyshareclient.h"
+#include "gtest/gtest.h"
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QHostAddress>
+#include <QMap>
+#include <QTcpServer>
+#include <QStringList>
+#include <QTcpSocket>
+#include <QTemporaryDir>
+#include <QTimer>
+#include <functional>
+
+#ifdef Q_OS_LINUX
+    #include <sys/stat.h>
+#endif
+
+// These run a sending and a receiving client against each other over loopback, so they go through the whole
+// handshake and the same socket code a real transfer does.
+
+namespace {
+    // The clients need an event loop, which needs an application
+    void ensureApplication() {
+        static int argc = 1;
+        static char name[] = "tests";
+        static char* argv[] = {name, nullptr};
+        if (!QCoreApplication::instance()) new QCoreApplication(argc, argv);
+    }
+
+    // Runs the event loop until done() returns true. Returns false if that takes longer than ten seconds.
+    bool runUntil(const std::function<bool()>& done) {
+        if (done()) return true;
+
+        QEventLoop loop;
+        QTimer poll;
+        QObject::connect(&poll, &QTimer::timeout, &loop, [&loop, &done] {
+            if (done()) loop.quit();
+        });
+        poll.start(10);
+        QTimer::singleShot(10000, &loop, [&loop] {
+            loop.exit(1);
+        });
+        return loop.exec() == 0;
+    }
+
+    // A sending client connected to a receiving one. Received files go to the Downloads folder of a temporary home.
+    class Transfer {
+        public:
+            explicit Transfer(const QList<NearbyShareClient::LocalFile>& files, NearbyShareClient::TransferOrder transferOrder = NearbyShareClient::TransferOrder::RoundRobin) {
+                ensureApplication();
+                qputenv("HOME", home.path().toLocal8Bit());
+                qunsetenv("XDG_CONFIG_HOME");
+                QDir(home.path()).mkpath("Downloads");
+
+                server.listen(QHostAddress::LocalHost);
+                QObject::connect(&server, &QTcpServer::newConnection, &server, [this] {
+                    receiver = NearbyShareClient::clientForReceive(server.nextPendingConnection());
+                });
+
+                auto connection = new QTcpSocket();
+                connection->connectToHost(QHostAddress::LocalHost, server.serverPort());
+                sender = NearbyShareClient::clientForSend(connection, QStringLiteral("Test"), files, transferOrder);
+                connection->setParent(sender);
+            }
+
+            ~Transfer() {
+                delete sender;
+                delete receiver;
+            }
+
+            // Waits for the receiver to be asked whether to accept the files
+            bool negotiate() {
+                return runUntil([this] {
+                    return receiver && receiver->state() == NearbyShareClient::State::WaitingForUserAccept;
+                });
+            }
+
+            bool finish() {
+                return runUntil([this] {
+                    return isDone(sender) && isDone(receiver);
+                });
+            }
+
+            // Keeps a snapshot of how much of each file the receiver has every time that changes
+            void recordProgress() {
+                QObject::connect(receiver, &NearbyShareClient::filesToTransferChanged, receiver, [this] {
+                    QMap<QString, quint64> snapshot;
+                    for (const auto& file : receiver->filesToTransfer()) snapshot.insert(file.fileName, file.transferred);
+                    progress.append(snapshot);
+                });
+            }
+
+            QString downloadedFile(const QString& fileName) {
+                return QDir(home.path()).absoluteFilePath(QStringLiteral("Downloads/%1").arg(fileName));
+            }
+
+            QTemporaryDir home;
+            QTcpServer server;
+            NearbyShareClient* sender = nullptr;
+            NearbyShareClient* receiver = nullptr;
+            QList<QMap<QString, quint64>> progress;
+
+        private:
+            static bool isDone(NearbyShareClient* client) {
+                return client && (client->state() == NearbyShareClient::State::Complete || client->state() == NearbyShareClient::State::Failed);
+            }
+    };
+
+    // Buffers of random data to send, named order-1.bin, order-2.bin and so on
+    class SourceFiles {
+        public:
+            explicit SourceFiles(const QList<int>& sizes, const QList<int>& priorities = {}) {
+                for (auto i = 0; i < sizes.length(); i++) {
+                    auto buffer = new QBuffer();
+                    buffer->setData(Cryptography::randomBytes(sizes.at(i)));
+                    buffer->open(QIODevice::ReadOnly);
+                    buffers.append(buffer);
+
+                    NearbyShareClient::LocalFile file{buffer, QStringLiteral("order-%1.bin").arg(i + 1), static_cast<quint64>(sizes.at(i))};
+                    if (i < priorities.length()) file.priority = priorities.at(i);
+                    files.append(file);
+                }
+            }
+
+            ~SourceFiles() {
+                qDeleteAll(buffers);
+            }
+
+            quint64 size(const QString& fileName) const {
+                for (const auto& file : files) {
+                    if (file.fileName == fileName) return file.size;
+                }
+                return 0;
+            }
+
+            QList<NearbyShareClient::LocalFile> files;
+
+        private:
+            QList<QBuffer*> buffers;
+    };
+
+    // Whether the receiver got the files one at a time in the given order, so that no file had any data before
+    // every file ahead of it was complete
+    bool receivedInOrder(const Transfer& transfer, const SourceFiles& source, const QStringList& order) {
+        for (const auto& snapshot : transfer.progress) {
+            for (auto i = 1; i < order.length(); i++) {
+                if (snapshot.value(order.at(i)) == 0) continue;
+                for (auto j = 0; j < i; j++) {
+                    if (snapshot.value(order.at(j)) != source.size(order.at(j))) return false;
+                }
+            }
+        }
+        return !transfer.progress.isEmpty();
+    }
+
+    // Whether at some point the receiver had part of more than one file
+    bool receivedInterleaved(const Transfer& transfer, const SourceFiles& source) {
+        for (const auto& snapshot : transfer.progress) {
+            auto partial = 0;
+            for (const auto& fileName : snapshot.keys()) {
+                auto transferred = snapshot.value(fileName);
+                if (transferred > 0 && transferred < source.size(fileName)) partial++;
+            }
+            if (partial > 1) return true;
+        }
+        return false;
+    }
+
+    // Sends the files, accepts them and waits for the transfer to finish, recording the receiver's progress
+    void runTransfer(Transfer* transfer) {
+        ASSERT_TRUE(transfer->negotiate());
+        transfer->recordProgress();
+        transfer->receiver->acceptTransfer();
+        ASSERT_TRUE(transfer->finish());
+        ASSERT_EQ(transfer->receiver->state(), NearbyShareClient::State::Complete);
+    }
+} // namespace
+
+TEST(nearbyshareclient, emptyFilesComplete) {
+    QBuffer first;
+    QBuffer second;
+    first.open(QIODevice::ReadOnly);
+    second.open(QIODevice::ReadOnly);
+
+    Transfer transfer({
+        {&first, QStringLiteral("empty-1.txt"), 0},
+        {&second, QStringLiteral("empty-2.txt"), 0}
+    });
+    ASSERT_TRUE(transfer.negotiate());
+    transfer.receiver->acceptTransfer();
+    ASSERT_TRUE(transfer.finish());
+
+    // There is no data for either side to wait on, but both still finish
+    EXPECT_EQ(transfer.sender->state(), NearbyShareClient::State::Complete);
+    EXPECT_EQ(transfer.receiver->state(), NearbyShareClient::State::Complete);
+    for (const auto& fileName : {QStringLiteral("empty-1.txt"), QStringLiteral("empty-2.txt")}) {
+        QFile file(transfer.downloadedFile(fileName));
+        EXPECT_TRUE(file.exists());
+        EXPECT_EQ(file.size(), 0);
+    }
+}
+
+TEST(nearbyshareclient, acceptReceivesFiles) {
+    auto firstData = Cryptography::randomBytes(3 * 1024 * 1024 + 17);
+    auto secondData = Cryptography::randomBytes(100 * 1024);
+    QBuffer first;
+    QBuffer second;
+    first.setData(firstData);
+    second.setData(secondData);
+    first.open(QIODevice::ReadOnly);
+    second.open(QIODevice::ReadOnly);
+
+    Transfer transfer({
+        {&first, QStringLiteral("accept-1.bin"), static_cast<quint64>(firstData.size())},
+        {&second, QStringLiteral("accept-2.bin"), static_cast<quint64>(secondData.size())}
+    });
+    ASSERT_TRUE(transfer.negotiate());
+    transfer.receiver->acceptTransfer();
+    ASSERT_TRUE(transfer.finish());
+
+    EXPECT_EQ(transfer.sender->state(), NearbyShareClient::State::Complete);
+    EXPECT_EQ(transfer.receiver->state(), NearbyShareClient::State::Complete);
+
+    QFile firstReceived(transfer.downloadedFile("accept-1.bin"));
+    QFile secondReceived(transfer.downloadedFile("accept-2.bin"));
+    ASSERT_TRUE(firstReceived.open(QIODevice::ReadOnly));
+    ASSERT_TRUE(secondReceived.open(QIODevice::ReadOnly));
+    EXPECT_EQ(firstReceived.readAll(), firstData);
+    EXPECT_EQ(secondReceived.readAll(), secondData);
+}
+
+TEST(nearbyshareclient, rejectFailsBothSides) {
+    QBuffer file;
+    file.setData(QByteArray(1024, 'R'));
+    file.open(QIODevice::ReadOnly);
+
+    Transfer transfer({
+        {&file, QStringLiteral("reject.bin"), 1024}
+    });
+    ASSERT_TRUE(transfer.negotiate());
+    transfer.receiver->rejectTransfer();
+    ASSERT_TRUE(transfer.finish());
+
+    EXPECT_EQ(transfer.sender->state(), NearbyShareClient::State::Failed);
+    EXPECT_EQ(transfer.sender->failedReason(), NearbyShareClient::FailedReason::RemoteDeclined);
+    EXPECT_EQ(transfer.receiver->state(), NearbyShareClient::State::Failed);
+    EXPECT_FALSE(QFile::exists(transfer.downloadedFile("reject.bin")));
+}
+
+TEST(nearbyshareclient, acceptWithoutSpaceFails) {
+    // Far more than any filesystem here can hold; it is never read, since the receiver turns it down
+    QBuffer file;
+    file.open(QIODevice::ReadOnly);
+
+    Transfer transfer({
+        {&file, QStringLiteral("huge.bin"), quint64(1) << 62}
+    });
+    ASSERT_TRUE(transfer.negotiate());
+    transfer.receiver->acceptTransfer();
+    if (transfer.receiver->state() == NearbyShareClient::State::Transferring) {
+        GTEST_SKIP() << "The filesystem can't set space aside";
+    }
+    ASSERT_TRUE(transfer.finish());
+
+    EXPECT_EQ(transfer.receiver->state(), NearbyShareClient::State::Failed);
+    EXPECT_EQ(transfer.receiver->failedReason(), NearbyShareClient::FailedReason::OutOfSpace);
+    EXPECT_EQ(transfer.sender->state(), NearbyShareClient::State::Failed);
+    EXPECT_EQ(transfer.sender->failedReason(), NearbyShareClient::FailedReason::RemoteOutOfSpace);
+    EXPECT_FALSE(QFile::exists(transfer.downloadedFile("huge.bin")));
+}
+
+#ifdef Q_OS_LINUX
+TEST(nearbyshareclient, failedTransferReleasesSpace) {
+    // The sender claims far more than it has, so it fails once the data runs out
+    constexpr qint64 ClaimedSize = 256 * 1024 * 1024;
+    QBuffer file;
+    file.setData(Cryptography::randomBytes(1024 * 1024));
+    file.open(QIODevice::ReadOnly);
+
+    Transfer transfer({
+        {&file, QStringLiteral("short.bin"), ClaimedSize}
+    });
+    ASSERT_TRUE(transfer.negotiate());
+    transfer.receiver->acceptTransfer();
+    ASSERT_TRUE(transfer.finish());
+    EXPECT_EQ(transfer.receiver->state(), NearbyShareClient::State::Failed);
+
+    // What arrived is kept, but the rest of the space that was set aside isn't
+    struct stat status;
+    ASSERT_EQ(stat(transfer.downloadedFile("short.bin").toLocal8Bit().constData(), &status), 0);
+    EXPECT_LE(status.st_size, 1024 * 1024);
+    EXPECT_LT(status.st_blocks * 512, ClaimedSize / 2);
+}
+#endif
+
+TEST(nearbyshareclient, sequentialOrderSendsFilesInTurn) {
+    SourceFiles source({3 * 1024 * 1024, 2 * 1024 * 1024, 1024 * 1024});
+    Transfer transfer(source.files, NearbyShareClient::TransferOrder::Sequential);
+    ASSERT_NO_FATAL_FAILURE(runTransfer(&transfer));
+    EXPECT_TRUE(receivedInOrder(transfer, source, {"order-1.bin", "order-2.bin", "order-3.bin"}));
+}
+
+TEST(nearbyshareclient, smallestFirstOrderSendsSmallerFilesFirst) {
+    SourceFiles source({3 * 1024 * 1024, 1024 * 1024, 2 * 1024 * 1024});
+    Transfer transfer(source.files, NearbyShareClient::TransferOrder::SmallestFirst);
+    ASSERT_NO_FATAL_FAILURE(runTransfer(&transfer));
+    EXPECT_TRUE(receivedInOrder(transfer, source, {"order-2.bin", "order-3.bin", "order-1.bin"}));
+}
+
+TEST(nearbyshareclient, priorityOrderKeepsTiesInOrder) {
+    // The two files with the highest priority tie, so they go in the order they were given
+    SourceFiles source({2 * 1024 * 1024, 2 * 1024 * 1024, 2 * 1024 * 1024, 2 * 1024 * 1024}, {0, 5, 5, 1});
+    Transfer transfer(source.files, NearbyShareClient::TransferOrder::Priority);
+    ASSERT_NO_FATAL_FAILURE(runTransfer(&transfer));
+    EXPECT_TRUE(receivedInOrder(transfer, source, {"order-2.bin", "order-3.bin", "order-4.bin", "order-1.bin"}));
+}
+
+TEST(nearbyshareclient, roundRobinOrderInterleavesFiles) {
+    SourceFiles source({4 * 1024 * 1024, 4 * 1024 * 1024, 4 * 1024 * 1024});
+    Transfer transfer(source.files, NearbyShareClient::TransferOrder::RoundRobin);
+    ASSERT_NO_FATAL_FAILURE(runTransfer(&transfer));
+    EXPECT_TRUE(receivedInterleaved(transfer, source));
+}
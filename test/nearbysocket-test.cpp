@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/abstractnearbypayload.h"
+#include "nearbyshare/cryptography.h"
+#include "nearbyshare/nearbysocket.h"
+#include "gtest/gtest.h"
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QHostAddress>
+#include <QMap>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTimer>
+#include <functional>
+
+namespace {
+    // The sockets need an event loop, which needs an application
+    void ensureApplication() {
+        static int argc = 1;
+        static char name[] = "tests";
+        static char* argv[] = {name, nullptr};
+        if (!QCoreApplication::instance()) new QCoreApplication(argc, argv);
+    }
+
+    // Runs the event loop until done() returns true. Returns false if that takes longer than ten seconds.
+    bool runUntil(const std::function<bool()>& done) {
+        if (done()) return true;
+
+        QEventLoop loop;
+        QTimer poll;
+        QObject::connect(&poll, &QTimer::timeout, &loop, [&loop, &done] {
+            if (done()) loop.quit();
+        });
+        poll.start(10);
+        QTimer::singleShot(10000, &loop, [&loop] {
+            loop.exit(1);
+        });
+        return loop.exec() == 0;
+    }
+
+    // Two NearbySockets that have finished the handshake with each other over loopback
+    class SocketPair {
+        public:
+            SocketPair() {
+                ensureApplication();
+                server.listen(QHostAddress::LocalHost);
+                QObject::connect(&server, &QTcpServer::newConnection, &server, [this] {
+                    receiverConnection = server.nextPendingConnection();
+                    receiver = new NearbySocket(receiverConnection, true, receiverConnection);
+                });
+
+                senderConnection = new QTcpSocket();
+                senderConnection->connectToHost(QHostAddress::LocalHost, server.serverPort());
+                sender = new NearbySocket(senderConnection, false, senderConnection);
+            }
+
+            ~SocketPair() {
+                delete senderConnection;
+            }
+
+            bool connect() {
+                auto encrypted = false;
+                QObject::connect(sender, &NearbySocket::readyForEncryptedMessages, sender, [&encrypted] {
+                    encrypted = true;
+                });
+                return runUntil([&encrypted] {
+                    return encrypted;
+                });
+            }
+
+            // Shrinks the kernel buffers on both ends, so that sendmsg() can only take part of what is queued and the
+            // rest has to go through QTcpSocket's own buffer
+            void shrinkSocketBuffers() {
+                senderConnection->setSocketOption(QAbstractSocket::SendBufferSizeSocketOption, 4096);
+                receiverConnection->setSocketOption(QAbstractSocket::ReceiveBufferSizeSocketOption, 4096);
+            }
+
+            // Has the receiver collect payload id into output (or a buffer of its own), and counts the frames it
+            // arrives in. The payload takes ownership of output.
+            AbstractNearbyPayloadPtr receive(qint64 id, int* frames, QBuffer* output = nullptr) {
+                auto payload = AbstractNearbyPayloadPtr(new AbstractNearbyPayload(id, false));
+                if (!output) output = new QBuffer();
+                output->open(QIODevice::WriteOnly);
+                payload->setOutput(output);
+                QObject::connect(payload.data(), &AbstractNearbyPayload::transferredChanged, payload.data(), [frames] {
+                    (*frames)++;
+                });
+                receiver->insertPendingPayload(id, payload);
+                return payload;
+            }
+
+            QTcpServer server;
+            QTcpSocket* senderConnection;
+            QTcpSocket* receiverConnection = nullptr;
+            NearbySocket* sender;
+            NearbySocket* receiver = nullptr;
+    };
+} // namespace
+
+TEST(nearbysocket, payloadPacketIsOneFrame) {
+    SocketPair sockets;
+    ASSERT_TRUE(sockets.connect());
+    ASSERT_NE(sockets.receiver, nullptr);
+
+    // However big the packet, it goes out as a single frame followed by the LAST_CHUNK marker
+    auto packet = Cryptography::randomBytes(1024 * 1024);
+    auto frames = 0;
+    auto payload = sockets.receive(7, &frames);
+    sockets.sender->sendPayloadPacket(packet, 7, NearbySocket::File, 0, true, packet.size());
+    ASSERT_TRUE(runUntil([&payload] {
+        return payload->completed();
+    }));
+
+    EXPECT_EQ(frames, 2);
+    EXPECT_EQ(payload->bytesTransferred(), static_cast<quint64>(packet.size()));
+}
+
+TEST(nearbysocket, queuedPacketsArriveInOrder) {
+    SocketPair sockets;
+    ASSERT_TRUE(sockets.connect());
+    ASSERT_NE(sockets.receiver, nullptr);
+
+    // Packets queued in one go are encrypted together, more of them than fit in one batch, and alternating between
+    // two payloads so each batch holds frames of both
+    auto firstFrames = 0;
+    auto secondFrames = 0;
+    auto firstOutput = new QBuffer();
+    auto secondOutput = new QBuffer();
+    auto first = sockets.receive(8, &firstFrames, firstOutput);
+    auto second = sockets.receive(9, &secondFrames, secondOutput);
+    QByteArray firstData;
+    QByteArray secondData;
+    constexpr int Packets = 20;
+    constexpr int PacketSize = 4096;
+    for (auto i = 0; i < Packets; i++) {
+        auto firstPacket = Cryptography::randomBytes(PacketSize);
+        auto secondPacket = Cryptography::randomBytes(PacketSize);
+        auto last = i == Packets - 1;
+        sockets.sender->sendPayloadPacket(firstPacket, 8, NearbySocket::File, firstData.size(), last, Packets * PacketSize);
+        sockets.sender->sendPayloadPacket(secondPacket, 9, NearbySocket::File, secondData.size(), last, Packets * PacketSize);
+        firstData.append(firstPacket);
+        secondData.append(secondPacket);
+    }
+    ASSERT_TRUE(runUntil([&first, &second] {
+        return first->completed() && second->completed();
+    }));
+
+    EXPECT_EQ(firstFrames, Packets + 1);
+    EXPECT_EQ(secondFrames, Packets + 1);
+    EXPECT_EQ(firstOutput->data(), firstData);
+    EXPECT_EQ(secondOutput->data(), secondData);
+}
+
+TEST(nearbysocket, partialWritesArriveIntact) {
+    SocketPair sockets;
+    ASSERT_TRUE(sockets.connect());
+    ASSERT_NE(sockets.receiver, nullptr);
+    sockets.shrinkSocketBuffers();
+    sockets.sender->setWriteWatermarks(4 * 1024 * 1024, 16 * 1024 * 1024);
+
+    // QTcpSocket only reports bytesWritten for data that went through its buffer, so this shows the kernel took
+    // part of a write and handed the rest over
+    auto handedOver = false;
+    QObject::connect(sockets.senderConnection, &QIODevice::bytesWritten, sockets.senderConnection, [&handedOver] {
+        handedOver = true;
+    });
+
+    auto frames = 0;
+    auto output = new QBuffer();
+    auto payload = sockets.receive(10, &frames, output);
+    QByteArray data;
+    constexpr int Packets = 4;
+    constexpr int PacketSize = 1024 * 1024;
+    for (auto i = 0; i < Packets; i++) {
+        auto packet = Cryptography::randomBytes(PacketSize);
+        sockets.sender->sendPayloadPacket(packet, 10, NearbySocket::File, data.size(), i == Packets - 1, Packets * PacketSize);
+        data.append(packet);
+    }
+    ASSERT_TRUE(runUntil([&payload] {
+        return payload->completed();
+    }));
+
+    EXPECT_TRUE(handedOver);
+    EXPECT_EQ(output->data(), data);
+}
+
+TEST(nearbysocket, payloadBytesWrittenCountsEveryByte) {
+    SocketPair sockets;
+    ASSERT_TRUE(sockets.connect());
+    ASSERT_NE(sockets.receiver, nullptr);
+    sockets.shrinkSocketBuffers();
+
+    QMap<qint64, qint64> written;
+    QObject::connect(sockets.sender, &NearbySocket::payloadBytesWritten, sockets.sender, [&written](qint64 id, qint64 bytes) {
+        written[id] += bytes;
+    });
+
+    // Two payloads of different sizes, interleaved, with chunks that end in the middle of writes
+    auto firstFrames = 0;
+    auto secondFrames = 0;
+    auto first = sockets.receive(11, &firstFrames);
+    auto second = sockets.receive(12, &secondFrames);
+    constexpr int Packets = 8;
+    constexpr int FirstPacketSize = 300 * 1024;
+    constexpr int SecondPacketSize = 70 * 1024 + 3;
+    auto firstPacket = Cryptography::randomBytes(FirstPacketSize);
+    auto secondPacket = Cryptography::randomBytes(SecondPacketSize);
+    for (auto i = 0; i < Packets; i++) {
+        auto last = i == Packets - 1;
+        sockets.sender->sendPayloadPacket(firstPacket, 11, NearbySocket::File, i * FirstPacketSize, last, Packets * FirstPacketSize);
+        sockets.sender->sendPayloadPacket(secondPacket, 12, NearbySocket::File, i * SecondPacketSize, last, Packets * SecondPacketSize);
+    }
+    ASSERT_TRUE(runUntil([&first, &second] {
+        return first->completed() && second->completed();
+    }));
+
+    // Bytes only count once the kernel has them, which is before the receiver can finish
+    EXPECT_EQ(written.value(11), Packets * FirstPacketSize);
+    EXPECT_EQ(written.value(12), Packets * SecondPacketSize);
+    EXPECT_EQ(sockets.sender->payloadBytesInFlight(), 0);
+}
@@ -0,0 +1,205 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/cryptography.h"
+#include "nearbyshare/cryptosession.h"
+#include "nearbyshare/payloadframeencoder.h"
+#include "device_to_device_messages.pb.h"
+#include "securegcm.pb.h"
+#include "securemessage.pb.h"
+#include "gtest/gtest.h"
+#include <QtEndian>
+
+namespace {
+    // Builds the frame the same way the generic send path does, using the generated protobuf classes
+    QByteArray referenceFrame(const PayloadFrameEncoder::Chunk& chunk, qint32 sequenceNumber, const QByteArray& iv, const QByteArray& encryptKey, const QByteArray& hmacKey) {
+        location::nearby::connections::OfflineFrame offlineFrame;
+        offlineFrame.set_version(location::nearby::connections::OfflineFrame_Version_V1);
+        auto v1 = offlineFrame.mutable_v1();
+        v1->set_type(location::nearby::connections::V1Frame_FrameType_PAYLOAD_TRANSFER);
+        auto payloadTransfer = v1->mutable_payload_transfer();
+        payloadTransfer->set_packet_type(location::nearby::connections::PayloadTransferFrame_PacketType_DATA);
+        auto payloadHeader = payloadTransfer->mutable_payload_header();
+        payloadHeader->set_id(chunk.id);
+        payloadHeader->set_type(chunk.payloadType);
+        payloadHeader->set_total_size(chunk.totalSize);
+        payloadHeader->set_is_sensitive(false);
+        auto payloadChunk = payloadTransfer->mutable_payload_chunk();
+        payloadChunk->set_offset(chunk.offset);
+        payloadChunk->set_flags(chunk.flags);
+        payloadChunk->set_body(chunk.body.data(), chunk.body.size());
+
+        securegcm::DeviceToDeviceMessage d2dm;
+        d2dm.set_sequence_number(sequenceNumber);
+        d2dm.set_message(offlineFrame.SerializeAsString());
+
+        auto encrypted = Cryptography::aes256cbcEncrypt(QByteArray::fromStdString(d2dm.SerializeAsString()), encryptKey, iv);
+
+        securegcm::GcmMetadata metadata;
+        metadata.set_type(securegcm::DEVICE_TO_DEVICE_MESSAGE);
+        metadata.set_version(1);
+
+        securemessage::HeaderAndBody headerAndBody;
+        auto header = headerAndBody.mutable_header();
+        header->set_encryption_scheme(securemessage::AES_256_CBC);
+        header->set_signature_scheme(securemessage::HMAC_SHA256);
+        header->set_public_metadata(metadata.SerializeAsString());
+        header->set_iv(iv.toStdString());
+        headerAndBody.set_body(encrypted.toStdString());
+
+        auto headerAndBodyBytes = QByteArray::fromStdString(headerAndBody.SerializeAsString());
+
+        securemessage::SecureMessage message;
+        message.set_signature(Cryptography::hmacSha256Signature(headerAndBodyBytes, hmacKey).toStdString());
+        message.set_header_and_body(headerAndBodyBytes.toStdString());
+
+        auto frame = QByteArray::fromStdString(message.SerializeAsString());
+        auto bePacketLength = qToBigEndian<quint32>(frame.length());
+        frame.prepend(reinterpret_cast<char*>(&bePacketLength), 4);
+        return frame;
+    }
+} // namespace
+
+TEST(payloadframeencoder, matchesGenericPath) {
+    auto encryptKey = Cryptography::randomBytes(32);
+    auto hmacKey = Cryptography::randomBytes(32);
+    auto iv = Cryptography::randomBytes(16);
+    CryptoSession session(encryptKey, encryptKey, hmacKey, hmacKey);
+
+    for (auto bodyLength : {0, 1, 15, 16, 127, 128, 1000, 16383, 16384, 512 * 1024}) {
+        QByteArray body(bodyLength, 'A');
+        for (auto i = 0; i < bodyLength; i++) body[i] = static_cast<char>(i * 31);
+
+        PayloadFrameEncoder::Chunk chunk;
+        chunk.id = 0x0123456789ABCDEF;
+        chunk.payloadType = location::nearby::connections::PayloadTransferFrame_PayloadHeader_PayloadType_FILE;
+        chunk.totalSize = 10 * 1024 * 1024;
+        chunk.offset = 3 * 1024 * 1024;
+        chunk.flags = 0;
+        chunk.body = body;
+
+        auto frame = PayloadFrameEncoder::encode(chunk, 42, iv, &session);
+        EXPECT_EQ(frame, referenceFrame(chunk, 42, iv, encryptKey, hmacKey)) << "body length " << bodyLength;
+    }
+}
+
+TEST(payloadframeencoder, negativeValues) {
+    auto encryptKey = Cryptography::randomBytes(32);
+    auto hmacKey = Cryptography::randomBytes(32);
+    auto iv = Cryptography::randomBytes(16);
+    CryptoSession session(encryptKey, encryptKey, hmacKey, hmacKey);
+
+    // Negative int32 and int64 fields take the full ten bytes on the wire
+    PayloadFrameEncoder::Chunk chunk;
+    chunk.id = -5;
+    chunk.payloadType = location::nearby::connections::PayloadTransferFrame_PayloadHeader_PayloadType_BYTES;
+    chunk.totalSize = 0;
+    chunk.offset = 0;
+    chunk.flags = location::nearby::connections::PayloadTransferFrame_PayloadChunk_Flags_LAST_CHUNK;
+    chunk.body = {};
+
+    auto frame = PayloadFrameEncoder::encode(chunk, -1, iv, &session);
+    EXPECT_EQ(frame, referenceFrame(chunk, -1, iv, encryptKey, hmacKey));
+}
+
+TEST(payloadframeencoder, gcm) {
+    auto key = Cryptography::randomBytes(32);
+    CryptoSession session(key, key, {}, {}, CryptoSession::Aes256Gcm);
+    ASSERT_TRUE(session.isValid());
+
+    QByteArray body(70000, 'G');
+    QList<PayloadFrameEncoder::Chunk> chunks;
+    QList<QByteArray> ivs;
+    for (auto bodyLength : {0, 1, 17, 65536, 70000}) {
+        PayloadFrameEncoder::Chunk chunk;
+        chunk.id = 9;
+        chunk.payloadType = location::nearby::connections::PayloadTransferFrame_PayloadHeader_PayloadType_FILE;
+        chunk.totalSize = 1024 * 1024;
+        chunk.offset = chunks.size() * 1000;
+        chunk.flags = 0;
+        chunk.body = QByteArrayView(body).first(bodyLength);
+        chunks.append(chunk);
+        ivs.append(Cryptography::randomBytes(session.ivLength()));
+    }
+
+    auto frames = PayloadFrameEncoder::encode(chunks, 5, ivs, &session);
+    ASSERT_EQ(frames.size(), chunks.size());
+    for (auto i = 0; i < frames.size(); i++) {
+        const auto& frame = frames.at(i);
+        EXPECT_EQ(frame, PayloadFrameEncoder::encode(chunks.at(i), 5 + i, ivs.at(i), &session)) << "chunk " << i;
+
+        // Take the frame apart the way a receiver does and check that the tag covers the header
+        securemessage::SecureMessage message;
+        ASSERT_TRUE(message.ParseFromArray(frame.constData() + 4, frame.size() - 4));
+        securemessage::HeaderAndBodyInternal headerAndBody;
+        ASSERT_TRUE(headerAndBody.ParseFromString(message.header_and_body()));
+        securemessage::Header header;
+        ASSERT_TRUE(header.ParseFromString(headerAndBody.header()));
+        EXPECT_EQ(header.encryption_scheme(), securemessage::AES_256_GCM);
+        EXPECT_EQ(header.signature_scheme(), securemessage::AEAD_TAG);
+        EXPECT_EQ(QByteArray::fromStdString(header.iv()), ivs.at(i));
+
+        auto headerBytes = QByteArray::fromStdString(headerAndBody.header());
+        auto ciphertext = QByteArray::fromStdString(headerAndBody.body());
+        auto tag = QByteArray::fromStdString(message.signature());
+        QByteArray plaintext(ciphertext.length(), Qt::Uninitialized);
+        ASSERT_EQ(session.decrypt(ciphertext.constData(), ciphertext.length(), plaintext.data(), ivs.at(i), headerBytes, tag), ciphertext.length());
+
+        securegcm::DeviceToDeviceMessage d2dm;
+        ASSERT_TRUE(d2dm.ParseFromString(plaintext.toStdString()));
+        EXPECT_EQ(d2dm.sequence_number(), 5 + i);
+        location::nearby::connections::OfflineFrame offlineFrame;
+        ASSERT_TRUE(offlineFrame.ParseFromString(d2dm.message()));
+        EXPECT_EQ(offlineFrame.v1().payload_transfer().payload_chunk().body().size(), chunks.at(i).body.size());
+
+        headerBytes[headerBytes.size() - 1] = static_cast<char>(headerBytes.at(headerBytes.size() - 1) ^ 1);
+        EXPECT_EQ(session.decrypt(ciphertext.constData(), ciphertext.length(), plaintext.data(), ivs.at(i), headerBytes, tag), -1);
+    }
+}
+
+TEST(payloadframeencoder, batch) {
+    auto encryptKey = Cryptography::randomBytes(32);
+    auto hmacKey = Cryptography::randomBytes(32);
+    CryptoSession session(encryptKey, encryptKey, hmacKey, hmacKey);
+
+    // More chunks than there are lanes, of different lengths, so lanes finish and get refilled at different times
+    QByteArray body(70000, 'B');
+    QList<PayloadFrameEncoder::Chunk> chunks;
+    QList<QByteArray> ivs;
+    for (auto bodyLength : {65536, 0, 17, 1000, 70000, 16, 31, 4096, 65535, 1, 12345}) {
+        PayloadFrameEncoder::Chunk chunk;
+        chunk.id = 7;
+        chunk.payloadType = location::nearby::connections::PayloadTransferFrame_PayloadHeader_PayloadType_FILE;
+        chunk.totalSize = 1024 * 1024;
+        chunk.offset = chunks.size() * 1000;
+        chunk.flags = 0;
+        chunk.body = QByteArrayView(body).first(bodyLength);
+        chunks.append(chunk);
+        ivs.append(Cryptography::randomBytes(16));
+    }
+
+    auto frames = PayloadFrameEncoder::encode(chunks, 100, ivs, &session);
+    ASSERT_EQ(frames.size(), chunks.size());
+    for (auto i = 0; i < chunks.size(); i++) {
+        EXPECT_EQ(frames.at(i), referenceFrame(chunks.at(i), 100 + i, ivs.at(i), encryptKey, hmacKey)) << "chunk " << i;
+    }
+}
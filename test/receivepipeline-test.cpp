@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/cryptography.h"
+#include "nearbyshare/cryptosession.h"
+#include "nearbyshare/payloadframeencoder.h"
+#include "nearbyshare/receivepipeline.h"
+#include "securemessage.pb.h"
+#include "gtest/gtest.h"
+#include <QThread>
+
+namespace {
+    QByteArray frameFor(qint32 sequenceNumber, CryptoSession* session) {
+        PayloadFrameEncoder::Chunk chunk;
+        chunk.id = 11;
+        chunk.payloadType = location::nearby::connections::PayloadTransferFrame_PayloadHeader_PayloadType_BYTES;
+        chunk.totalSize = 1024;
+        chunk.offset = 0;
+        chunk.flags = 0;
+        auto body = QByteArray(1024, 'R');
+        chunk.body = body;
+
+        // Encoded frames carry the 4 byte length prefix, which the socket strips before submitting
+        return PayloadFrameEncoder::encode(chunk, sequenceNumber, Cryptography::randomBytes(16), session).mid(4);
+    }
+
+    // A correctly signed CBC frame whose header carries iv, or no IV at all if it is null
+    QByteArray frameWithIv(const QByteArray& iv, CryptoSession* session) {
+        securemessage::Header header;
+        header.set_signature_scheme(securemessage::HMAC_SHA256);
+        header.set_encryption_scheme(securemessage::AES_256_CBC);
+        if (!iv.isNull()) header.set_iv(iv.toStdString());
+
+        securemessage::HeaderAndBody headerAndBody;
+        *headerAndBody.mutable_header() = header;
+        headerAndBody.set_body(Cryptography::randomBytes(32).toStdString());
+        auto headerAndBodyBytes = QByteArray::fromStdString(headerAndBody.SerializeAsString());
+
+        securemessage::SecureMessage message;
+        message.set_header_and_body(headerAndBodyBytes.toStdString());
+        message.set_signature(session->sign(headerAndBodyBytes).toStdString());
+        return QByteArray::fromStdString(message.SerializeAsString());
+    }
+
+    QQueue<ReceivePipeline::Message> drain(ReceivePipeline* pipeline, qsizetype count) {
+        QQueue<ReceivePipeline::Message> messages;
+        while (messages.size() < count) {
+            pipeline->takeMessages(&messages);
+            QThread::yieldCurrentThread();
+        }
+        return messages;
+    }
+} // namespace
+
+TEST(receivepipeline, ordersBySequenceNumber) {
+    auto key = Cryptography::randomBytes(32);
+    auto hmacKey = Cryptography::randomBytes(32);
+    CryptoSession session(key, key, hmacKey, hmacKey);
+
+    ReceivePipeline pipeline(&session, [] {}, 3);
+    EXPECT_EQ(pipeline.lanes(), 3);
+
+    // Submitted out of order, and spread over the lanes
+    QList<qint32> sequenceNumbers = {3, 1, 2, 6, 4, 5};
+    for (auto sequenceNumber : sequenceNumbers) {
+        EXPECT_TRUE(pipeline.submit(frameFor(sequenceNumber, &session)));
+    }
+
+    auto messages = drain(&pipeline, sequenceNumbers.size());
+    ASSERT_EQ(messages.size(), sequenceNumbers.size());
+    for (auto i = 0; i < messages.size(); i++) {
+        EXPECT_EQ(messages.at(i).error, ReceivePipeline::NoError);
+        EXPECT_EQ(messages.at(i).sequenceNumber, i + 1);
+
+        EXPECT_FALSE(messages.at(i).message.isEmpty());
+    }
+    EXPECT_TRUE(pipeline.isEmpty());
+}
+
+TEST(receivepipeline, fullLanesPushBack) {
+    auto key = Cryptography::randomBytes(32);
+    auto hmacKey = Cryptography::randomBytes(32);
+    CryptoSession session(key, key, hmacKey, hmacKey);
+
+    ReceivePipeline pipeline(&session, [] {}, 1);
+    auto frame = frameFor(1, &session);
+    for (auto i = 0; i < ReceivePipeline::FramesPerLane; i++) {
+        EXPECT_TRUE(pipeline.submit(frameFor(i + 1, &session)));
+    }
+    EXPECT_TRUE(pipeline.isFull());
+    EXPECT_FALSE(pipeline.submit(frame));
+
+    drain(&pipeline, ReceivePipeline::FramesPerLane);
+    EXPECT_FALSE(pipeline.isFull());
+
+    // Numbers that have already been handed out are rejected, as are frames that have been tampered with
+    EXPECT_TRUE(pipeline.submit(frame));
+    auto tampered = frameFor(ReceivePipeline::FramesPerLane + 1, &session);
+    tampered[tampered.size() - 40] ^= 1;
+    EXPECT_TRUE(pipeline.submit(tampered));
+
+    auto messages = drain(&pipeline, 2);
+    EXPECT_EQ(messages.at(0).error, ReceivePipeline::BadSequenceNumber);
+    EXPECT_EQ(messages.at(1).error, ReceivePipeline::BadSignature);
+}
+
+TEST(receivepipeline, gapIsRejected) {
+    auto key = Cryptography::randomBytes(32);
+    auto hmacKey = Cryptography::randomBytes(32);
+    CryptoSession session(key, key, hmacKey, hmacKey);
+
+    ReceivePipeline pipeline(&session, [] {}, 2);
+    for (auto sequenceNumber : {1, 2, 4, 5}) {
+        EXPECT_TRUE(pipeline.submit(frameFor(sequenceNumber, &session)));
+    }
+
+    // 3 never arrives, so nothing after it may be delivered
+    auto messages = drain(&pipeline, 4);
+    ASSERT_EQ(messages.size(), 4);
+    EXPECT_EQ(messages.at(0).error, ReceivePipeline::NoError);
+    EXPECT_EQ(messages.at(0).sequenceNumber, 1);
+    EXPECT_EQ(messages.at(1).error, ReceivePipeline::NoError);
+    EXPECT_EQ(messages.at(1).sequenceNumber, 2);
+    EXPECT_EQ(messages.at(2).error, ReceivePipeline::BadSequenceNumber);
+    EXPECT_EQ(messages.at(3).error, ReceivePipeline::BadSequenceNumber);
+    EXPECT_TRUE(pipeline.isEmpty());
+}
+
+TEST(receivepipeline, badIvIsMalformed) {
+    auto key = Cryptography::randomBytes(32);
+    auto hmacKey = Cryptography::randomBytes(32);
+    CryptoSession session(key, key, hmacKey, hmacKey);
+
+    // The signature checks out, but the IV is too short, too long or missing, so nothing is decrypted
+    for (const auto& iv : {Cryptography::randomBytes(8), Cryptography::randomBytes(17), QByteArray()}) {
+        ReceivePipeline::Message message;
+        EXPECT_EQ(ReceivePipeline::open(frameWithIv(iv, &session), &session, &message), ReceivePipeline::Malformed);
+    }
+
+    ReceivePipeline::Message message;
+    EXPECT_EQ(ReceivePipeline::open(frameFor(1, &session), &session, &message), ReceivePipeline::NoError);
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/cryptography.h"
+#include "nearbyshare/cryptosession.h"
+#include "nearbyshare/sendpipeline.h"
+#include "nearbyshare/spscqueue.h"
+#include "gtest/gtest.h"
+#include <QThread>
+#include <thread>
+
+namespace {
+    QList<PayloadFrameEncoder::Chunk> chunksOf(const QByteArray& data, qint64 offset, qsizetype chunkSize) {
+        QList<PayloadFrameEncoder::Chunk> chunks;
+        for (qsizetype position = 0; position < data.size(); position += chunkSize) {
+            PayloadFrameEncoder::Chunk chunk;
+            chunk.id = 11;
+            chunk.payloadType = location::nearby::connections::PayloadTransferFrame_PayloadHeader_PayloadType_FILE;
+            chunk.totalSize = 64 * 1024 * 1024;
+            chunk.offset = offset + position;
+            chunk.flags = 0;
+            chunk.body = QByteArrayView(data).sliced(position, qMin(chunkSize, data.size() - position));
+            chunks.append(chunk);
+        }
+        return chunks;
+    }
+
+    QList<QByteArray> ivsFor(qsizetype count) {
+        QList<QByteArray> ivs;
+        for (auto i = 0; i < count; i++) ivs.append(Cryptography::randomBytes(16));
+        return ivs;
+    }
+
+    QQueue<QByteArray> drain(SendPipeline* pipeline) {
+        QQueue<QByteArray> frames;
+        while (!pipeline->isEmpty()) {
+            EXPECT_TRUE(pipeline->takeFrames(&frames));
+            QThread::yieldCurrentThread();
+        }
+        return frames;
+    }
+} // namespace
+
+TEST(spscqueue, twoThreads) {
+    SpscQueue<qsizetype> queue(5);
+    constexpr qsizetype count = 200000;
+
+    std::thread producer([&queue] {
+        for (qsizetype i = 0; i < count; i++) {
+            auto value = i;
+            while (!queue.push(std::move(value))) std::this_thread::yield();
+        }
+    });
+
+    qsizetype expected = 0;
+    while (expected < count) {
+        qsizetype value;
+        if (!queue.pop(&value)) {
+            std::this_thread::yield();
+            continue;
+        }
+        ASSERT_EQ(value, expected);
+        expected++;
+    }
+    producer.join();
+    EXPECT_TRUE(queue.isEmpty());
+}
+
+TEST(sendpipeline, keepsSubmissionOrder) {
+    auto key = Cryptography::randomBytes(32);
+    auto hmacKey = Cryptography::randomBytes(32);
+    CryptoSession session(key, key, hmacKey, hmacKey);
+
+    std::atomic<int> notifications = 0;
+    SendPipeline pipeline(&session, [&notifications] {
+        notifications++;
+    }, 3);
+    EXPECT_EQ(pipeline.lanes(), 3);
+
+    // More jobs than the lanes take, so some are encoded inline, with finished frames in between
+    QByteArray data(200 * 1024, 'P');
+    QList<QByteArray> expected;
+    qint32 sequenceNumber = 1;
+    for (auto job = 0; job < 10; job++) {
+        auto chunks = chunksOf(data, job * data.size(), 64 * 1024);
+        auto ivs = ivsFor(chunks.size());
+        pipeline.encode(chunks, sequenceNumber, ivs, {data});
+        expected.append(PayloadFrameEncoder::encode(chunks, sequenceNumber, ivs, &session));
+        sequenceNumber += chunks.size();
+
+        auto control = QByteArray("control frame ") + QByteArray::number(job);
+        pipeline.append(control);
+        expected.append(control);
+    }
+    pipeline.append({});
+    expected.append(QByteArray());
+
+    auto frames = drain(&pipeline);
+    ASSERT_EQ(frames.size(), expected.size());
+    for (auto i = 0; i < frames.size(); i++) {
+        EXPECT_EQ(frames.at(i), expected.at(i)) << "frame " << i;
+    }
+    EXPECT_GT(notifications, 0);
+    EXPECT_FALSE(pipeline.isFull());
+}
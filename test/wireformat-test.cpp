@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2023 Victor Tran
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "nearbyshare/wireformat.h"
+#include "gtest/gtest.h"
+#include "offline_wire_formats.pb.h"
+
+TEST(wireformat, payloadChunk) {
+    location::nearby::connections::PayloadTransferFrame_PayloadChunk chunk;
+    chunk.set_flags(location::nearby::connections::PayloadTransferFrame_PayloadChunk_Flags_LAST_CHUNK);
+    chunk.set_offset(1234567890123);
+    chunk.set_body(std::string(1000, 'B'));
+    auto serialized = chunk.SerializeAsString();
+
+    quint64 flags = 0;
+    quint64 offset = 0;
+    QByteArrayView body;
+
+    WireFormat::Reader reader(QByteArrayView(serialized.data(), serialized.size()));
+    while (reader.next()) {
+        switch (reader.fieldNumber()) {
+            case location::nearby::connections::PayloadTransferFrame_PayloadChunk::kFlagsFieldNumber:
+                flags = reader.varint();
+                break;
+            case location::nearby::connections::PayloadTransferFrame_PayloadChunk::kOffsetFieldNumber:
+                offset = reader.varint();
+                break;
+            case location::nearby::connections::PayloadTransferFrame_PayloadChunk::kBodyFieldNumber:
+                body = reader.bytes();
+                break;
+        }
+    }
+
+    EXPECT_FALSE(reader.error());
+    EXPECT_EQ(flags, location::nearby::connections::PayloadTransferFrame_PayloadChunk_Flags_LAST_CHUNK);
+    EXPECT_EQ(offset, 1234567890123ull);
+    EXPECT_EQ(body.toByteArray(), QByteArray(1000, 'B'));
+
+    // The body must be a view into the serialized message, not a copy
+    EXPECT_GE(body.data(), serialized.data());
+    EXPECT_LT(body.data(), serialized.data() + serialized.size());
+}
+
+TEST(wireformat, truncated) {
+    location::nearby::connections::PayloadTransferFrame_PayloadChunk chunk;
+    chunk.set_body("HELLO WORLD");
+    auto serialized = chunk.SerializeAsString();
+
+    QByteArrayView body;
+    EXPECT_TRUE(WireFormat::findBytes(QByteArrayView(serialized.data(), serialized.size()), location::nearby::connections::PayloadTransferFrame_PayloadChunk::kBodyFieldNumber, &body));
+    EXPECT_FALSE(WireFormat::findBytes(QByteArrayView(serialized.data(), serialized.size() - 1), location::nearby::connections::PayloadTransferFrame_PayloadChunk::kBodyFieldNumber, &body));
+    EXPECT_FALSE(WireFormat::findBytes(QByteArrayView(serialized.data(), serialized.size()), location::nearby::connections::PayloadTransferFrame_PayloadChunk::kOffsetFieldNumber, &body));
+}